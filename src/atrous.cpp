@@ -0,0 +1,124 @@
+#include "atrous.h"
+#include <algorithm>
+#include <cmath>
+#include "parallel.h"
+
+namespace {
+
+// B3 スプライン
+const float KERNEL[3] = {3.0f / 8.0f, 1.0f / 4.0f, 1.0f / 16.0f};
+
+float luminance(const glm::vec3& color) {
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+glm::vec3 demodulate(const glm::vec3& color, const glm::vec3& albedo) {
+    return color / glm::max(albedo, glm::vec3(1e-3f));
+}
+
+} // namespace
+
+void atrousFilter(std::vector<glm::vec4>& image, const std::vector<GBufferTexel>& gbuffer, int width, int height,
+                  const AtrousOptions& options, const std::vector<float>* variance) {
+    int numPixels = width * height;
+    // rgb: アルベドで割った色, a: 輝度の分散
+    std::vector<glm::vec4> current(numPixels);
+    std::vector<glm::vec4> next(numPixels);
+
+    // 3x3 の近傍から輝度の分散を見積もる (atrous.glsl の prepare)
+    parallelFor(0, numPixels, [&](int pixel) {
+        int x = pixel % width;
+        int y = pixel / width;
+        glm::vec3 color = demodulate(glm::vec3(image[pixel]), gbuffer[pixel].albedo);
+        if (variance) {
+            current[pixel] = glm::vec4(color, (*variance)[pixel]);
+            return;
+        }
+        float sum = 0.0f;
+        float sumSquared = 0.0f;
+        int count = 0;
+        for (int dy = -1; dy <= 1; ++dy) {
+            for (int dx = -1; dx <= 1; ++dx) {
+                int qx = x + dx;
+                int qy = y + dy;
+                if (qx < 0 || qy < 0 || qx >= width || qy >= height) continue;
+                int q = qy * width + qx;
+                if (gbuffer[q].depth < 0.0f) continue;
+                float l = luminance(demodulate(glm::vec3(image[q]), gbuffer[q].albedo));
+                sum += l;
+                sumSquared += l * l;
+                ++count;
+            }
+        }
+        float mean = count > 0 ? sum / count : 0.0f;
+        float variance = count > 0 ? std::max(sumSquared / count - mean * mean, 0.0f) : 0.0f;
+        current[pixel] = glm::vec4(color, variance);
+    });
+
+    for (int iteration = 0; iteration < options.iterations; ++iteration) {
+        int step = 1 << iteration;
+        parallelFor(0, numPixels, [&](int pixel) {
+            const GBufferTexel& center = gbuffer[pixel];
+            const glm::vec4& centerColor = current[pixel];
+            // 背景はそのまま
+            if (center.depth < 0.0f) {
+                next[pixel] = centerColor;
+                return;
+            }
+            int x = pixel % width;
+            int y = pixel / width;
+
+            // 分散は 3x3 でぼかしてから使う
+            float variance = 0.0f;
+            float varianceWeight = 0.0f;
+            for (int dy = -1; dy <= 1; ++dy) {
+                for (int dx = -1; dx <= 1; ++dx) {
+                    int qx = x + dx;
+                    int qy = y + dy;
+                    if (qx < 0 || qy < 0 || qx >= width || qy >= height) continue;
+                    float w = (dx == 0 ? 0.5f : 0.25f) * (dy == 0 ? 0.5f : 0.25f);
+                    variance += w * current[qy * width + qx].w;
+                    varianceWeight += w;
+                }
+            }
+            float phiColor = options.colorPhi * std::sqrt(std::max(variance / varianceWeight, 0.0f)) + 1e-4f;
+            float centerLuminance = luminance(glm::vec3(centerColor));
+
+            glm::vec3 sum(0.0f);
+            float sumVariance = 0.0f;
+            float sumWeight = 0.0f;
+            for (int dy = -2; dy <= 2; ++dy) {
+                for (int dx = -2; dx <= 2; ++dx) {
+                    int qx = x + dx * step;
+                    int qy = y + dy * step;
+                    if (qx < 0 || qy < 0 || qx >= width || qy >= height) continue;
+                    int q = qy * width + qx;
+                    const GBufferTexel& tap = gbuffer[q];
+                    if (tap.depth < 0.0f) continue;
+                    const glm::vec4& color = current[q];
+
+                    float offset = static_cast<float>(step) * std::sqrt(static_cast<float>(dx * dx + dy * dy));
+                    float depthScale = options.depthPhi * center.depth * offset + 1e-6f;
+                    float depthTerm = std::fabs(center.depth - tap.depth) / depthScale;
+                    float colorTerm = std::fabs(centerLuminance - luminance(glm::vec3(color))) / phiColor;
+                    float normalWeight =
+                        std::pow(std::max(glm::dot(center.normal, tap.normal), 0.0f), options.normalPhi);
+                    float w = KERNEL[std::abs(dx)] * KERNEL[std::abs(dy)] * normalWeight *
+                              std::exp(-depthTerm - colorTerm);
+
+                    sum += w * glm::vec3(color);
+                    sumVariance += w * w * color.w;
+                    sumWeight += w;
+                }
+            }
+            // 中心は必ず重み KERNEL[0]^2 で入る
+            next[pixel] = glm::vec4(sum / sumWeight, sumVariance / (sumWeight * sumWeight));
+        });
+        current.swap(next);
+    }
+
+    parallelFor(0, numPixels, [&](int pixel) {
+        glm::vec3 color = glm::vec3(current[pixel]) * glm::max(gbuffer[pixel].albedo, glm::vec3(1e-3f));
+        image[pixel] = glm::vec4(color, image[pixel].w);
+    });
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// 一次レイの当たった面. Tracer::render と compute_raytracing_1.glsl の GBUFFER が書く
+struct GBufferTexel {
+    glm::vec3 normal;
+    float depth;        // 当たった距離. 当たらなければ負
+    glm::vec3 albedo;
+    glm::vec3 position; // 当たった点. TemporalAccumulator が前のフレームの画素を求めるのに使う
+};
+
+// atrous.glsl の定数と同じ
+struct AtrousOptions {
+    int iterations;     // i 回目は 2^i 画素おきの 5x5 タップ
+    float colorPhi;     // 輝度の差を分散の標準偏差の何倍まで許すか
+    float normalPhi;    // dot(n, nq) の指数
+    float depthPhi;     // 1 画素あたりに許す距離の差 (距離に対する比)
+
+    AtrousOptions() : iterations(5), colorPhi(3.0f), normalPhi(128.0f), depthPhi(0.005f) {}
+};
+
+// 法線, 距離, 輝度で重みを止める à-trous ウェーブレットフィルタ (SVGF の空間フィルタ).
+// アルベドで割った照明を 3x3 の分散で案内しながらぼかし, 最後にアルベドを掛け直す.
+// variance を渡すと 3x3 の見積もりの代わりに使う (TemporalAccumulator::accumulate の時間方向の分散).
+// Denoiser (denoiser.cpp) が GPU で同じ計算をする
+void atrousFilter(std::vector<glm::vec4>& image, const std::vector<GBufferTexel>& gbuffer, int width, int height,
+                  const AtrousOptions& options = AtrousOptions(), const std::vector<float>* variance = nullptr);
@@ -0,0 +1,117 @@
+#include "autotune.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "cshader.h"
+
+namespace {
+
+const int WARMUP_DISPATCHES = 2;
+const int TIMED_DISPATCHES = 5;
+
+struct Candidate {
+    int x;
+    int y;
+};
+
+const Candidate CANDIDATES[] = {{8, 8}, {16, 8}, {32, 4}, {64, 1}};
+
+std::string glString(GLenum name) {
+    const GLubyte* value = glGetString(name);
+    return value ? reinterpret_cast<const char*>(value) : "";
+}
+
+} // namespace
+
+WorkgroupAutotuner::WorkgroupAutotuner(const std::string& path) : path(path) {
+}
+
+// 1 行に 1 つ: キー '\t' localSizeX localSizeY morton
+bool WorkgroupAutotuner::lookup(const std::string& key, ShaderVariant& variant) const {
+    std::ifstream file(path);
+    std::string line;
+    bool found = false;
+    while (std::getline(file, line)) {
+        size_t tab = line.rfind('\t');
+        if (tab == std::string::npos || line.compare(0, tab, key) != 0 || tab != key.size()) continue;
+
+        std::istringstream values(line.substr(tab + 1));
+        int x = 0, y = 0, morton = 0;
+        if (values >> x >> y >> morton && x > 0 && y > 0) {
+            variant = variant.withWorkgroup(x, y, morton != 0);
+            found = true; // 後の行を優先する
+        }
+    }
+    return found;
+}
+
+void WorkgroupAutotuner::save(const std::string& key, const ShaderVariant& variant) const {
+    std::ofstream file(path, std::ios::app);
+    if (!file) {
+        std::cerr << "WorkgroupAutotuner: failed to write " << path << std::endl;
+        return;
+    }
+    file << key << '\t' << variant.localSizeX << ' ' << variant.localSizeY << ' ' << (variant.mortonSwizzle ? 1 : 0)
+         << '\n';
+}
+
+double WorkgroupAutotuner::measure(const char* kernelPath, const ShaderVariant& variant, GLuint outputTexture,
+                                   int width, int height, ProgramCache* cache) const {
+    Cshader shader(kernelPath, variant.defines(), cache);
+    shader.use();
+    glBindImageTexture(0, outputTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, outputInternalFormat(variant.outputFormat));
+
+    for (int i = 0; i < WARMUP_DISPATCHES; ++i) {
+        glDispatchCompute(variant.groupsX(width), variant.groupsY(height), 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+
+    GLuint query;
+    glGenQueries(1, &query);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    for (int i = 0; i < TIMED_DISPATCHES; ++i) {
+        glDispatchCompute(variant.groupsX(width), variant.groupsY(height), 1);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+    }
+    glEndQuery(GL_TIME_ELAPSED);
+
+    // 起動時に一度だけなので結果を待ってよい
+    GLuint64 elapsedNs = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsedNs);
+    glDeleteQueries(1, &query);
+    glDeleteProgram(shader.ID);
+    return elapsedNs / 1e6 / TIMED_DISPATCHES;
+}
+
+ShaderVariant WorkgroupAutotuner::tune(const char* kernelPath, const ShaderVariant& base, const std::string& sceneKey,
+                                       GLuint outputTexture, int width, int height, ProgramCache* cache) {
+    std::ostringstream key;
+    key << glString(GL_RENDERER) << " | " << glString(GL_VERSION) << " | " << sceneKey << " | " << width << "x"
+        << height << " | traversal " << static_cast<int>(base.traversal) << " | "
+        << outputFormatName(base.outputFormat);
+
+    ShaderVariant best = base;
+    if (lookup(key.str(), best)) {
+        std::cout << "workgroup: " << best.workgroupName() << " (saved)" << std::endl;
+        return best;
+    }
+
+    double bestMs = 0.0;
+    bool first = true;
+    for (const Candidate& candidate : CANDIDATES) {
+        for (int morton = 0; morton < 2; ++morton) {
+            ShaderVariant variant = base.withWorkgroup(candidate.x, candidate.y, morton != 0);
+            double ms = measure(kernelPath, variant, outputTexture, width, height, cache);
+            std::cout << "workgroup " << variant.workgroupName() << ": " << ms << " ms" << std::endl;
+            if (first || ms < bestMs) {
+                best = variant;
+                bestMs = ms;
+                first = false;
+            }
+        }
+    }
+
+    std::cout << "workgroup: " << best.workgroupName() << " (tuned)" << std::endl;
+    save(key.str(), best);
+    return best;
+}
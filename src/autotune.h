@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <glad/gl.h>
+#include "program_cache.h"
+#include "shader_variant.h"
+
+// 1 パスのカーネルのワークグループの形を選ぶ.
+// 候補 (8x8, 16x8, 32x4, 64x1 とそれぞれの Morton 版) を今のシーンとドライバで計測し,
+// 一番速いものを path に保存する. 同じキーで保存済みなら計測しない
+class WorkgroupAutotuner {
+public:
+    explicit WorkgroupAutotuner(const std::string& path);
+
+    // 呼ぶ前に BVH などの SSBO と FrameUniforms を用意しておくこと. outputTexture (形式は base.outputFormat) に描画する
+    ShaderVariant tune(const char* kernelPath, const ShaderVariant& base, const std::string& sceneKey,
+                       GLuint outputTexture, int width, int height, ProgramCache* cache = nullptr);
+
+private:
+    bool lookup(const std::string& key, ShaderVariant& variant) const;
+    void save(const std::string& key, const ShaderVariant& variant) const;
+    double measure(const char* kernelPath, const ShaderVariant& variant, GLuint outputTexture, int width, int height,
+                   ProgramCache* cache) const;
+
+    std::string path;
+};
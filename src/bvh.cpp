@@ -1,17 +1,104 @@
 #include "bvh.h"
 #include <algorithm>
+#include <iostream>
 #include <limits>
 
-BVH::BVH(const std::vector<Data>& inDataArray) : dataArray(inDataArray) {
-    buildBVH();
+namespace {
+
+const int MAX_BINS = 32;
+
+float surfaceArea(const glm::vec3& min, const glm::vec3& max) {
+    glm::vec3 extent = glm::max(max - min, glm::vec3(0.0f));
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+} // namespace
+
+// 構築中に並べ替える参照. 比較のたびに重心を計算しないように持っておく
+struct BVH::BuildRef {
+    glm::vec3 min;
+    int dataIndex;
+    glm::vec3 max;
+    glm::vec3 centroid;
+
+    BuildRef() {}
+    explicit BuildRef(const PrimRef& ref)
+        : min(ref.min), dataIndex(ref.dataIndex), max(ref.max), centroid((ref.min + ref.max) * 0.5f) {}
+};
+
+// 構築の作業用の配列. clear しても容量は残る
+struct BVH::Scratch {
+    std::vector<BuildRef> refs;
+    // optimizeLayout
+    std::vector<BVHNode> oldNodes;
+    std::vector<BuildRef> oldRefs;
+    std::vector<int> order;
+    std::vector<int> newIndex;
+    std::vector<int> treeletRoots;
+    std::vector<int> frontier;
+    std::vector<int> next;
+};
+
+BVH::BVH(const std::vector<Data>& inDataArray, const BVHBuildOptions& inOptions)
+    : options(inOptions), oversizedLeaves(0), scratch(nullptr) {
+    rebuild(inDataArray);
 }
 
-void BVH::buildBVH() {
-    nodes.reserve(2 * dataArray.size() - 1);
-    recursiveBuild(0, static_cast<int>(dataArray.size()), 0);
+BVH::BVH(const std::vector<Data>& inDataArray, const std::vector<PrimRef>& inRefs, const BVHBuildOptions& inOptions)
+    : options(inOptions), oversizedLeaves(0), scratch(nullptr) {
+    rebuild(inDataArray, inRefs);
+}
+
+void BVH::rebuild(const std::vector<Data>& inDataArray) {
+    scratch = &threadScratch();
+    scratch->refs.clear();
+    for (size_t i = 0; i < inDataArray.size(); ++i) {
+        scratch->refs.push_back(BuildRef(makePrimRef(inDataArray[i], static_cast<int>(i))));
+    }
+    buildBVH(inDataArray);
+}
+
+void BVH::rebuild(const std::vector<Data>& inDataArray, const std::vector<PrimRef>& inRefs) {
+    scratch = &threadScratch();
+    scratch->refs.clear();
+    for (const PrimRef& ref : inRefs) {
+        scratch->refs.push_back(BuildRef(ref));
+    }
+    buildBVH(inDataArray);
+}
+
+void BVH::buildBVH(const std::vector<Data>& inDataArray) {
+    const std::vector<BuildRef>& refs = scratch->refs;
+    nodes.clear();
+    dataArray.clear();
+    oversizedLeaves = 0;
+    if (refs.empty()) {
+        scratch = nullptr;
+        return;
+    }
+
+    nodes.reserve(2 * refs.size() - 1);
+    options.maxDepth = std::min(options.maxDepth, BVH_STACK_SIZE - 1);
+    options.numBins = std::max(2, std::min(options.numBins, MAX_BINS));
+    recursiveBuild(0, static_cast<int>(refs.size()), 0);
+
+    if (oversizedLeaves > 0) {
+        std::cerr << "BVH: " << oversizedLeaves << " leaves exceed maxLeafSize at depth limit" << std::endl;
+    }
+    if (options.treeletDepth > 0) {
+        optimizeLayout();
+    }
+
+    // 参照の並び順で三角形を並べる. 分割された三角形は複数の葉にコピーされる
+    dataArray.resize(refs.size());
+    for (size_t i = 0; i < refs.size(); ++i) {
+        dataArray[i] = inDataArray[refs[i].dataIndex];
+    }
+    scratch = nullptr;
 }
 
 int BVH::recursiveBuild(int start, int end, int depth) {
+    std::vector<BuildRef>& refs = scratch->refs;
     int nodeIndex = static_cast<int>(nodes.size());
     nodes.emplace_back();
     BVHNode& node = nodes.back();
@@ -20,38 +107,239 @@ int BVH::recursiveBuild(int start, int end, int depth) {
     glm::vec3 min(std::numeric_limits<float>::max());
     glm::vec3 max(std::numeric_limits<float>::lowest());
     for (int i = start; i < end; ++i) {
-        const Data& data = dataArray[i];
-        min = glm::min(min, glm::min(glm::vec3(data.v0), glm::min(glm::vec3(data.v1), glm::vec3(data.v2))));
-        max = glm::max(max, glm::max(glm::vec3(data.v0), glm::max(glm::vec3(data.v1), glm::vec3(data.v2))));
+        min = glm::min(min, refs[i].min);
+        max = glm::max(max, refs[i].max);
     }
-    node.min = glm::vec4(min, 0.0f);
-    node.max = glm::vec4(max, 0.0f);
+    node.min = min;
+    node.max = max;
+    node.parent = -1;
+    node.sibling = -1;
 
     int numData = end - start;
-    if (numData <= 4 || depth > 20) {
+    bool canSplit = numData > options.minLeafSize && depth < options.maxDepth;
+    Split split;
+    bool hasSplit = canSplit && findSplit(start, end, surfaceArea(min, max), split);
+
+    // 葉のコストと最良の分割のコストを比べる
+    float leafCost = options.intersectionCost * numData;
+    bool splitIsWorse = !hasSplit || split.cost >= leafCost;
+    if (!canSplit || (splitIsWorse && numData <= options.maxLeafSize)) {
         // 葉ノード
+        if (numData > options.maxLeafSize) ++oversizedLeaves;
         node.data = glm::ivec4(-1, -1, start, numData);
-    } else {
-        // 内部ノード
-        int axis = depth % 3;
-        int mid = (start + end) / 2;
+        return nodeIndex;
+    }
+
+    // 内部ノード
+    int mid = start;
+    if (hasSplit) {
+        mid = static_cast<int>(std::partition(refs.begin() + start, refs.begin() + end,
+                                              [&](const BuildRef& ref) {
+                                                  return binIndex(ref, split) <= split.bin;
+                                              }) - refs.begin());
+    }
+
+    // SAH で分けられない (重心が重なっている) 場合は最長軸の中央で分ける
+    if (mid == start || mid == end) {
+        glm::vec3 extent = max - min;
+        int axis = 0;
+        if (extent.y > extent.x && extent.y > extent.z) {
+            axis = 1;
+        } else if (extent.z > extent.x) {
+            axis = 2;
+        }
+        mid = (start + end) / 2;
 
         // データを軸に沿ってソート
-        std::nth_element(dataArray.begin() + start,
-                         dataArray.begin() + mid,
-                         dataArray.begin() + end,
-                         [&](const Data& a, const Data& b) {
-                             return calculateCentroid(a)[axis] < calculateCentroid(b)[axis];
+        std::nth_element(refs.begin() + start,
+                         refs.begin() + mid,
+                         refs.begin() + end,
+                         [&](const BuildRef& a, const BuildRef& b) {
+                             return a.centroid[axis] < b.centroid[axis];
                          });
-
-        int leftChild = recursiveBuild(start, mid, depth + 1);
-        int rightChild = recursiveBuild(mid, end, depth + 1);
-        node.data = glm::ivec4(leftChild, rightChild, -1, -1);
     }
 
+    int leftChild = recursiveBuild(start, mid, depth + 1);
+    int rightChild = recursiveBuild(mid, end, depth + 1);
+    node.data = glm::ivec4(leftChild, rightChild, -1, -1);
+
+    // スタックレスなトラバーサル用のリンク
+    nodes[leftChild].parent = nodeIndex;
+    nodes[leftChild].sibling = rightChild;
+    nodes[rightChild].parent = nodeIndex;
+    nodes[rightChild].sibling = leftChild;
+
     return nodeIndex;
 }
 
-glm::vec3 BVH::calculateCentroid(const Data& data) const {
-    return (glm::vec3(data.v0) + glm::vec3(data.v1) + glm::vec3(data.v2)) / 3.0f;
-}
\ No newline at end of file
+// ノードを treelet 単位で並べ替える. 兄弟は隣り合わせ (左が先) に置き,
+// treelet 内は幅優先, treelet 同士は深さ優先の順にする.
+// 三角形は新しい順序で葉が現れる順に詰め直す
+// 古い配列は作業用の配列に写してから並べ直す (swap すると容量が木と作業用の配列の間を行き来する)
+void BVH::optimizeLayout() {
+    std::vector<BuildRef>& refs = scratch->refs;
+    std::vector<BVHNode>& oldNodes = scratch->oldNodes;
+    std::vector<BuildRef>& oldRefs = scratch->oldRefs;
+    std::vector<int>& order = scratch->order;
+    std::vector<int>& newIndex = scratch->newIndex;
+    // ノードの数は構築ごとに少し変わるので, 上限の 2n - 1 個分を確保しておく
+    size_t maxNodes = 2 * refs.size() - 1;
+    oldNodes.reserve(maxNodes);
+    order.reserve(maxNodes);
+    newIndex.reserve(maxNodes);
+    oldNodes.assign(nodes.begin(), nodes.end());
+    oldRefs.assign(refs.begin(), refs.end());
+    nodes.clear();
+    refs.clear();
+
+    order.clear();
+    newIndex.assign(oldNodes.size(), -1);
+    order.push_back(0);
+    newIndex[0] = 0;
+
+    std::vector<int>& treeletRoots = scratch->treeletRoots;
+    std::vector<int>& frontier = scratch->frontier;
+    std::vector<int>& next = scratch->next;
+    treeletRoots.assign(1, 0);
+    while (!treeletRoots.empty()) {
+        int root = treeletRoots.back();
+        treeletRoots.pop_back();
+
+        frontier.assign(1, root);
+        for (int level = 0; level < options.treeletDepth && !frontier.empty(); ++level) {
+            next.clear();
+            for (int index : frontier) {
+                const BVHNode& node = oldNodes[index];
+                if (node.dataOffset >= 0) continue;
+                newIndex[node.left] = static_cast<int>(order.size());
+                order.push_back(node.left);
+                newIndex[node.right] = static_cast<int>(order.size());
+                order.push_back(node.right);
+                next.push_back(node.left);
+                next.push_back(node.right);
+            }
+            frontier.swap(next);
+        }
+
+        // 左の treelet から処理されるように逆順に積む
+        for (int i = static_cast<int>(frontier.size()) - 1; i >= 0; --i) {
+            if (oldNodes[frontier[i]].dataOffset < 0) {
+                treeletRoots.push_back(frontier[i]);
+            }
+        }
+    }
+
+    for (int oldIndex : order) {
+        BVHNode node = oldNodes[oldIndex];
+        if (node.parent >= 0) {
+            node.parent = newIndex[node.parent];
+            node.sibling = newIndex[node.sibling];
+        }
+        if (node.dataOffset >= 0) {
+            int offset = static_cast<int>(refs.size());
+            refs.insert(refs.end(), oldRefs.begin() + node.dataOffset, oldRefs.begin() + node.dataOffset + node.dataCount);
+            node.dataOffset = offset;
+        } else {
+            node.left = newIndex[node.left];
+            node.right = newIndex[node.right];
+        }
+        nodes.push_back(node);
+    }
+}
+
+// 重心をビンに分けて SAH のコストが最小になる分割を探す
+bool BVH::findSplit(int start, int end, float nodeArea, Split& split) const {
+    const std::vector<BuildRef>& refs = scratch->refs;
+    glm::vec3 centroidMin(std::numeric_limits<float>::max());
+    glm::vec3 centroidMax(std::numeric_limits<float>::lowest());
+    for (int i = start; i < end; ++i) {
+        centroidMin = glm::min(centroidMin, refs[i].centroid);
+        centroidMax = glm::max(centroidMax, refs[i].centroid);
+    }
+
+    int numBins = options.numBins;
+    glm::vec3 extent = centroidMax - centroidMin;
+    split.cost = std::numeric_limits<float>::max();
+    split.centroidMin = centroidMin;
+    for (int axis = 0; axis < 3; ++axis) {
+        split.binScale[axis] = extent[axis] > 0.0f ? numBins / extent[axis] : 0.0f;
+    }
+    if (nodeArea <= 0.0f) return false;
+
+    bool found = false;
+    for (int axis = 0; axis < 3; ++axis) {
+        if (extent[axis] <= 0.0f) continue;
+
+        int counts[MAX_BINS] = {};
+        glm::vec3 binMin[MAX_BINS];
+        glm::vec3 binMax[MAX_BINS];
+        for (int b = 0; b < numBins; ++b) {
+            binMin[b] = glm::vec3(std::numeric_limits<float>::max());
+            binMax[b] = glm::vec3(std::numeric_limits<float>::lowest());
+        }
+
+        Split candidate = split;
+        candidate.axis = axis;
+        for (int i = start; i < end; ++i) {
+            int b = binIndex(refs[i], candidate);
+            ++counts[b];
+            binMin[b] = glm::min(binMin[b], refs[i].min);
+            binMax[b] = glm::max(binMax[b], refs[i].max);
+        }
+
+        // 右側から累積した面積と個数
+        float rightArea[MAX_BINS];
+        int rightCount[MAX_BINS];
+        glm::vec3 accMin(std::numeric_limits<float>::max());
+        glm::vec3 accMax(std::numeric_limits<float>::lowest());
+        int accCount = 0;
+        for (int b = numBins - 1; b > 0; --b) {
+            accMin = glm::min(accMin, binMin[b]);
+            accMax = glm::max(accMax, binMax[b]);
+            accCount += counts[b];
+            rightArea[b] = accCount > 0 ? surfaceArea(accMin, accMax) : 0.0f;
+            rightCount[b] = accCount;
+        }
+
+        accMin = glm::vec3(std::numeric_limits<float>::max());
+        accMax = glm::vec3(std::numeric_limits<float>::lowest());
+        accCount = 0;
+        for (int b = 0; b < numBins - 1; ++b) {
+            accMin = glm::min(accMin, binMin[b]);
+            accMax = glm::max(accMax, binMax[b]);
+            accCount += counts[b];
+            if (accCount == 0 || rightCount[b + 1] == 0) continue;
+
+            float leftArea = surfaceArea(accMin, accMax);
+            float cost = options.traversalCost + options.intersectionCost *
+                         (leftArea * accCount + rightArea[b + 1] * rightCount[b + 1]) / nodeArea;
+            if (cost < split.cost) {
+                split.cost = cost;
+                split.axis = axis;
+                split.bin = b;
+                found = true;
+            }
+        }
+    }
+    return found;
+}
+
+int BVH::binIndex(const BuildRef& ref, const Split& split) const {
+    int axis = split.axis;
+    int b = static_cast<int>((ref.centroid[axis] - split.centroidMin[axis]) * split.binScale[axis]);
+    return std::max(0, std::min(options.numBins - 1, b));
+}
+
+// スレッドごとに一つ. 並列に構築しても取り合わない
+BVH::Scratch& BVH::threadScratch() {
+    static thread_local Scratch scratch;
+    return scratch;
+}
+
+PrimRef makePrimRef(const Data& data, int dataIndex) {
+    PrimRef ref;
+    ref.min = glm::min(glm::vec3(data.v0), glm::min(glm::vec3(data.v1), glm::vec3(data.v2)));
+    ref.max = glm::max(glm::vec3(data.v0), glm::max(glm::vec3(data.v1), glm::vec3(data.v2)));
+    ref.dataIndex = dataIndex;
+    return ref;
+}
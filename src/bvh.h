@@ -5,8 +5,10 @@
 #include "util.h"
 
 struct BVHNode {
-    glm::vec4 min;          // 16 bytes
-    glm::vec4 max;          // 16 bytes
+    glm::vec3 min;
+    int parent;             // 16 bytes, -1 for the root
+    glm::vec3 max;
+    int sibling;            // 16 bytes, -1 for the root
     union {
         struct {
             int left;
@@ -18,19 +20,70 @@ struct BVHNode {
     };
 };
 
+// シェーダーのトラバーサルスタックの大きさ. 木の深さは BVH_STACK_SIZE - 1 を超えない
+const int BVH_STACK_SIZE = 64;
+
+struct BVHBuildOptions {
+    int minLeafSize;        // これ以下なら必ず葉にする
+    int maxLeafSize;        // これを超える葉は深さ上限に達したときしか作らない
+    int maxDepth;
+    int numBins;            // SAH のビン数
+    float traversalCost;
+    float intersectionCost;
+    int treeletDepth;       // 構築後の並べ替えで一塊にする深さ. 0 なら並べ替えない
+
+    BVHBuildOptions()
+        : minLeafSize(1), maxLeafSize(8), maxDepth(BVH_STACK_SIZE - 1), numBins(16),
+          traversalCost(1.0f), intersectionCost(1.0f), treeletDepth(3) {}
+};
+
+// 三角形への参照. presplit で一つの三角形が複数の参照に分かれることがある
+struct PrimRef {
+    glm::vec3 min;
+    glm::vec3 max;
+    int dataIndex;          // 入力 dataArray のインデックス
+};
+
+// 構築の作業用の配列 (参照, 重心, 並べ替え用の一時配列) はスレッドごとに持ち, 構築の間で使い回す.
+// rebuild はノードと三角形の配列の容量も使い回すので, 同じくらいの大きさの木を作り直してもヒープを確保しない
 class BVH {
 public:
-    BVH(const std::vector<Data>& dataArray);
+    BVH(const std::vector<Data>& dataArray, const BVHBuildOptions& options = BVHBuildOptions());
+    // 参照のバウンディングボックスで構築する. 葉には参照先の三角形がコピーされる
+    BVH(const std::vector<Data>& dataArray, const std::vector<PrimRef>& refs,
+        const BVHBuildOptions& options = BVHBuildOptions());
     ~BVH() = default;
 
+    // 同じ options で作り直す. アニメーションなどで毎フレーム構築するときに使う
+    void rebuild(const std::vector<Data>& dataArray);
+    void rebuild(const std::vector<Data>& dataArray, const std::vector<PrimRef>& refs);
+
     const std::vector<BVHNode>& getNodes() const { return nodes; }
     const std::vector<Data>& getDataArray() const { return dataArray; }
 
 private:
-    void buildBVH();
+    struct BuildRef;
+    struct Scratch;
+    static Scratch& threadScratch();
+
+    void buildBVH(const std::vector<Data>& inDataArray);
     int recursiveBuild(int start, int end, int depth);
-    glm::vec3 calculateCentroid(const Data& data) const;
-    
+    struct Split {
+        int axis;
+        int bin;
+        float cost;
+        glm::vec3 centroidMin;
+        glm::vec3 binScale;
+    };
+    bool findSplit(int start, int end, float nodeArea, Split& split) const;
+    int binIndex(const BuildRef& ref, const Split& split) const;
+    void optimizeLayout();
+
+    BVHBuildOptions options;
+    int oversizedLeaves;
     std::vector<BVHNode> nodes;
     std::vector<Data> dataArray;
-};
\ No newline at end of file
+    Scratch* scratch;       // 構築の間だけ, このスレッドの作業用の配列を指す
+};
+
+PrimRef makePrimRef(const Data& data, int dataIndex);
@@ -15,6 +15,11 @@ glm::mat4 Camera::GetViewMatrix() {
     return glm::lookAt(Position, Position + Front, Up);
 }
 
+glm::mat4 Camera::GetViewProjectionMatrix(float aspectRatio) const {
+    return glm::perspective(glm::radians(Zoom), aspectRatio, 0.01f, 1000.0f) *
+           glm::lookAt(Position, Position + Front, Up);
+}
+
 // キーボード入力を処理
 void Camera::ProcessKeyboard(Camera_Movement direction, float deltaTime) {
     float velocity = MovementSpeed * deltaTime;
@@ -45,6 +45,8 @@ public:
 
     // ビューマトリックスを返す
     glm::mat4 GetViewMatrix();
+    // compute_raytracing_1.glsl の rayDirection と同じ投影 (Zoom は縦の画角) とビューを掛けたもの
+    glm::mat4 GetViewProjectionMatrix(float aspectRatio) const;
 
     // キーボード入力を処理
     void ProcessKeyboard(Camera_Movement direction, float deltaTime);
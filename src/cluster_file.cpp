@@ -0,0 +1,212 @@
+#include "cluster_file.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+namespace {
+
+const char MAGIC[8] = {'R', 'T', 'P', 'A', 'G', 'E', 'S', '\0'};
+
+void hashWord(uint64_t& hash, uint64_t word) {
+    hash ^= word;
+    hash *= 1099511628211ull;
+}
+
+glm::vec3 centroid(const Data& triangle) {
+    return (glm::vec3(triangle.v0) + glm::vec3(triangle.v1) + glm::vec3(triangle.v2)) / 3.0f;
+}
+
+// 三角形の番号を重心の最長軸の中央値で二つに分けていき, 上位の木の節とクラスタのページを書く
+class ClusterWriter {
+public:
+    ClusterWriter(std::ofstream& file, const std::vector<Data>& triangles, const ClusterFileOptions& options)
+        : failed(false), file(file), triangles(triangles), options(options), order(triangles.size()) {
+        for (size_t i = 0; i < order.size(); ++i) order[i] = static_cast<int>(i);
+    }
+
+    void build() {
+        if (!order.empty()) recursiveBuild(0, static_cast<int>(order.size()), -1);
+    }
+
+    std::vector<BVHNode> topNodes;
+    std::vector<ClusterRecord> clusters;
+    bool failed;
+
+private:
+    int recursiveBuild(int start, int end, int parent) {
+        int index = static_cast<int>(topNodes.size());
+        topNodes.push_back(BVHNode());
+        BVHNode node;
+        node.parent = parent;
+        node.sibling = -1;
+
+        glm::vec3 centroidMin(std::numeric_limits<float>::max());
+        glm::vec3 centroidMax(std::numeric_limits<float>::lowest());
+        node.min = centroidMin;
+        node.max = centroidMax;
+        for (int i = start; i < end; ++i) {
+            const Data& triangle = triangles[order[i]];
+            node.min = glm::min(node.min, glm::min(glm::vec3(triangle.v0), glm::min(glm::vec3(triangle.v1), glm::vec3(triangle.v2))));
+            node.max = glm::max(node.max, glm::max(glm::vec3(triangle.v0), glm::max(glm::vec3(triangle.v1), glm::vec3(triangle.v2))));
+            centroidMin = glm::min(centroidMin, centroid(triangle));
+            centroidMax = glm::max(centroidMax, centroid(triangle));
+        }
+
+        if (end - start <= options.maxClusterTriangles) {
+            node.data = glm::ivec4(-1, -1, static_cast<int>(clusters.size()), 1);
+            writePage(start, end, node.min, node.max);
+            topNodes[index] = node;
+            return index;
+        }
+
+        glm::vec3 extent = centroidMax - centroidMin;
+        int axis = extent.y > extent.x ? 1 : 0;
+        if (extent.z > extent[axis]) axis = 2;
+        int mid = start + (end - start) / 2;
+        std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&](int a, int b) {
+            return centroid(triangles[a])[axis] < centroid(triangles[b])[axis];
+        });
+
+        int left = recursiveBuild(start, mid, index);
+        int right = recursiveBuild(mid, end, index);
+        topNodes[left].sibling = right;
+        topNodes[right].sibling = left;
+        node.data = glm::ivec4(left, right, -1, 0);
+        topNodes[index] = node;
+        return index;
+    }
+
+    void writePage(int start, int end, const glm::vec3& min, const glm::vec3& max) {
+        std::vector<Data> pageTriangles;
+        pageTriangles.reserve(end - start);
+        for (int i = start; i < end; ++i) pageTriangles.push_back(triangles[order[i]]);
+        // presplit はしない. 参照が増えるとページの容量を超える
+        BVH bvh(pageTriangles);
+        const std::vector<BVHNode>& nodes = bvh.getNodes();
+        const std::vector<Data>& data = bvh.getDataArray();
+
+        uint64_t offset = static_cast<uint64_t>(file.tellp());
+        offset = (offset + ClusterFile::PAGE_ALIGNMENT - 1) / ClusterFile::PAGE_ALIGNMENT * ClusterFile::PAGE_ALIGNMENT;
+        file.seekp(static_cast<std::streamoff>(offset));
+        file.write(reinterpret_cast<const char*>(nodes.data()), nodes.size() * sizeof(BVHNode));
+        file.write(reinterpret_cast<const char*>(data.data()), data.size() * sizeof(Data));
+        if (!file) failed = true;
+
+        ClusterRecord record;
+        record.min = min;
+        record.max = max;
+        record.nodeCount = static_cast<uint32_t>(nodes.size());
+        record.triangleCount = static_cast<uint32_t>(data.size());
+        record.offset = offset;
+        clusters.push_back(record);
+    }
+
+    std::ofstream& file;
+    const std::vector<Data>& triangles;
+    ClusterFileOptions options;
+    std::vector<int> order;
+};
+
+} // namespace
+
+const uint32_t ClusterFile::VERSION;
+const uint64_t ClusterFile::PAGE_ALIGNMENT;
+
+// FNV-1a を 8 バイトずつ. 三角形の全部のバイトを見るので, 同じ数の三角形を動かしただけでも変わる
+uint64_t hashClusterSource(const std::vector<Data>& triangles, const ClusterFileOptions& options) {
+    static_assert(sizeof(Data) % sizeof(uint64_t) == 0, "Data is hashed in 8 byte words");
+    uint64_t hash = 14695981039346656037ull;
+    hashWord(hash, sizeof(BVHNode));
+    hashWord(hash, sizeof(Data));
+    hashWord(hash, static_cast<uint64_t>(options.maxClusterTriangles));
+    const size_t words = triangles.size() * sizeof(Data) / sizeof(uint64_t);
+    const char* bytes = reinterpret_cast<const char*>(triangles.data());
+    for (size_t i = 0; i < words; ++i) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i * sizeof(uint64_t), sizeof(word));
+        hashWord(hash, word);
+    }
+    return hash;
+}
+
+bool writeClusterFile(const std::string& path, const std::vector<Data>& triangles, const ClusterFileOptions& options) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        std::cerr << "writeClusterFile: cannot open " << path << std::endl;
+        return false;
+    }
+
+    // ヘッダは表の位置が分かってから書き直す
+    ClusterFileHeader header;
+    std::memset(&header, 0, sizeof(header));
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    ClusterWriter writer(file, triangles, options);
+    writer.build();
+
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = ClusterFile::VERSION;
+    header.clusterCount = static_cast<uint32_t>(writer.clusters.size());
+    header.topNodeCount = static_cast<uint32_t>(writer.topNodes.size());
+    header.pageTriangleCapacity = static_cast<uint32_t>(options.maxClusterTriangles);
+    header.pageNodeCapacity = static_cast<uint32_t>(2 * options.maxClusterTriangles - 1);
+    header.triangleCount = static_cast<uint32_t>(triangles.size());
+    header.sourceHash = hashClusterSource(triangles, options);
+    header.tableOffset = static_cast<uint64_t>(file.tellp());
+    file.write(reinterpret_cast<const char*>(writer.topNodes.data()), writer.topNodes.size() * sizeof(BVHNode));
+    file.write(reinterpret_cast<const char*>(writer.clusters.data()), writer.clusters.size() * sizeof(ClusterRecord));
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+    if (!file || writer.failed) {
+        std::cerr << "writeClusterFile: failed to write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+ClusterFile::ClusterFile(const std::string& path) : file(path, std::ios::binary), open(false) {
+    std::memset(&header, 0, sizeof(header));
+    if (!file) {
+        std::cerr << "ClusterFile: cannot open " << path << std::endl;
+        return;
+    }
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file || std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 || header.version != VERSION) {
+        std::cerr << "ClusterFile: " << path << " is not a version " << VERSION << " page file" << std::endl;
+        return;
+    }
+
+    topNodes.resize(header.topNodeCount);
+    clusters.resize(header.clusterCount);
+    file.seekg(static_cast<std::streamoff>(header.tableOffset));
+    file.read(reinterpret_cast<char*>(topNodes.data()), topNodes.size() * sizeof(BVHNode));
+    file.read(reinterpret_cast<char*>(clusters.data()), clusters.size() * sizeof(ClusterRecord));
+    if (!file) {
+        std::cerr << "ClusterFile: " << path << " is truncated" << std::endl;
+        return;
+    }
+    open = true;
+}
+
+bool ClusterFile::matches(const std::vector<Data>& triangles, const ClusterFileOptions& options) const {
+    return open && header.triangleCount == triangles.size() &&
+           header.pageTriangleCapacity == static_cast<uint32_t>(options.maxClusterTriangles) &&
+           header.sourceHash == hashClusterSource(triangles, options);
+}
+
+bool ClusterFile::readPage(int cluster, std::vector<BVHNode>& nodes, std::vector<Data>& triangles) {
+    const ClusterRecord& record = clusters[cluster];
+    nodes.resize(record.nodeCount);
+    triangles.resize(record.triangleCount);
+    file.seekg(static_cast<std::streamoff>(record.offset));
+    file.read(reinterpret_cast<char*>(nodes.data()), nodes.size() * sizeof(BVHNode));
+    file.read(reinterpret_cast<char*>(triangles.data()), triangles.size() * sizeof(Data));
+    if (!file) {
+        std::cerr << "ClusterFile: failed to read page " << cluster << std::endl;
+        file.clear();
+        return false;
+    }
+    return true;
+}
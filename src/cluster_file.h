@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "bvh.h"
+
+// シーンを空間で分けたクラスタごとに BVH を作り, ページとして 1 つのファイルに並べる (GeometryStreamer の入力).
+// ファイルの並び:
+//   ClusterFileHeader
+//   ページ (クラスタごとに PAGE_ALIGNMENT に揃えて BVHNode[nodeCount], Data[triangleCount]. 番号はページの中のもの)
+//   上位の木 BVHNode[topNodeCount] (葉の dataOffset がクラスタの番号, dataCount は 1)
+//   ClusterRecord[clusterCount]
+struct ClusterFileOptions {
+    int maxClusterTriangles;    // ページの三角形数の上限. ページのノード数は 2 * maxClusterTriangles - 1 まで
+
+    ClusterFileOptions() : maxClusterTriangles(4096) {}
+};
+
+struct ClusterFileHeader {
+    char magic[8];              // "RTPAGES\0"
+    uint32_t version;
+    uint32_t clusterCount;
+    uint32_t topNodeCount;
+    uint32_t pageNodeCapacity;
+    uint32_t pageTriangleCapacity;
+    uint32_t triangleCount;     // 書いたときの入力の三角形数
+    uint64_t tableOffset;       // 上位の木とクラスタの表の位置
+    uint64_t sourceHash;        // hashClusterSource. 入力が変わったら書き直す
+};
+
+struct ClusterRecord {
+    glm::vec3 min;
+    uint32_t nodeCount;
+    glm::vec3 max;
+    uint32_t triangleCount;
+    uint64_t offset;            // ページの位置
+};
+
+// 入力の三角形, options とページの構造体の大きさから作るハッシュ. ファイルが今の入力から作られたかを見る
+uint64_t hashClusterSource(const std::vector<Data>& triangles, const ClusterFileOptions& options);
+
+// triangles をクラスタに分けて path に書く. 失敗したら std::cerr に書いて false
+bool writeClusterFile(const std::string& path, const std::vector<Data>& triangles,
+                      const ClusterFileOptions& options = ClusterFileOptions());
+
+// 表だけを読んでおき, ページは readPage で一つずつ読む. 一つのスレッドから使う
+class ClusterFile {
+public:
+    static const uint32_t VERSION = 2;     // BVHNode や Data の並びを変えたら上げる
+    static const uint64_t PAGE_ALIGNMENT = 4096;
+
+    // 開けなければ isOpen() が false
+    explicit ClusterFile(const std::string& path);
+    bool isOpen() const { return open; }
+
+    const std::vector<BVHNode>& getTopNodes() const { return topNodes; }
+    const std::vector<ClusterRecord>& getClusters() const { return clusters; }
+    int getPageNodeCapacity() const { return static_cast<int>(header.pageNodeCapacity); }
+    int getPageTriangleCapacity() const { return static_cast<int>(header.pageTriangleCapacity); }
+    // triangles と options から書いたファイルなら true. 違えば書き直す (ファイルは入力のキャッシュ)
+    bool matches(const std::vector<Data>& triangles, const ClusterFileOptions& options = ClusterFileOptions()) const;
+
+    bool readPage(int cluster, std::vector<BVHNode>& nodes, std::vector<Data>& triangles);
+
+private:
+    std::ifstream file;
+    bool open;
+    ClusterFileHeader header;
+    std::vector<BVHNode> topNodes;
+    std::vector<ClusterRecord> clusters;
+};
@@ -1,6 +1,6 @@
 #include "cshader.h"
 
-Cshader::Cshader(const char* computePath) {
+Cshader::Cshader(const char* computePath, const std::string& defines, ProgramCache* cache) {
     std::string computeCode;
     std::ifstream cShaderFile;
     cShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
@@ -13,6 +13,19 @@ Cshader::Cshader(const char* computePath) {
     } catch (std::ifstream::failure e) {
         std::cerr << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
     }
+    if (!defines.empty()) {
+        size_t versionEnd = computeCode.find('\n');
+        computeCode.insert(versionEnd == std::string::npos ? computeCode.size() : versionEnd + 1, defines);
+    }
+    // キャッシュにあればコンパイルしない
+    if (cache) {
+        ID = cache->load(computeCode);
+        if (ID != 0) {
+            reflection.reflect(ID);
+            return;
+        }
+    }
+
     const char* cShaderCode = computeCode.c_str();
 
     // コンピュートシェーダーをコンパイル
@@ -25,10 +38,16 @@ Cshader::Cshader(const char* computePath) {
     // コンピュートシェーダー用のプログラムを作成
     ID = glCreateProgram();
     glAttachShader(ID, compute);
+    if (cache) glProgramParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
     glLinkProgram(ID);
     checkCompileErrors(ID, "PROGRAM");
+    reflection.reflect(ID);
 
     glDeleteShader(compute);
+
+    GLint linked = GL_FALSE;
+    glGetProgramiv(ID, GL_LINK_STATUS, &linked);
+    if (cache && linked) cache->store(computeCode, ID);
 }
 
 void Cshader::use() {
@@ -36,29 +55,49 @@ void Cshader::use() {
 }
 
 void Cshader::setBool(const std::string &name, bool value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    glUniform1i(reflection.uniformLocation(name), (int)value);
 }
 
 void Cshader::setInt(const std::string &name, int value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(reflection.uniformLocation(name), value);
 }
 
 void Cshader::setFloat(const std::string &name, float value) const {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1f(reflection.uniformLocation(name), value);
 }
 
 void Cshader::setMat4(const std::string &name, const glm::mat4 &mat) const {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    glUniformMatrix4fv(reflection.uniformLocation(name), 1, GL_FALSE, &mat[0][0]);
 }
 
 void Cshader::setVec3(const std::string &name, const glm::vec3 &value) const {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform3fv(reflection.uniformLocation(name), 1, &value[0]);
 }
 
 void Cshader::setTexture(const std::string &name, int unit, GLuint texture) {
     glActiveTexture(GL_TEXTURE0 + unit);
     glBindTexture(GL_TEXTURE_2D, texture);
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), unit);
+    glUniform1i(reflection.uniformLocation(name), unit);
+}
+
+GLint Cshader::getUniformLocation(const std::string &name) const {
+    return reflection.uniformLocation(name);
+}
+
+void Cshader::setBool(GLint location, bool value) const {
+    glUniform1i(location, (int)value);
+}
+
+void Cshader::setInt(GLint location, int value) const {
+    glUniform1i(location, value);
+}
+
+void Cshader::setFloat(GLint location, float value) const {
+    glUniform1f(location, value);
+}
+
+void Cshader::setVec3(GLint location, const glm::vec3 &value) const {
+    glUniform3fv(location, 1, &value[0]);
 }
 
 void Cshader::checkCompileErrors(GLuint cshader, std::string type) {
@@ -7,12 +7,16 @@
 #include <sstream>
 #include <iostream>
 #include <glm/glm.hpp>
+#include "reflection.h"
+#include "program_cache.h"
 
 class Cshader {
 public:
     GLuint ID;
 
-    Cshader(const char* computePath);
+    // defines は #version の直後に挿入される (例: "#define TRAVERSAL_KIND 1\n").
+    // cache を渡すとリンク済みのバイナリを再利用し, なければコンパイルして保存する
+    Cshader(const char* computePath, const std::string& defines = "", ProgramCache* cache = nullptr);
     void use();
     void setBool(const std::string &name, bool value) const;
     void setInt(const std::string &name, int value) const;
@@ -21,10 +25,20 @@ public:
     void setVec3(const std::string &name, const glm::vec3 &value) const;
     void setTexture(const std::string &name, int unit, GLuint texture);
 
+    // location はリンク時に読んだものを返す. 毎フレームの更新には location を保持して下の版を使う
+    GLint getUniformLocation(const std::string &name) const;
+    const ProgramReflection& getReflection() const { return reflection; }
+    void setBool(GLint location, bool value) const;
+    void setInt(GLint location, int value) const;
+    void setFloat(GLint location, float value) const;
+    void setVec3(GLint location, const glm::vec3 &value) const;
+
     void dispatch(GLuint num_groups_x, GLuint num_groups_y, GLuint num_groups_z);
      void waitForCompute();
 
 private:
+    ProgramReflection reflection;
+
     void checkCompileErrors(GLuint shader, std::string type);
 };
 
@@ -0,0 +1,141 @@
+#include "culling.h"
+#include <algorithm>
+#include <glm/gtc/type_ptr.hpp>
+#include "util.h"
+
+namespace {
+
+// cull.glsl の uniform の layout(location)
+const GLint VIEW_PROJECTION_LOCATION = 0;
+const GLint HIZ_VIEW_PROJECTION_LOCATION = 1;
+const GLint HIZ_SIZE_LOCATION = 2;
+const GLint HIZ_LEVELS_LOCATION = 3;
+const GLint NUM_DRAWS_LOCATION = 4;
+
+// hiz.glsl の uniform の layout(location)
+const GLint SOURCE_SIZE_LOCATION = 0;
+const GLint TARGET_SIZE_LOCATION = 1;
+const GLint SOURCE_LEVEL_LOCATION = 2;
+
+const GLuint CULL_GROUP_SIZE = 64;
+const GLuint HIZ_GROUP_SIZE = 16;
+
+int mipLevels(int width, int height) {
+    int levels = 1;
+    while ((std::max(width, height) >> levels) > 0) ++levels;
+    return levels;
+}
+
+} // namespace
+
+DrawCuller::DrawCuller(const Model& model, int width, int height)
+    : inputCommands(model.getCommandBuffer()), numDraws(static_cast<GLuint>(model.getDrawCount())),
+      width(0), height(0), levels(0), hiZValid(false), hiZSize(0), hiZLevels(0), hiZViewProjection(1.0f),
+      cullShader(SOURCE_DIR "/src/shader/cull.glsl"), hiZShader(SOURCE_DIR "/src/shader/hiz.glsl") {
+    const std::vector<DrawBounds>& bounds = model.getDrawBounds();
+    boundsSSBO = createSSBO(bounds.data(), bounds.size() * sizeof(DrawBounds), BOUNDS_BINDING);
+    const std::vector<DrawLod>& lods = model.getDrawLods();
+    lodSSBO = createSSBO(lods.data(), lods.size() * sizeof(DrawLod), LOD_BINDING);
+    std::vector<GLint> zeros(numDraws, 0);
+    levelSSBO = createSSBO(zeros.data(), zeros.size() * sizeof(GLint), LEVEL_BINDING);
+    outputCommands = createSSBO(nullptr, numDraws * sizeof(DrawCommand), OUTPUT_COMMAND_BINDING);
+    drawCount = createSSBO(nullptr, sizeof(GLuint), COUNT_BINDING);
+    allocate(width, height);
+}
+
+void DrawCuller::allocate(int width, int height) {
+    if (this->width > 0) glDeleteTextures(1, &hiZ);
+    this->width = width;
+    this->height = height;
+    levels = mipLevels(width, height);
+
+    // texelFetch で段を選ぶので, 全段を持つ不変のストレージにする
+    glGenTextures(1, &hiZ);
+    glBindTexture(GL_TEXTURE_2D, hiZ);
+    glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    hiZValid = false;
+}
+
+void DrawCuller::resize(int width, int height) {
+    if (width <= this->width && height <= this->height) return;
+    allocate(std::max(width, this->width), std::max(height, this->height));
+}
+
+void DrawCuller::setLevels(const std::vector<int>& drawLevels) {
+    std::vector<GLint> values(drawLevels.begin(), drawLevels.end());
+    values.resize(numDraws, 0);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, levelSSBO);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, values.size() * sizeof(GLint), values.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void DrawCuller::cull(const glm::mat4& viewProjection) {
+    const GLuint zero = 0;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawCount);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, INPUT_COMMAND_BINDING, inputCommands);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, BOUNDS_BINDING, boundsSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, OUTPUT_COMMAND_BINDING, outputCommands);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, COUNT_BINDING, drawCount);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LOD_BINDING, lodSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LEVEL_BINDING, levelSSBO);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, hiZ);
+
+    // Hi-Z がなければ hiZLevels を 0 にして遮蔽の判定を飛ばす
+    cullShader.use();
+    glUniformMatrix4fv(VIEW_PROJECTION_LOCATION, 1, GL_FALSE, glm::value_ptr(viewProjection));
+    glUniformMatrix4fv(HIZ_VIEW_PROJECTION_LOCATION, 1, GL_FALSE, glm::value_ptr(hiZViewProjection));
+    glUniform2i(HIZ_SIZE_LOCATION, hiZSize.x, hiZSize.y);
+    glUniform1i(HIZ_LEVELS_LOCATION, hiZValid ? hiZLevels : 0);
+    glUniform1ui(NUM_DRAWS_LOCATION, numDraws);
+    glDispatchCompute((numDraws + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+    // 詰めたコマンドと数を間接描画が読む
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
+
+void DrawCuller::buildHiZ(GLuint depthTexture, const glm::ivec2& size, const glm::mat4& viewProjection) {
+    hiZShader.use();
+    glActiveTexture(GL_TEXTURE0);
+
+    // 0 段目は深度を写すだけ. 以降は前の段の 2x2 (奇数の端は 3 つ目まで) の最大を取る
+    glm::ivec2 sourceSize = size;
+    glm::ivec2 targetSize = size;
+    int usedLevels = std::min(mipLevels(size.x, size.y), levels);
+    for (int level = 0; level < usedLevels; ++level) {
+        if (level > 0) {
+            sourceSize = targetSize;
+            targetSize = glm::max(targetSize / 2, glm::ivec2(1));
+        }
+        glBindTexture(GL_TEXTURE_2D, level == 0 ? depthTexture : hiZ);
+        glBindImageTexture(0, hiZ, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glUniform2i(SOURCE_SIZE_LOCATION, sourceSize.x, sourceSize.y);
+        glUniform2i(TARGET_SIZE_LOCATION, targetSize.x, targetSize.y);
+        glUniform1i(SOURCE_LEVEL_LOCATION, level - 1);
+        glDispatchCompute((targetSize.x + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE,
+                          (targetSize.y + HIZ_GROUP_SIZE - 1) / HIZ_GROUP_SIZE, 1);
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+
+    hiZValid = true;
+    hiZSize = size;
+    hiZLevels = usedLevels;
+    hiZViewProjection = viewProjection;
+}
+
+void DrawCuller::cleanup() {
+    glDeleteTextures(1, &hiZ);
+    glDeleteBuffers(1, &boundsSSBO);
+    glDeleteBuffers(1, &lodSSBO);
+    glDeleteBuffers(1, &levelSSBO);
+    glDeleteBuffers(1, &outputCommands);
+    glDeleteBuffers(1, &drawCount);
+    glDeleteProgram(cullShader.ID);
+    glDeleteProgram(hiZShader.ID);
+}
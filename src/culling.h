@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include "cshader.h"
+#include "model.h"
+
+// Model のコマンドを GPU で視錐台と前のフレームの Hi-Z (深度の最大値のミップマップ) に対して判定し,
+// 残ったものだけを setLevels の段で間接描画のコマンドバッファに詰める (cull.glsl, hiz.glsl).
+// Model::DrawVisibility(shader, commandBuffer(), countBuffer()) で描く
+class DrawCuller {
+public:
+    // cull.glsl の SSBO の binding
+    static const GLuint INPUT_COMMAND_BINDING = 14;
+    static const GLuint BOUNDS_BINDING = 15;
+    static const GLuint OUTPUT_COMMAND_BINDING = 16;
+    static const GLuint COUNT_BINDING = 17;
+    static const GLuint LOD_BINDING = 18;
+    static const GLuint LEVEL_BINDING = 24;
+
+    DrawCuller(const Model& model, int width, int height);
+    // 描画範囲の最大. Hi-Z は大きくなるときだけ作り直す
+    void resize(int width, int height);
+
+    // コマンドごとの詳細度の段 (Model::selectLods). トレースする段 (main の lodScene のインスタンスのメッシュ) と同じものを渡す. 最初はすべて段 0
+    void setLevels(const std::vector<int>& drawLevels);
+    // viewProjection で見えるコマンドを詰める. 前の buildHiZ の深度で隠れるものも除く
+    void cull(const glm::mat4& viewProjection);
+    // depthTexture (GL_DEPTH_COMPONENT32F) の左下 size から次のフレームの Hi-Z を作る.
+    // viewProjection は深度を描いたときのもの
+    void buildHiZ(GLuint depthTexture, const glm::ivec2& size, const glm::mat4& viewProjection);
+    // Hi-Z を使わない. 次の buildHiZ まで遮蔽の判定をしない
+    void discardHiZ() { hiZValid = false; }
+
+    GLuint commandBuffer() const { return outputCommands; }
+    GLuint countBuffer() const { return drawCount; }
+    void cleanup();
+
+private:
+    void allocate(int width, int height);
+
+    GLuint inputCommands;   // Model::getCommandBuffer()
+    GLuint boundsSSBO;
+    GLuint lodSSBO;         // Model::getDrawLods()
+    GLuint levelSSBO;       // setLevels の段
+    GLuint outputCommands;
+    GLuint drawCount;
+    GLuint numDraws;
+
+    int width;
+    int height;
+    int levels;
+    GLuint hiZ;             // GL_R32F, 0 段目は深度そのもの
+    bool hiZValid;
+    glm::ivec2 hiZSize;     // buildHiZ の size
+    int hiZLevels;          // hiZSize で使う段数
+    glm::mat4 hiZViewProjection;
+
+    Cshader cullShader;
+    Cshader hiZShader;
+};
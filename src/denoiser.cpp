@@ -0,0 +1,137 @@
+#include "denoiser.h"
+#include <algorithm>
+#include <string>
+
+namespace {
+
+// atrous.glsl の uniform の layout(location)
+const GLint STEP_SIZE_LOCATION = 0;
+const GLint RENDER_SIZE_LOCATION = 1;
+const GLint HISTORY_VALID_LOCATION = 2;
+
+const char* SHADER_PATH = SOURCE_DIR "/src/shader/atrous.glsl";
+
+std::string finalDefines(OutputFormat format) {
+    std::string defines = "#define FINAL_PASS\n";
+    defines += std::string("#define OUTPUT_FORMAT ") + outputFormatQualifier(format) + "\n";
+    if (isDisplayFormat(format)) defines += "#define ENCODE_OUTPUT 1\n";
+    return defines;
+}
+
+void bindTexture(GLenum unit, GLuint texture) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+} // namespace
+
+Denoiser::Denoiser(int width, int height)
+    : width(0), height(0), current(0), historyValid(false), historySize(0), passShader(SHADER_PATH),
+      temporalShader(SHADER_PATH, "#define TEMPORAL_PASS\n"), finalShader(SHADER_PATH, finalDefines(OUTPUT_RGBA32F)),
+      finalFormat(OUTPUT_RGBA32F) {
+    allocate(width, height);
+}
+
+void Denoiser::allocate(int width, int height) {
+    if (this->width > 0) release();
+    this->width = width;
+    this->height = height;
+    color = createTexture(width, height, GL_RGBA16F);
+    albedo = createTexture(width, height, GL_RGBA8);
+    motion = createTexture(width, height, GL_RGBA32F);
+    for (int i = 0; i < 2; ++i) {
+        normalDepth[i] = createTexture(width, height, GL_RGBA16F);
+        historyColor[i] = createTexture(width, height, GL_RGBA16F);
+        historyMoments[i] = createTexture(width, height, GL_RG16F);
+        ping[i] = createTexture(width, height, GL_RGBA16F);
+    }
+    historyValid = false;
+}
+
+void Denoiser::release() {
+    glDeleteTextures(1, &color);
+    glDeleteTextures(1, &albedo);
+    glDeleteTextures(1, &motion);
+    glDeleteTextures(2, normalDepth);
+    glDeleteTextures(2, historyColor);
+    glDeleteTextures(2, historyMoments);
+    glDeleteTextures(2, ping);
+}
+
+void Denoiser::resize(int width, int height) {
+    if (width <= this->width && height <= this->height) return;
+    allocate(std::max(width, this->width), std::max(height, this->height));
+}
+
+void Denoiser::bindGBuffer() {
+    glBindImageTexture(1, normalDepth[current], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glBindImageTexture(2, albedo, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+    glBindImageTexture(3, motion, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
+}
+
+void Denoiser::apply(GLuint target, OutputFormat format, const glm::ivec2& renderSize, bool temporal, bool spatial) {
+    if (format != finalFormat) {
+        glDeleteProgram(finalShader.ID);
+        finalShader = Cshader(SHADER_PATH, finalDefines(format));
+        finalFormat = format;
+    }
+
+    GLuint groupsX = static_cast<GLuint>((renderSize.x + 15) / 16);
+    GLuint groupsY = static_cast<GLuint>((renderSize.y + 15) / 16);
+    int previous = 1 - current;
+    bindTexture(1, normalDepth[current]);
+    bindTexture(2, albedo);
+    bindTexture(3, motion);
+    bindTexture(4, normalDepth[previous]);
+    bindTexture(5, historyColor[previous]);
+    bindTexture(6, historyMoments[previous]);
+    bindTexture(0, color);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    // 最初のパス: 時間方向に蓄積するか, 3x3 で分散を見積もる
+    Cshader& first = temporal ? temporalShader : passShader;
+    first.use();
+    first.setInt(STEP_SIZE_LOCATION, 0);
+    glUniform2i(RENDER_SIZE_LOCATION, renderSize.x, renderSize.y);
+    if (temporal) {
+        first.setBool(HISTORY_VALID_LOCATION, historyValid && historySize == renderSize);
+        glBindImageTexture(1, historyColor[current], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+        glBindImageTexture(2, historyMoments[current], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16F);
+    }
+    glBindImageTexture(0, ping[0], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+    glDispatchCompute(groupsX, groupsY, 1);
+
+    // à-trous の反復は ping を交互に使い, 最後の反復で target に書く. spatial でなければそのまま書く
+    int iterations = spatial ? ITERATIONS : 0;
+    int passes = std::max(iterations, 1);
+    int input = 0;
+    for (int pass = 0; pass < passes; ++pass) {
+        bool last = pass == passes - 1;
+        Cshader& shader = last ? finalShader : passShader;
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        shader.use();
+        shader.setInt(STEP_SIZE_LOCATION, iterations > 0 ? 1 << pass : 0);
+        glUniform2i(RENDER_SIZE_LOCATION, renderSize.x, renderSize.y);
+        glBindTexture(GL_TEXTURE_2D, ping[input]);
+        if (last) {
+            glBindImageTexture(0, target, 0, GL_FALSE, 0, GL_WRITE_ONLY, outputInternalFormat(format));
+        } else {
+            glBindImageTexture(0, ping[1 - input], 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA16F);
+            input = 1 - input;
+        }
+        glDispatchCompute(groupsX, groupsY, 1);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // 次のフレームは今のフレームの G-buffer と履歴から再投影する
+    historyValid = temporal;
+    historySize = renderSize;
+    if (temporal) current = previous;
+}
+
+void Denoiser::cleanup() {
+    release();
+    glDeleteProgram(passShader.ID);
+    glDeleteProgram(temporalShader.ID);
+    glDeleteProgram(finalShader.ID);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include "cshader.h"
+#include "util.h"
+
+// トレースした画像を atrous.glsl で少ないサンプル数のノイズを除いてから出力先に書く.
+// compute_raytracing_1.glsl を GBUFFER 付きかつ OUTPUT_RGBA16F でコンパイルし, colorTexture() に書かせる.
+// temporal では前のフレームまでの蓄積を動きベクトルで再投影して混ぜ (SVGF の時間方向), spatial では
+// à-trous フィルタをかける. CPU 版は TemporalAccumulator (temporal.h) と atrousFilter (atrous.h)
+class Denoiser {
+public:
+    static const int ITERATIONS = 5;    // AtrousOptions::iterations
+
+    Denoiser(int width, int height);
+    // 描画範囲の最大. テクスチャは大きくなるときだけ作り直す
+    void resize(int width, int height);
+
+    // トレースの出力先 (RGBA16F のリニアの HDR)
+    GLuint colorTexture() const { return color; }
+    // トレースの前に呼ぶ. G-buffer を image unit 1, 2, 3 に結び付ける
+    void bindGBuffer();
+    // colorTexture() の左下 renderSize を処理して target に書く. format は target を作ったときのもの.
+    // 描画範囲が変わったフレームや temporal でなかった次のフレームは履歴を捨てる
+    void apply(GLuint target, OutputFormat format, const glm::ivec2& renderSize, bool temporal, bool spatial);
+    // apply を飛ばしたフレームの後に呼ぶ. 次の temporal は履歴なしで始める
+    void discardHistory() { historyValid = false; }
+    void cleanup();
+
+private:
+    void allocate(int width, int height);
+    void release();
+
+    int width;
+    int height;
+    GLuint color;
+    GLuint albedo;
+    GLuint motion;
+    // [current] に今のフレームを書き, [1 - current] の前のフレームから再投影する
+    GLuint normalDepth[2];
+    GLuint historyColor[2];     // rgb: アルベドで割って蓄積した色, a: 蓄積したフレーム数
+    GLuint historyMoments[2];   // 輝度と輝度の 2 乗の平均
+    int current;
+    bool historyValid;
+    glm::ivec2 historySize;
+    GLuint ping[2];             // rgb: アルベドで割った色, a: 輝度の分散
+    Cshader passShader;         // 分散の見積もりと途中の反復 (RGBA16F に書く)
+    Cshader temporalShader;
+    Cshader finalShader;        // 最後の反復. 出力先の形式でコンパイルする
+    OutputFormat finalFormat;
+};
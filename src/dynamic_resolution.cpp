@@ -0,0 +1,57 @@
+#include "dynamic_resolution.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const float SCALE_STEP = 0.05f;        // 細かく揺れないように量子化する
+const float SMOOTHING = 0.2f;
+const float GROW_THRESHOLD = 0.7f;     // 予算のこの割合を下回ったら解像度を上げる
+const int COOLDOWN_SAMPLES = 8;        // 変更前に発行済みの Profiler::FRAME_LATENCY フレームより多く
+
+} // namespace
+
+DynamicResolution::DynamicResolution(float budgetMs, float minScale, float maxScale)
+    : budgetMs(budgetMs), minScale(minScale), maxScale(maxScale), scale(maxScale), smoothedMs(0.0f), cooldown(0),
+      enabled(false) {
+}
+
+void DynamicResolution::setEnabled(bool value) {
+    enabled = value;
+    scale = maxScale;
+    smoothedMs = 0.0f;
+    cooldown = 0;
+}
+
+bool DynamicResolution::update(float gpuMs) {
+    if (!enabled || gpuMs <= 0.0f) return false;
+
+    // 変更直後の計測は前の解像度のものなので捨てる
+    if (cooldown > 0) {
+        --cooldown;
+        return false;
+    }
+    smoothedMs = smoothedMs > 0.0f ? smoothedMs + SMOOTHING * (gpuMs - smoothedMs) : gpuMs;
+
+    // 時間は画素数, つまり scale の 2 乗にほぼ比例する
+    float target = scale;
+    if (smoothedMs > budgetMs) {
+        target = std::floor(scale * std::sqrt(budgetMs / smoothedMs) / SCALE_STEP + 0.5f) * SCALE_STEP;
+        target = std::min(target, scale - SCALE_STEP);
+    } else if (smoothedMs < GROW_THRESHOLD * budgetMs) {
+        target = scale + SCALE_STEP;
+    }
+    target = std::min(std::max(target, minScale), maxScale);
+    if (std::fabs(target - scale) < 0.5f * SCALE_STEP) return false;
+
+    scale = target;
+    smoothedMs = 0.0f;
+    cooldown = COOLDOWN_SAMPLES;
+    return true;
+}
+
+glm::ivec2 DynamicResolution::renderSize(int windowWidth, int windowHeight) const {
+    float s = getScale();
+    return glm::max(glm::ivec2(static_cast<int>(windowWidth * s + 0.5f), static_cast<int>(windowHeight * s + 0.5f)),
+                    glm::ivec2(1));
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+// フレームの GPU 時間が予算を超えたら内部解像度を下げ, 余裕があれば少しずつ戻す.
+// 描画は出力テクスチャの左下 renderSize の範囲だけに行い, Quad で画面全体に拡大する
+class DynamicResolution {
+public:
+    explicit DynamicResolution(float budgetMs, float minScale = 0.5f, float maxScale = 1.0f);
+
+    // 新しく読み出されたフレームの GPU 時間 (Profiler::takeGpuFrameMs) を 1 回ずつ渡す. スケールが変わったら true
+    bool update(float gpuMs);
+    glm::ivec2 renderSize(int windowWidth, int windowHeight) const;
+
+    float getScale() const { return enabled ? scale : maxScale; }
+    bool isEnabled() const { return enabled; }
+    void setEnabled(bool value);
+
+private:
+    float budgetMs;
+    float minScale;
+    float maxScale;
+    float scale;
+    float smoothedMs;
+    int cooldown;       // 変更後, 新しい解像度の計測が届くまで捨てる計測の数
+    bool enabled;
+};
@@ -0,0 +1,84 @@
+#include "frame_pipeline.h"
+#include <algorithm>
+#include <chrono>
+
+FramePipeline::FramePipeline(int frames)
+    : format(OUTPUT_RGBA32F), pipelined(true), traceIndex(0), displayIndex(-1), lastWaitSeconds(0.0) {
+    Target empty = {0, 0, glm::ivec2(0), 0.0, nullptr, false};
+    targets.assign(std::min(std::max(frames, 2), static_cast<int>(MAX_FRAMES)), empty);
+}
+
+void FramePipeline::release(Target& target) {
+    if (target.fence) glDeleteSync(target.fence);
+    glDeleteFramebuffers(1, &target.framebuffer);
+    glDeleteTextures(1, &target.texture);
+    target.fence = nullptr;
+    target.framebuffer = 0;
+    target.texture = 0;
+    target.traced = false;
+}
+
+void FramePipeline::resize(int width, int height, OutputFormat format) {
+    this->format = format;
+    for (Target& target : targets) {
+        release(target);
+        // 表示側は縮小した範囲を拡大するので線形補間にする
+        target.texture = createTexture(width, height, outputInternalFormat(format));
+        target.framebuffer = createFramebuffer(target.texture);
+        glBindTexture(GL_TEXTURE_2D, target.texture);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    displayIndex = -1;
+}
+
+void FramePipeline::setPipelined(bool value) {
+    pipelined = value;
+    // 切り替えた直後は古い画像を表示しない
+    for (Target& target : targets) target.traced = false;
+}
+
+FramePipeline::Target& FramePipeline::beginTrace(double inputTime, const glm::ivec2& renderSize) {
+    int previous = traceIndex;
+    int next = pipelined ? (traceIndex + 1) % static_cast<int>(targets.size()) : 0;
+    Target& target = targets[next];
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    if (target.fence) {
+        // 1 秒待っても終わらなければそのまま上書きする (UniformRing と同じ)
+        glClientWaitSync(target.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        glDeleteSync(target.fence);
+        target.fence = nullptr;
+    }
+    lastWaitSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // パイプライン時も, 1 つ前の画像がまだなければこのフレームの画像を表示する
+    displayIndex = pipelined && previous != next && targets[previous].traced ? previous : next;
+    target.renderSize = renderSize;
+    target.inputTime = inputTime;
+    target.traced = true;
+    traceIndex = next;
+    return target;
+}
+
+FramePipeline::Target& FramePipeline::displayTarget() {
+    return targets[displayIndex >= 0 ? displayIndex : traceIndex];
+}
+
+void FramePipeline::endDisplay() {
+    // 直列モードは以前と同じく同期をドライバに任せる
+    if (!pipelined) return;
+    Target& target = displayTarget();
+    if (target.fence) glDeleteSync(target.fence);
+    target.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+double FramePipeline::presented(double now) {
+    if (displayIndex < 0) return -1.0;
+    return now - targets[displayIndex].inputTime;
+}
+
+void FramePipeline::cleanup() {
+    for (Target& target : targets) release(target);
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <vector>
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include "util.h"
+
+// トレース先の画像を複数持ち, フレーム N をトレースしている間にフレーム N-1 を表示する.
+// 画像を使い回す前にはその画像の表示の後に入れたフェンスを待つので, GPU に積まれるフレームは最大 frames - 1.
+// 直列モードでは 1 枚目だけを使い, トレースした画像をそのフレームで表示する (以前の動作)
+class FramePipeline {
+public:
+    static const int MAX_FRAMES = 4;
+
+    struct Target {
+        GLuint texture;
+        GLuint framebuffer;
+        glm::ivec2 renderSize;  // トレースした範囲 (DynamicResolution)
+        double inputTime;       // このフレームの入力を読んだ時刻 (秒). 遅延の計測用
+        GLsync fence;           // 最後にこの画像を読むコマンド (表示) の後
+        bool traced;
+    };
+
+    explicit FramePipeline(int frames = 3);
+    // 全部の画像を作り直す. ウィンドウの大きさや OutputFormat が変わったときに呼ぶ
+    void resize(int width, int height, OutputFormat format);
+    void setPipelined(bool value);
+    bool isPipelined() const { return pipelined; }
+    OutputFormat getFormat() const { return format; }
+
+    // 次にトレースする画像. 前の使用が終わるまで待つ
+    Target& beginTrace(double inputTime, const glm::ivec2& renderSize);
+    // このフレームで表示する画像. パイプライン時は 1 つ前にトレースしたもの
+    Target& displayTarget();
+    // 表示のコマンドを出した後に呼ぶ
+    void endDisplay();
+    // バッファを入れ替えた後に呼ぶ. 表示した画像の入力から表示までの時間 (秒) を返す. 表示するものがなければ負
+    double presented(double now);
+
+    // トレースの前にフェンスで待った時間 (秒, 直近のフレーム)
+    double getLastWaitSeconds() const { return lastWaitSeconds; }
+    void cleanup();
+
+private:
+    void release(Target& target);
+
+    std::vector<Target> targets;
+    OutputFormat format;
+    bool pipelined;
+    int traceIndex;     // 最後にトレースした画像
+    int displayIndex;   // このフレームで表示する画像, なければ -1
+    double lastWaitSeconds;
+};
@@ -0,0 +1,73 @@
+#include "heatmap.h"
+#include <vector>
+#include "util.h"
+
+const char* TraversalHeatmap::metricName(Metric metric) {
+    static const char* names[NUM_METRICS] = {"nodes visited", "AABB tests", "triangle tests", "stack depth"};
+    return names[metric];
+}
+
+TraversalHeatmap::TraversalHeatmap(int width, int height)
+    : width(width), height(height), capacity(static_cast<size_t>(width) * height), maxCounts(0u),
+      quad(SOURCE_DIR "/src/shader/simple_vertex.glsl", SOURCE_DIR "/src/shader/traversal_heatmap.glsl") {
+    counterBuffer = createSSBO(nullptr, capacity * sizeof(glm::uvec4), 8);
+
+    Shader& shader = quad.getShader();
+    metricLocation = shader.getUniformLocation("metric");
+    maxValueLocation = shader.getUniformLocation("maxValue");
+    imageWidthLocation = shader.getUniformLocation("imageWidth");
+    imageHeightLocation = shader.getUniformLocation("imageHeight");
+}
+
+void TraversalHeatmap::resize(int width, int height) {
+    this->width = width;
+    this->height = height;
+    size_t count = static_cast<size_t>(width) * height;
+    if (count <= capacity) return;
+    glDeleteBuffers(1, &counterBuffer);
+    capacity = count;
+    counterBuffer = createSSBO(nullptr, capacity * sizeof(glm::uvec4), 8);
+}
+
+void TraversalHeatmap::clear() {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, counterBuffer);
+}
+
+TraversalStats TraversalHeatmap::readback() {
+    std::vector<glm::uvec4> counters(static_cast<size_t>(width) * height);
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, counterBuffer);
+    glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, counters.size() * sizeof(glm::uvec4), counters.data());
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    TraversalStats total;
+    maxCounts = glm::uvec4(0u);
+    for (const glm::uvec4& c : counters) {
+        total.nodesVisited += c.x;
+        total.aabbTests += c.y;
+        total.triangleTests += c.z;
+        total.stackDepth(static_cast<int>(c.w));
+        maxCounts = glm::max(maxCounts, c);
+    }
+    return total;
+}
+
+void TraversalHeatmap::draw(Metric metric) {
+    Shader& shader = quad.getShader();
+    shader.use();
+    shader.setInt(metricLocation, metric);
+    shader.setFloat(maxValueLocation, static_cast<float>(maxCounts[metric]));
+    shader.setInt(imageWidthLocation, width);
+    shader.setInt(imageHeightLocation, height);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, counterBuffer);
+    glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    quad.draw();
+}
+
+void TraversalHeatmap::cleanup() {
+    glDeleteBuffers(1, &counterBuffer);
+    quad.cleanup();
+}
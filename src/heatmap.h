@@ -0,0 +1,34 @@
+#pragma once
+
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include "quad.h"
+#include "tracer.h"
+
+// compute_raytracing_1.glsl を TRAVERSAL_STATS 付きでコンパイルしたときの画素ごとのカウンタ (binding 8).
+// ホストで合計を集計し, traversal_heatmap.glsl で Quad に描く
+class TraversalHeatmap {
+public:
+    enum Metric { NODES_VISITED, AABB_TESTS, TRIANGLE_TESTS, STACK_DEPTH, NUM_METRICS };
+    static const char* metricName(Metric metric);
+
+    TraversalHeatmap(int width, int height);
+    // 描画範囲 (DynamicResolution やウィンドウの大きさに合わせる). カウンタは大きくなるときだけ確保し直す
+    void resize(int width, int height);
+    void clear();                   // トレースの前に呼ぶ
+    TraversalStats readback();      // トレースの後に呼ぶ. 画素の合計を返し, 描画用の最大値を更新する
+    void draw(Metric metric);
+    void cleanup();
+
+private:
+    int width;
+    int height;
+    size_t capacity;
+    GLuint counterBuffer;
+    glm::uvec4 maxCounts;
+    Quad quad;
+    GLint metricLocation;
+    GLint maxValueLocation;
+    GLint imageWidthLocation;
+    GLint imageHeightLocation;
+};
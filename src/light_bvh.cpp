@@ -0,0 +1,169 @@
+#include "light_bvh.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+namespace {
+
+float luminance(const glm::vec3& color) {
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+// compute_raytracing_1.glsl の lightImportance と同じ. 箱の中では距離を箱の大きさで抑える
+float importance(const LightBVHNode& node, const glm::vec3& point) {
+    glm::vec3 center = 0.5f * (node.min + node.max);
+    glm::vec3 half = 0.5f * (node.max - node.min);
+    glm::vec3 offset = point - center;
+    float distanceSquared = std::max(glm::dot(offset, offset), glm::dot(half, half));
+    return node.power / std::max(distanceSquared, 1e-6f);
+}
+
+} // namespace
+
+LightBVH::LightBVH(const std::vector<Light>& pointLights, const std::vector<EmissiveTriangle>& emissiveTriangles) {
+    // 明るさが 0 の光源は選ばれても寄与しないので入れない
+    for (const Light& light : pointLights) {
+        float power = luminance(glm::vec3(light.color));
+        if (power <= 0.0f) continue;
+        LightSource source;
+        source.position = glm::vec4(glm::vec3(light.position), LIGHT_POINT);
+        source.edge1 = glm::vec4(0.0f);
+        source.edge2 = glm::vec4(0.0f);
+        source.emission = glm::vec4(glm::vec3(light.color), 0.0f);
+        lights.push_back(source);
+        lightMin.push_back(glm::vec3(light.position));
+        lightMax.push_back(glm::vec3(light.position));
+        lightPower.push_back(power);
+    }
+    for (const EmissiveTriangle& emissive : emissiveTriangles) {
+        const Triangle& t = emissive.triangle;
+        glm::vec3 edge1 = t.v1 - t.v0;
+        glm::vec3 edge2 = t.v2 - t.v0;
+        float area = 0.5f * glm::length(glm::cross(edge1, edge2));
+        float power = luminance(emissive.emission) * area;
+        if (power <= 0.0f) continue;
+        LightSource source;
+        source.position = glm::vec4(t.v0, LIGHT_TRIANGLE);
+        source.edge1 = glm::vec4(edge1, 0.0f);
+        source.edge2 = glm::vec4(edge2, 0.0f);
+        source.emission = glm::vec4(emissive.emission, area);
+        lights.push_back(source);
+        lightMin.push_back(glm::min(t.v0, glm::min(t.v1, t.v2)));
+        lightMax.push_back(glm::max(t.v0, glm::max(t.v1, t.v2)));
+        lightPower.push_back(power);
+    }
+    if (lights.empty()) return;
+
+    order.resize(lights.size());
+    std::iota(order.begin(), order.end(), 0);
+    nodes.reserve(2 * lights.size() - 1);
+    nodes.emplace_back();
+    build(0, 0, static_cast<int>(lights.size()));
+
+    // 葉の番号は order の位置なので, 光源をその順に並べ直す
+    std::vector<LightSource> sorted(lights.size());
+    for (size_t i = 0; i < order.size(); ++i) sorted[i] = lights[order[i]];
+    lights.swap(sorted);
+    order.clear();
+    lightMin.clear();
+    lightMax.clear();
+    lightPower.clear();
+}
+
+// 重心の範囲が最も長い軸の中央値で分ける. 兄弟を隣に置くので子は child と child + 1
+void LightBVH::build(int nodeIndex, int start, int end) {
+    glm::vec3 min(std::numeric_limits<float>::max());
+    glm::vec3 max(std::numeric_limits<float>::lowest());
+    glm::vec3 centroidMin = min;
+    glm::vec3 centroidMax = max;
+    float power = 0.0f;
+    for (int i = start; i < end; ++i) {
+        int light = order[i];
+        min = glm::min(min, lightMin[light]);
+        max = glm::max(max, lightMax[light]);
+        glm::vec3 centroid = 0.5f * (lightMin[light] + lightMax[light]);
+        centroidMin = glm::min(centroidMin, centroid);
+        centroidMax = glm::max(centroidMax, centroid);
+        power += lightPower[light];
+    }
+    nodes[nodeIndex].min = min;
+    nodes[nodeIndex].max = max;
+    nodes[nodeIndex].power = power;
+
+    if (end - start == 1) {
+        nodes[nodeIndex].child = -start - 1;
+        return;
+    }
+
+    glm::vec3 extent = centroidMax - centroidMin;
+    int axis = extent.x > extent.y && extent.x > extent.z ? 0 : (extent.y > extent.z ? 1 : 2);
+    int mid = (start + end) / 2;
+
+    std::nth_element(order.begin() + start, order.begin() + mid, order.begin() + end, [&](int a, int b) {
+        return lightMin[a][axis] + lightMax[a][axis] < lightMin[b][axis] + lightMax[b][axis];
+    });
+
+    int child = static_cast<int>(nodes.size());
+    nodes[nodeIndex].child = child;
+    nodes.emplace_back();
+    nodes.emplace_back();
+    build(child, start, mid);
+    build(child + 1, mid, end);
+}
+
+int LightBVH::pick(const glm::vec3& point, float u, float& pdf) const {
+    pdf = 0.0f;
+    if (nodes.empty()) return -1;
+
+    pdf = 1.0f;
+    int index = 0;
+    while (nodes[index].child >= 0) {
+        int child = nodes[index].child;
+        float left = importance(nodes[child], point);
+        float right = importance(nodes[child + 1], point);
+        float probability = left / (left + right);
+        // 使った範囲を [0, 1) に引き伸ばして次の段でも使う
+        if (u < probability) {
+            u = std::min(u / probability, 0.99999994f);
+            pdf *= probability;
+            index = child;
+        } else {
+            u = std::min((u - probability) / (1.0f - probability), 0.99999994f);
+            pdf *= 1.0f - probability;
+            index = child + 1;
+        }
+    }
+    return -nodes[index].child - 1;
+}
+
+bool LightBVH::sample(const glm::vec3& point, const glm::vec3& u, LightSample& result) const {
+    float pdf;
+    int index = pick(point, u.x, pdf);
+    if (index < 0 || pdf <= 0.0f) return false;
+
+    const LightSource& light = lights[index];
+    if (light.position.w == LIGHT_POINT) {
+        glm::vec3 toLight = glm::vec3(light.position) - point;
+        result.distance = glm::length(toLight);
+        if (result.distance <= 0.0f) return false;
+        result.direction = toLight / result.distance;
+        result.radiance = glm::vec3(light.emission) / pdf;
+        return true;
+    }
+
+    // 三角形上で一様に選ぶ (面積の pdf は 1 / 面積). 両面が光る
+    float su = std::sqrt(u.y);
+    glm::vec3 edge1(light.edge1);
+    glm::vec3 edge2(light.edge2);
+    glm::vec3 target = glm::vec3(light.position) + edge1 * (su * (1.0f - u.z)) + edge2 * (su * u.z);
+    glm::vec3 toLight = target - point;
+    float distanceSquared = glm::dot(toLight, toLight);
+    if (distanceSquared <= 0.0f) return false;
+    result.distance = std::sqrt(distanceSquared);
+    result.direction = toLight / result.distance;
+    float cosLight = std::fabs(glm::dot(glm::normalize(glm::cross(edge1, edge2)), result.direction));
+    if (cosLight <= 0.0f) return false;
+    result.radiance = glm::vec3(light.emission) * (cosLight * light.emission.w / (distanceSquared * pdf));
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "util.h"
+
+const float LIGHT_POINT = 0.0f;
+const float LIGHT_TRIANGLE = 1.0f;
+
+// compute_raytracing_1.glsl の LightSource (std430, binding 10)
+struct LightSource {
+    glm::vec4 position;     // xyz: 点光源の位置か三角形の v0, w: LIGHT_POINT / LIGHT_TRIANGLE
+    glm::vec4 edge1;        // 三角形の v1 - v0
+    glm::vec4 edge2;        // 三角形の v2 - v0
+    glm::vec4 emission;     // rgb: 点光源の強さか三角形の放射輝度, w: 三角形の面積
+};
+
+// compute_raytracing_1.glsl の LightNode (std430, binding 9). 32 bytes
+struct LightBVHNode {
+    glm::vec3 min;
+    float power;            // 部分木の光源の明るさの合計
+    glm::vec3 max;
+    int child;              // >= 0: 子は child と child + 1, < 0: 葉で光源は -child - 1
+};
+
+struct LightSample {
+    glm::vec3 direction;    // シェーディング点から光源へ (正規化済み)
+    float distance;
+    glm::vec3 radiance;     // 表面側の cos を除いた寄与を, 光源と光源上の点を選んだ確率で割ったもの
+};
+
+// 多数の光源から, シェーディング点への寄与の見積もり (明るさ / 距離^2) に比例した確率で光源を選ぶための木.
+// 選んだ確率で割るので, 光源をいくつ選んでも期待値はすべての光源を足したものと同じになる
+class LightBVH {
+public:
+    LightBVH(const std::vector<Light>& pointLights, const std::vector<EmissiveTriangle>& emissiveTriangles);
+
+    const std::vector<LightSource>& getLights() const { return lights; }
+    const std::vector<LightBVHNode>& getNodes() const { return nodes; }
+
+    // 光源の番号を返す (光源がなければ -1). pdf はその光源を選ぶ確率
+    int pick(const glm::vec3& point, float u, float& pdf) const;
+    // u.x で光源を, u.y と u.z で三角形上の点を選ぶ. 寄与がなければ false
+    bool sample(const glm::vec3& point, const glm::vec3& u, LightSample& result) const;
+
+private:
+    void build(int nodeIndex, int start, int end);
+
+    std::vector<LightSource> lights;
+    std::vector<LightBVHNode> nodes;
+    std::vector<int> order;             // 構築用. 葉の順に並べた光源の番号
+    std::vector<glm::vec3> lightMin;    // 構築用の光源ごとの境界
+    std::vector<glm::vec3> lightMax;
+    std::vector<float> lightPower;
+};
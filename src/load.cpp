@@ -3,6 +3,8 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
 #include "load.h"
+#include <algorithm>
+#include <cfloat>
 #include <iostream>
 
 Model::Model(const std::string& path) {
@@ -130,6 +132,12 @@ void Model::loadModel(const std::string& path) {
 
 std::vector<Triangle> extractTriangles(const std::vector<primitive>& primitives) {
     std::vector<Triangle> triangles;
+    extractTriangles(primitives, triangles);
+    return triangles;
+}
+
+void extractTriangles(const std::vector<primitive>& primitives, std::vector<Triangle>& triangles) {
+    triangles.clear();
     for (const auto& prim : primitives) {
         for (size_t i = 0; i < prim.indices.size(); i += 3) {
             Triangle tri;
@@ -143,27 +151,25 @@ std::vector<Triangle> extractTriangles(const std::vector<primitive>& primitives)
             triangles.push_back(tri);
         }
     }
-    return triangles;
 }
 
-BVHNode* buildBVH(std::vector<Triangle>& triangles, int start, int end) {
-    if (start >= end) return nullptr;
+namespace {
 
-    BVHNode* node = new BVHNode();
+BVHNode* buildRange(BVHArena& arena, int start, int end) {
+    // nodes は最初に 2n - 1 個分確保してあるので, ポインタは構築の間ずっと有効
+    arena.nodes.emplace_back();
+    BVHNode* node = &arena.nodes.back();
 
     glm::vec3 minBound(FLT_MAX), maxBound(-FLT_MAX);
     for (int i = start; i < end; ++i) {
-        const Triangle& tri = triangles[i];
-        for (const glm::vec3& v : {tri.v0, tri.v1, tri.v2}) {
-            minBound = glm::min(minBound, v);
-            maxBound = glm::max(maxBound, v);
-        }
+        minBound = glm::min(minBound, arena.boundsMin[arena.order[i]]);
+        maxBound = glm::max(maxBound, arena.boundsMax[arena.order[i]]);
     }
     node->bounds[0] = minBound;
     node->bounds[1] = maxBound;
 
     if (end - start == 1) {
-        node->triangleIndex = start;
+        node->triangleIndex = arena.order[start];
         node->left = node->right = nullptr;
         return node;
     }
@@ -177,27 +183,42 @@ BVHNode* buildBVH(std::vector<Triangle>& triangles, int start, int end) {
     }
 
     int mid = (start + end) / 2;
-    std::nth_element(triangles.begin() + start, triangles.begin() + mid, triangles.begin() + end,
-                     [axis](const Triangle& a, const Triangle& b) {
-                         return (a.v0[axis] + a.v1[axis] + a.v2[axis]) <
-                                (b.v0[axis] + b.v1[axis] + b.v2[axis]);
+    const std::vector<glm::vec3>& centroids = arena.centroids;
+    std::nth_element(arena.order.begin() + start, arena.order.begin() + mid, arena.order.begin() + end,
+                     [&centroids, axis](int a, int b) {
+                         return centroids[a][axis] < centroids[b][axis];
                      });
 
-    node->left = buildBVH(triangles, start, mid);
-    node->right = buildBVH(triangles, mid, end);
+    node->left = buildRange(arena, start, mid);
+    node->right = buildRange(arena, mid, end);
     node->triangleIndex = -1;
 
     return node;
 }
 
-BVHNode* generateBVH(const std::vector<primitive>& primitives) {
-    std::vector<Triangle> triangles = extractTriangles(primitives);
-    return buildBVH(triangles, 0, triangles.size());
+} // namespace
+
+BVHNode* buildBVH(const std::vector<Triangle>& triangles, BVHArena& arena) {
+    arena.nodes.clear();
+    if (triangles.empty()) return nullptr;
+
+    size_t count = triangles.size();
+    arena.nodes.reserve(2 * count - 1);
+    arena.order.resize(count);
+    arena.centroids.resize(count);
+    arena.boundsMin.resize(count);
+    arena.boundsMax.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        const Triangle& tri = triangles[i];
+        arena.order[i] = static_cast<int>(i);
+        arena.centroids[i] = (tri.v0 + tri.v1 + tri.v2) / 3.0f;
+        arena.boundsMin[i] = glm::min(tri.v0, glm::min(tri.v1, tri.v2));
+        arena.boundsMax[i] = glm::max(tri.v0, glm::max(tri.v1, tri.v2));
+    }
+    return buildRange(arena, 0, static_cast<int>(count));
 }
 
-void freeBVH(BVHNode* node) {
-    if (!node) return;
-    freeBVH(node->left);
-    freeBVH(node->right);
-    delete node;
-}
\ No newline at end of file
+BVHNode* generateBVH(const std::vector<primitive>& primitives, BVHArena& arena) {
+    extractTriangles(primitives, arena.triangles);
+    return buildBVH(arena.triangles, arena);
+}
@@ -47,7 +47,21 @@ struct BVHNode {
     int triangleIndex;    // -1 ならリーフでない
 };
 
+// buildBVH のノードと作業用の配列. 作り直すときは中身だけ捨てて容量を使い回すので, 同じくらいの大きさなら
+// 2 回目からはヒープを確保しない. ノードは次に作り直すか arena を捨てるまで有効
+struct BVHArena {
+    std::vector<Triangle> triangles;    // generateBVH が取り出した三角形
+    std::vector<BVHNode> nodes;
+    // 三角形の番号を並べ替えて分ける. 重心とバウンディングボックスは最初に一度だけ計算する
+    std::vector<int> order;
+    std::vector<glm::vec3> centroids;
+    std::vector<glm::vec3> boundsMin;
+    std::vector<glm::vec3> boundsMax;
+};
+
 std::vector<Triangle> extractTriangles(const std::vector<primitive>& primitives);
-BVHNode* buildBVH(std::vector<Triangle>& triangles, int start, int end);
-BVHNode* generateBVH(const std::vector<primitive>& primitives);
-void freeBVH(BVHNode* node);
+void extractTriangles(const std::vector<primitive>& primitives, std::vector<Triangle>& triangles);
+// 葉の triangleIndex は triangles の番号. triangles は並べ替えない
+BVHNode* buildBVH(const std::vector<Triangle>& triangles, BVHArena& arena);
+// 三角形は arena.triangles に取り出す
+BVHNode* generateBVH(const std::vector<primitive>& primitives, BVHArena& arena);
@@ -3,14 +3,32 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <fstream>
 #include <iostream>
+#include <memory>
 #include "camera.h"
 #include "shader.h"
 #include "model.h"
 #include "cshader.h"
 #include "util.h"
 #include "bvh.h"
+#include "presplit.h"
 #include "quad.h"
+#include "wavefront.h"
+#include "heatmap.h"
+#include "profiler.h"
+#include "uniform_ring.h"
+#include "shader_variant.h"
+#include "program_cache.h"
+#include "autotune.h"
+#include "dynamic_resolution.h"
+#include "frame_pipeline.h"
+#include "light_bvh.h"
+#include "denoiser.h"
+#include "visibility.h"
+#include "culling.h"
+#include "streaming.h"
+#include "scene.h"
 
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
@@ -22,14 +40,119 @@ const unsigned int SCR_HEIGHT = 800;
 Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
 float lastX = SCR_WIDTH / 2.0f;
 float lastY = SCR_HEIGHT / 2.0f;
+// size of the default framebuffer, render targets follow it (0 while minimized)
+int windowWidth = SCR_WIDTH;
+int windowHeight = SCR_HEIGHT;
+bool windowResized = false;
 bool firstMouse = true;
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
+bool useStackless = false;
+bool traversalKeyPressed = false;
 
-struct Light {
-    glm::vec4 position;
-    glm::vec4 color;
-};
+// R cycles through the single-pass kernel and the multi-pass pipeline with/without ray sorting
+enum RenderMode { MEGAKERNEL, WAVEFRONT, WAVEFRONT_SORTED };
+const char* renderModeNames[] = {"megakernel", "wavefront", "wavefront sorted"};
+const int WAVEFRONT_BOUNCES = 3;
+RenderMode renderMode = MEGAKERNEL;
+bool renderModeKeyPressed = false;
+
+// H shows the traversal cost heatmap (instrumented shader variants), M cycles the counter shown
+bool showHeatmap = false;
+bool heatmapKeyPressed = false;
+TraversalHeatmap::Metric heatmapMetric = TraversalHeatmap::NODES_VISITED;
+bool metricKeyPressed = false;
+
+// O toggles the profiler overlay, P writes the recorded phases as a Chrome trace and CSV
+bool showOverlay = true;
+bool overlayKeyPressed = false;
+bool exportRequested = false;
+bool exportKeyPressed = false;
+
+// V toggles dynamic resolution: the trace renders into a smaller part of the target when the GPU time of the
+// whole frame (every profiled GPU phase) is over budget
+const float FRAME_BUDGET_MS = 12.0f;
+bool useDynamicResolution = false;
+bool dynamicResolutionKeyPressed = false;
+
+// F cycles the output image format, C saves the traced image as capture.png.
+// RGBA16F halves the image traffic of RGBA32F; the display formats are tonemapped in the compute pass
+OutputFormat outputFormat = OUTPUT_RGBA16F;
+bool formatKeyPressed = false;
+bool captureRequested = false;
+bool captureKeyPressed = false;
+
+// B toggles frame pipelining: trace frame N into one of several targets while frame N-1 is shown
+bool usePipelining = true;
+bool pipeliningKeyPressed = false;
+
+// G toggles path tracing: diffuse bounces with Russian roulette instead of one mirror bounce.
+// paths that end are compacted out of the wavefront queue, so later bounces only trace live paths
+const int PATH_BOUNCES = 8;
+bool usePathTracing = false;
+bool pathTracingKeyPressed = false;
+
+// L toggles many-light sampling: each hit shades LIGHT_SAMPLES lights picked through the light BVH
+// (point lights and emissive triangles of the model) instead of looping over every point light
+const int LIGHT_SAMPLES = 1;
+bool useLightSampling = false;
+bool lightSamplingKeyPressed = false;
+
+// N cycles the denoiser: the kernels also write a G-buffer and trace into a linear image that the
+// denoiser writes into the render target in its format. The temporal modes reproject the previous frames'
+// accumulated colour through the motion buffer, the spatial modes run the a-trous filter
+enum DenoiseMode { DENOISE_OFF, DENOISE_SPATIAL, DENOISE_TEMPORAL, DENOISE_TEMPORAL_SPATIAL, NUM_DENOISE_MODES };
+const char* denoiseModeNames[] = {"", ", spatial denoiser", ", temporal accumulation",
+                                  ", temporal and spatial denoiser"};
+DenoiseMode denoiseMode = DENOISE_OFF;
+bool denoiserKeyPressed = false;
+
+// X toggles hybrid rendering: the first hits are rasterized into a visibility buffer with the model's VAOs
+// and the kernels only trace the shadow and secondary rays
+bool useHybrid = false;
+bool hybridKeyPressed = false;
+
+// Z toggles culling of the rasterized first hits: a compute pass keeps the draws inside the frustum and not
+// behind the previous frame's hierarchical-Z, and the visibility buffer draws only those
+bool useCulling = false;
+bool cullingKeyPressed = false;
+
+// K toggles levels of detail: each mesh uses the coarsest simplified level whose error stays under a pixel.
+// The first time, every level of every draw becomes a mesh of a Scene with its own BVH, and each draw gets an
+// instance. The levels follow the camera every frame: a draw whose level changes only moves its instance to
+// another mesh, which refits the instance tree. The culling pass rasterizes the same levels, so the traced rays
+// and the rasterized first hits see one surface
+bool useLod = false;
+bool lodKeyPressed = false;
+
+// U toggles geometry streaming: the scene is split into clusters with their own BVHs in a page file, and the
+// kernels only trace the pages a loader thread has uploaded so far. Clusters the rays reach are requested, pages
+// that went unused are evicted under the budget. The page file is a cache of the full-detail triangles next to
+// the program cache: it is written again when its source key (triangle count and hash) no longer matches.
+// The full-detail BVH and its SSBOs are released while streaming and built again when U turns it off. The model
+// itself stays loaded, the rasterized first hits and the page file check read it
+const char* PAGE_FILE = "shader_cache/scene.pages";
+bool useStreaming = false;
+bool streamingKeyPressed = false;
+
+// J toggles the instanced scene: the model becomes one mesh of a Scene with its own BVH, placed by an instance
+// tree that the kernels walk first. I places another copy of the model in front of the camera and Y removes the
+// last one; the copies spin, so every frame only refits the instance tree and re-uploads what moved
+bool useScene = false;
+bool sceneKeyPressed = false;
+bool addInstanceRequested = false;
+bool addInstanceKeyPressed = false;
+bool removeInstanceRequested = false;
+bool removeInstanceKeyPressed = false;
+
+// Tab toggles the per-second statistics on the console: frame time, latency, heatmap averages, streaming,
+// scene edits and the profiler summary
+bool printStats = false;
+bool statsKeyPressed = false;
+
+// set when the output format, path tracing, light sampling, the denoiser, hybrid rendering, streaming, the instanced
+// scene or levels of detail change, the kernels are rebuilt at the start of the next frame
+bool kernelsChanged = false;
 
 std::vector<Light> lights = {
     {glm::vec4(0.0f, 5.0f, 0.0f, 1.0f), glm::vec4(1.0f, 1.0f, 1.0f, 1.0f)},
@@ -62,66 +185,479 @@ int main() {
 
     Model model(SOURCE_DIR "/asset/furina/scene.gltf");
 
-    std::vector<Triangle> triangles = model.getTriangles();
-    std::vector<Data> dataArray = makeData(triangles);
-    BVH bvh(dataArray);
-    const std::vector<BVHNode>& nodes = bvh.getNodes();
-    const std::vector<Data>& data = bvh.getDataArray();
-    GLuint triangleSSBO = createSSBO(data.data(), data.size() * sizeof(Data), 0);
-    GLuint nodeSSBO = createSSBO(nodes.data(), nodes.size() * sizeof(BVHNode), 1);
+    // the BVH traces level 0 of every mesh, K traces the levels in lodLevels through lodScene instead.
+    // the culler draws the same levels
+    std::vector<int> lodLevels(model.getDrawCount(), 0);
+    std::vector<Data> dataArray = makeData(model.getTriangles());
+    // the full-detail BVH and its SSBOs. Streaming traces only its pages, so they are released while it is on
+    std::vector<PrimRef> refs;
+    std::unique_ptr<BVH> bvh;
+    GLuint triangleSSBO = 0;
+    GLuint nodeSSBO = 0;
+    auto buildBVH = [&]() {
+        presplit(dataArray, refs);
+        bvh.reset(new BVH(dataArray, refs));
+        const std::vector<Data>& data = bvh->getDataArray();
+        const std::vector<BVHNode>& nodes = bvh->getNodes();
+        triangleSSBO = createSSBO(data.data(), data.size() * sizeof(Data), 0);
+        nodeSSBO = createSSBO(nodes.data(), nodes.size() * sizeof(BVHNode), 1);
+    };
+    auto releaseBVH = [&]() {
+        bvh.reset();
+        std::vector<PrimRef>().swap(refs);
+        glDeleteBuffers(1, &triangleSSBO);
+        glDeleteBuffers(1, &nodeSSBO);
+        triangleSSBO = nodeSSBO = 0;
+    };
+    buildBVH();
     GLuint lightSSBO = createSSBO(lights.data(), lights.size() * sizeof(Light), 2);
+    LightBVH lightBVH(lights, model.getEmissiveTriangles());
+    const std::vector<LightSource>& lightSources = lightBVH.getLights();
+    const std::vector<LightBVHNode>& lightNodes = lightBVH.getNodes();
+    GLuint lightNodeSSBO = createSSBO(lightNodes.data(), lightNodes.size() * sizeof(LightBVHNode), 9);
+    GLuint lightSourceSSBO = createSSBO(lightSources.data(), lightSources.size() * sizeof(LightSource), 10);
+    // the visibility buffer names every triangle of the model's index buffer (levels of detail included) in
+    // model order, the BVH reorders its copy of the traced levels
+    VisibilityBuffer visibilityBuffer(makeData(model.getIndexBufferTriangles()), SCR_WIDTH, SCR_HEIGHT);
+    DrawCuller drawCuller(model, SCR_WIDTH, SCR_HEIGHT);
+    std::cout << "light BVH: " << lightSources.size() << " lights (" << model.getEmissiveTriangles().size()
+              << " emissive triangles), " << lightNodes.size() << " nodes" << std::endl;
 
-    // compute_shader
-    Cshader cshader(SOURCE_DIR "/src/shader/compute_raytracing_1.glsl");
+    // camera and frame state for all compute variants, one std140 block updated per frame
+    UniformRing frameRing(sizeof(FrameUniforms), 0);
+    FrameUniforms frameUniforms;
+    frameUniforms.aspectRatio = (float)SCR_WIDTH / (float)SCR_HEIGHT;
+    frameUniforms.renderSize = glm::ivec2(SCR_WIDTH, SCR_HEIGHT);
+    frameUniforms.numLights = (int)lights.size();
+    frameUniforms.frameIndex = 0;
 
     // quad is used for to show the image computed by compute_shader
     Quad quad;
 
-    // framebuffer for compute_shader
-    GLuint framebufferTexture = createTexture(SCR_WIDTH, SCR_HEIGHT);
-    GLuint framebuffer = createFramebuffer(framebufferTexture);
+    // render targets for compute_shader, sized to the window.
+    // the quad tonemaps the accumulation formats, the display formats are already encoded by the kernel
+    FramePipeline framePipeline(3);
+    framePipeline.resize(SCR_WIDTH, SCR_HEIGHT, outputFormat);
+    quad.setEncodeOutput(!isDisplayFormat(outputFormat));
+
+    // linked programs are cached in shader_cache/ so later launches skip compilation
+    const char* kernelPath = SOURCE_DIR "/src/shader/compute_raytracing_1.glsl";
+    ProgramCache programCache("shader_cache");
+
+    // workgroup shape of the single-pass kernels, timed from the start camera on this scene and driver.
+    // the choice is saved, so this only runs the first time
+    frameUniforms.cameraPosition = camera.Position;
+    frameUniforms.cameraFront = camera.Front;
+    frameUniforms.cameraUp = camera.Up;
+    frameUniforms.cameraRight = camera.Right;
+    frameUniforms.fov = camera.Zoom;
+    frameUniforms.previousViewProjection = glm::mat4(0.0f);
+    frameUniforms.previousCameraPosition = camera.Position;
+    frameRing.update(&frameUniforms);
+    WorkgroupAutotuner autotuner("shader_cache/workgroup.txt");
+    std::string sceneKey = "furina " + std::to_string(bvh->getDataArray().size()) + " triangles";
+    ShaderVariant stackVariant = autotuner.tune(kernelPath, ShaderVariant().withOutputFormat(outputFormat), sceneKey,
+                                                framePipeline.displayTarget().texture, SCR_WIDTH, SCR_HEIGHT,
+                                                &programCache);
+    frameRing.fence();
+
+    // variants of the master kernel, T switches between the stack and the stackless traversal
+    ShaderVariant stacklessVariant = stackVariant.withTraversal(TRAVERSAL_STACKLESS);
+    ShaderVariant wavefrontVariant = stackVariant.withWavefront();
+    Cshader stackShader(kernelPath, stackVariant.defines(), &programCache);
+    Cshader stacklessShader(kernelPath, stacklessVariant.defines(), &programCache);
+    Cshader wavefrontShader(kernelPath, wavefrontVariant.defines(), &programCache);
+    Wavefront wavefront(SCR_WIDTH, SCR_HEIGHT);
+    Denoiser denoiser(SCR_WIDTH, SCR_HEIGHT);
+
+    // same kernels with the traversal counters compiled in, only used while the heatmap is shown
+    Cshader stackStatsShader(kernelPath, stackVariant.withTraversalStats().defines(), &programCache);
+    Cshader stacklessStatsShader(kernelPath, stacklessVariant.withTraversalStats().defines(), &programCache);
+    Cshader wavefrontStatsShader(kernelPath, wavefrontVariant.withTraversalStats().defines(), &programCache);
+    std::cout << "shader cache: " << programCache.getHits() << " loaded, "
+              << programCache.getMisses() << " compiled" << std::endl;
+    auto rebuildShader = [&](Cshader& shader, const ShaderVariant& variant) {
+        glDeleteProgram(shader.ID);
+        shader = Cshader(kernelPath, variant.defines(), &programCache);
+    };
+    TraversalHeatmap heatmap(SCR_WIDTH, SCR_HEIGHT);
+    TraversalStats traversalTotal;
+    // created the first time U is pressed
+    std::unique_ptr<GeometryStreamer> streamer;
+    // filled the first time J is pressed
+    Scene scene;
+    MeshHandle sceneMesh = {-1};
+    std::vector<InstanceHandle> sceneCopies;
+    std::vector<glm::vec3> copyPositions;
+    // filled the first time K is pressed: the mesh of each (draw, level) and one instance per draw
+    Scene lodScene;
+    std::vector<MeshHandle> lodMeshes;
+    std::vector<InstanceHandle> lodInstances;
+    // which scene the instance kernels trace, chosen with them
+    bool traceLodScene = false;
+    SceneCommitStats sceneStats;
+
+    Profiler profiler;
+    DynamicResolution dynamicResolution(FRAME_BUDGET_MS);
+    glm::ivec2 renderSize(SCR_WIDTH, SCR_HEIGHT);
+
+    float frameTimeSum = 0.0f;
+    int frameCount = 0;
+    double latencySum = 0.0;
+    int latencyCount = 0;
 
     // Main loop
     while (!glfwWindowShouldClose(window)) {
+        // nothing to render into while minimized
+        if (windowWidth == 0 || windowHeight == 0) {
+            glfwWaitEvents();
+            continue;
+        }
+        if (kernelsChanged) {
+            // the tuned workgroup shape is kept
+            kernelsChanged = false;
+            if (useStreaming && bvh) releaseBVH();
+            if (useStreaming && !streamer) {
+                bool current = std::ifstream(PAGE_FILE) && ClusterFile(PAGE_FILE).matches(dataArray);
+                if (!current && writeClusterFile(PAGE_FILE, dataArray))
+                    std::cout << "page file written to " << PAGE_FILE << std::endl;
+                streamer.reset(new GeometryStreamer(PAGE_FILE));
+            }
+            if (useStreaming && streamer->getSlotCount() == 0) {
+                std::cerr << "streaming disabled, no pages in " << PAGE_FILE << std::endl;
+                useStreaming = false;
+            }
+            if (!useStreaming && !bvh) buildBVH();
+            if (useScene && sceneMesh.index < 0) {
+                sceneMesh = scene.addMesh(dataArray);
+                scene.addInstance(sceneMesh, glm::mat4(1.0f));
+                for (const Light& light : lights) scene.addLight(light);
+            }
+            if (useLod && lodInstances.empty()) {
+                // levels that could not be simplified repeat the one before and share its mesh
+                const std::vector<DrawLod>& drawLods = model.getDrawLods();
+                std::vector<Triangle> triangles;
+                std::vector<Data> meshData;
+                for (size_t draw = 0; draw < model.getDrawCount(); ++draw) {
+                    for (int level = 0; level < Model::MAX_LOD_LEVELS; ++level) {
+                        size_t index = draw * Model::MAX_LOD_LEVELS + level;
+                        if (level > 0 && drawLods[index].firstIndex == drawLods[index - 1].firstIndex) {
+                            lodMeshes.push_back(lodMeshes.back());
+                            continue;
+                        }
+                        model.getTriangles(draw, level, triangles);
+                        makeData(triangles, meshData);
+                        lodMeshes.push_back(lodScene.addMesh(meshData));
+                    }
+                    MeshHandle mesh = lodMeshes[draw * Model::MAX_LOD_LEVELS + lodLevels[draw]];
+                    lodInstances.push_back(lodScene.addInstance(mesh, glm::mat4(1.0f)));
+                }
+                for (const Light& light : lights) lodScene.addLight(light);
+                std::cout << "levels of detail: " << lodScene.getMeshCount() << " meshes, one instance per draw"
+                          << std::endl;
+            }
+            traceLodScene = useLod;
+            if (!useStreaming && !useScene && !useLod) {
+                // the streamer and the scenes bind their own pools in place of the BVH
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, triangleSSBO);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, nodeSSBO);
+                glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, lightSSBO);
+            }
+            stackVariant = stackVariant.withDenoiser(denoiseMode != DENOISE_OFF, outputFormat)
+                               .withPathTracing(usePathTracing, PATH_BOUNCES)
+                               .withLightSamples(useLightSampling ? LIGHT_SAMPLES : 0)
+                               .withVisibilityBuffer(useHybrid)
+                               .withStreaming(useStreaming)
+                               .withInstances(useScene || useLod);
+            // the sampling kernels read the light sources instead of the point lights
+            frameUniforms.numLights = (int)(useLightSampling ? lightSources.size()
+                                            : useScene ? scene.getLightCount()
+                                            : useLod ? lodScene.getLightCount() : lights.size());
+            stacklessVariant = stackVariant.withTraversal(TRAVERSAL_STACKLESS);
+            wavefrontVariant = stackVariant.withWavefront();
+            rebuildShader(stackShader, stackVariant);
+            rebuildShader(stacklessShader, stacklessVariant);
+            rebuildShader(wavefrontShader, wavefrontVariant);
+            rebuildShader(stackStatsShader, stackVariant.withTraversalStats());
+            rebuildShader(stacklessStatsShader, stacklessVariant.withTraversalStats());
+            rebuildShader(wavefrontStatsShader, wavefrontVariant.withTraversalStats());
+            std::cout << "output format " << outputFormatName(outputFormat) << ", "
+                      << (usePathTracing ? "path tracing" : "mirror bounce") << ", "
+                      << (useLightSampling ? "light BVH sampling" : "all lights")
+                      << denoiseModeNames[denoiseMode] << (useHybrid ? ", rasterized first hits" : "")
+                      << (useStreaming ? ", streamed geometry" : "") << (useScene ? ", instanced scene" : "")
+                      << (useLod ? ", levels of detail" : "") << std::endl;
+        }
+        // the wavefront pipeline accumulates bounces in the image, so it may need a linear format.
+        // the denoiser writes the target itself, so any format works
+        bool denoise = stackVariant.gbuffer;
+        OutputFormat targetFormat = denoise ? outputFormat
+                                  : renderMode == MEGAKERNEL ? stackVariant.outputFormat
+                                  : wavefrontVariant.outputFormat;
+        if (windowResized || targetFormat != framePipeline.getFormat()) {
+            windowResized = false;
+            framePipeline.resize(windowWidth, windowHeight, targetFormat);
+            quad.setEncodeOutput(!isDisplayFormat(targetFormat));
+        }
+        if (usePipelining != framePipeline.isPipelined())
+            framePipeline.setPipelined(usePipelining);
+
+        profiler.beginFrame();
         float currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
 
+        frameTimeSum += deltaTime;
+        ++frameCount;
+        if (frameTimeSum >= 1.0f) {
+            if (printStats) {
+                // latency: from reading the input to the swap that shows the frame, one frame longer when pipelined
+                std::cout << renderModeNames[renderMode] << ", "
+                          << (useStackless ? "stackless" : "stack") << " traversal: "
+                          << 1000.0f * frameTimeSum / frameCount << " ms/frame, "
+                          << renderSize.x << "x" << renderSize.y << " of " << windowWidth << "x" << windowHeight << " "
+                          << outputFormatName(framePipeline.getFormat()) << std::endl;
+                std::cout << "  " << (framePipeline.isPipelined() ? "pipelined" : "serial") << ": "
+                          << frameCount / frameTimeSum << " frames/s, latency "
+                          << (latencyCount > 0 ? 1000.0 * latencySum / latencyCount : 0.0) << " ms" << std::endl;
+                if (showHeatmap) {
+                    // per pixel averages over the frames of this interval
+                    double pixels = static_cast<double>(renderSize.x) * renderSize.y * frameCount;
+                    std::cout << "  per pixel: " << traversalTotal.nodesVisited / pixels << " nodes visited, "
+                              << traversalTotal.aabbTests / pixels << " AABB tests, "
+                              << traversalTotal.triangleTests / pixels << " triangle tests, max stack depth "
+                              << traversalTotal.maxStackDepth << std::endl;
+                }
+                if (stackVariant.streaming) {
+                    std::cout << "  streaming: " << streamer->getResidentCount() << " of "
+                              << streamer->getClusterCount() << " clusters resident ("
+                              << streamer->getSlotCount() << " slots), " << streamer->getPendingCount() << " loading"
+                              << std::endl;
+                }
+                if (stackVariant.instances) {
+                    const Scene& traced = traceLodScene ? lodScene : scene;
+                    std::cout << "  scene: " << traced.getInstanceCount() << " instances, last commit "
+                              << sceneStats.meshesBuilt << " meshes built, " << sceneStats.instancesUpdated
+                              << " instances updated, "
+                              << (sceneStats.instanceTreeRebuilt ? "tree rebuilt" : "tree refit")
+                              << ", " << sceneStats.bytesUploaded << " bytes uploaded" << std::endl;
+                }
+                std::cout << "  " << profiler.summary() << std::endl;
+            }
+            latencySum = 0.0;
+            latencyCount = 0;
+            traversalTotal = TraversalStats();
+            frameTimeSum = 0.0f;
+            frameCount = 0;
+        }
+
+        profiler.beginPhase("input", false);
+        double inputTime = glfwGetTime();
         processInput(window);
+        if (exportRequested) {
+            exportRequested = false;
+            if (profiler.writeChromeTrace("profile_trace.json") && profiler.writeCsv("profile.csv"))
+                std::cout << "profile written to profile_trace.json and profile.csv" << std::endl;
+        }
+        if (captureRequested) {
+            // the image shown by the previous frame
+            captureRequested = false;
+            const FramePipeline::Target& shown = framePipeline.displayTarget();
+            if (shown.traced && writeTexturePNG("capture.png", shown.texture, shown.renderSize.x, shown.renderSize.y,
+                                                framePipeline.getFormat()))
+                std::cout << "image written to capture.png" << std::endl;
+        }
+        if (useDynamicResolution != dynamicResolution.isEnabled())
+            dynamicResolution.setEnabled(useDynamicResolution);
+        float gpuFrameMs;
+        if (profiler.takeGpuFrameMs(gpuFrameMs)) dynamicResolution.update(gpuFrameMs);
+        renderSize = dynamicResolution.renderSize(windowWidth, windowHeight);
+        profiler.endPhase();
+
+        // the levels are chosen every frame, a change only re-points instances and the culler's levels
+        std::vector<int> levels = useLod ? model.selectLods(camera.Position, Model::lodScale(camera.Zoom, renderSize.y))
+                                         : std::vector<int>(model.getDrawCount(), 0);
+        if (levels != lodLevels) {
+            lodLevels.swap(levels);
+            drawCuller.setLevels(lodLevels);
+        }
 
-        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
-        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+        Cshader& cshader = showHeatmap
+            ? (renderMode != MEGAKERNEL ? wavefrontStatsShader : useStackless ? stacklessStatsShader : stackStatsShader)
+            : (renderMode != MEGAKERNEL ? wavefrontShader : useStackless ? stacklessShader : stackShader);
+        // waits only when the GPU is frames behind, otherwise input and uniforms overlap the previous trace
+        profiler.beginPhase("pace", false);
+        FramePipeline::Target& traceTarget = framePipeline.beginTrace(inputTime, renderSize);
+        profiler.endPhase();
+
+        bool hybrid = stackVariant.visibility;
+        if (hybrid) {
+            profiler.beginPhase("visibility");
+            visibilityBuffer.resize(renderSize.x, renderSize.y);
+            drawCuller.resize(renderSize.x, renderSize.y);
+            // the culling pass applies the traced levels of detail, so it also runs for them
+            bool cull = useCulling || useLod;
+            visibilityBuffer.render(model, camera, renderSize, cull ? &drawCuller : nullptr);
+            profiler.endPhase();
+        }
+        // the hierarchical-Z is only kept up to date while culling runs
+        if (!hybrid || !(useCulling || useLod)) drawCuller.discardHiZ();
+
+        if (stackVariant.instances) {
+            // edits of this frame are batched into one commit before the trace
+            profiler.beginPhase("scene");
+            if (traceLodScene) {
+                for (size_t draw = 0; draw < lodInstances.size(); ++draw) {
+                    lodScene.setMesh(lodInstances[draw], lodMeshes[draw * Model::MAX_LOD_LEVELS + lodLevels[draw]]);
+                }
+                sceneStats = lodScene.commit();
+                lodScene.bind();
+            } else {
+                if (addInstanceRequested) {
+                    glm::vec3 position = camera.Position + camera.Front * 3.0f;
+                    sceneCopies.push_back(scene.addInstance(sceneMesh, glm::translate(glm::mat4(1.0f), position)));
+                    copyPositions.push_back(position);
+                }
+                if (removeInstanceRequested && !sceneCopies.empty()) {
+                    scene.removeInstance(sceneCopies.back());
+                    sceneCopies.pop_back();
+                    copyPositions.pop_back();
+                }
+                for (size_t i = 0; i < sceneCopies.size(); ++i) {
+                    glm::mat4 transform = glm::translate(glm::mat4(1.0f), copyPositions[i]);
+                    scene.setTransform(sceneCopies[i],
+                                       glm::rotate(transform, currentFrame, glm::vec3(0.0f, 1.0f, 0.0f)));
+                }
+                sceneStats = scene.commit();
+                scene.bind();
+            }
+            profiler.endPhase();
+        }
+        addInstanceRequested = false;
+        removeInstanceRequested = false;
+
+        bool streaming = stackVariant.streaming;
+        if (streaming) {
+            // pages loaded since the last frame are uploaded before the trace that stamps this frame index
+            profiler.beginPhase("streaming");
+            streamer->update(frameUniforms.frameIndex);
+            streamer->bind();
+            profiler.endPhase();
+        }
+
+        profiler.beginPhase("uniforms");
+        heatmap.resize(renderSize.x, renderSize.y);
+        if (showHeatmap) heatmap.clear();
+
+        glBindFramebuffer(GL_FRAMEBUFFER, traceTarget.framebuffer);
+        glViewport(0, 0, renderSize.x, renderSize.y);
         cshader.use();
-        cshader.setVec3("cameraPosition", camera.Position);
-        cshader.setVec3("cameraFront", camera.Front);
-        cshader.setVec3("cameraUp", camera.Up);
-        cshader.setVec3("cameraRight", camera.Right);
-        cshader.setFloat("aspectRatio", (float)SCR_WIDTH / (float)SCR_HEIGHT);
-        cshader.setFloat("fov", camera.Zoom);
-        cshader.setInt("numLights", (int)lights.size());
-
-        glBindImageTexture(0, framebufferTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
-        glDispatchCompute((GLuint)SCR_WIDTH / 16, (GLuint)SCR_HEIGHT / 16, 1);
+        frameUniforms.cameraPosition = camera.Position;
+        frameUniforms.cameraFront = camera.Front;
+        frameUniforms.cameraUp = camera.Up;
+        frameUniforms.cameraRight = camera.Right;
+        frameUniforms.fov = camera.Zoom;
+        frameUniforms.aspectRatio = (float)renderSize.x / (float)renderSize.y;
+        frameUniforms.renderSize = renderSize;
+        frameRing.update(&frameUniforms);
+        ++frameUniforms.frameIndex;
+        // the motion buffer of the next frame points back into this one
+        frameUniforms.previousViewProjection = camera.GetViewProjectionMatrix(frameUniforms.aspectRatio);
+        frameUniforms.previousCameraPosition = camera.Position;
+        profiler.endPhase();
+
+        profiler.beginPhase("dispatch");
+        GLuint traceTexture = denoise ? denoiser.colorTexture() : traceTarget.texture;
+        OutputFormat traceFormat = denoise ? OUTPUT_RGBA16F : framePipeline.getFormat();
+        if (denoise) {
+            denoiser.resize(renderSize.x, renderSize.y);
+            denoiser.bindGBuffer();
+        }
+        if (hybrid) visibilityBuffer.bind();
+        if (renderMode == MEGAKERNEL) {
+            glBindImageTexture(0, traceTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, outputInternalFormat(traceFormat));
+            // the stack and stackless variants share the tuned workgroup shape
+            glDispatchCompute(stackVariant.groupsX(renderSize.x), stackVariant.groupsY(renderSize.y), 1);
+        } else {
+            wavefront.resize(renderSize.x, renderSize.y);
+            wavefront.render(cshader, traceTexture, traceFormat,
+                             wavefrontVariant.pathTrace ? PATH_BOUNCES : WAVEFRONT_BOUNCES,
+                             renderMode == WAVEFRONT_SORTED);
+        }
+        frameRing.fence();
+        if (streaming) streamer->fence();
+        profiler.endPhase();
+
+        profiler.beginPhase("barrier");
         glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        profiler.endPhase();
+
+        if (denoise && !showHeatmap) {
+            profiler.beginPhase("denoise");
+            denoiser.apply(traceTarget.texture, framePipeline.getFormat(), renderSize,
+                           denoiseMode >= DENOISE_TEMPORAL, denoiseMode != DENOISE_TEMPORAL);
+            glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+            profiler.endPhase();
+        } else if (denoise) {
+            // the heatmap frames skip the denoiser, their G-buffer does not match the history
+            denoiser.discardHistory();
+        }
 
+        if (showHeatmap) {
+            profiler.beginPhase("heatmap readback", false);
+            traversalTotal.add(heatmap.readback());
+            profiler.endPhase();
+        }
+
+        profiler.beginPhase("blit");
         glBindFramebuffer(GL_FRAMEBUFFER, 0);
-        glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+        glViewport(0, 0, windowWidth, windowHeight);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, framebufferTexture);
-        quad.draw();
+        if (showHeatmap) {
+            heatmap.draw(heatmapMetric);
+        } else {
+            const FramePipeline::Target& shown = framePipeline.displayTarget();
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, shown.texture);
+            quad.setTextureScale((float)shown.renderSize.x / windowWidth, (float)shown.renderSize.y / windowHeight);
+            quad.draw();
+        }
+        framePipeline.endDisplay();
+        profiler.endPhase();
+
+        if (showOverlay) profiler.drawOverlay(10, 10, windowWidth / 2, 48);
 
+        profiler.beginPhase("swap", false);
         glfwSwapBuffers(window);
+        double latency = framePipeline.presented(glfwGetTime());
+        if (latency >= 0.0) {
+            latencySum += latency;
+            ++latencyCount;
+        }
         glfwPollEvents();
+        profiler.endPhase();
+        profiler.endFrame();
     }
 
     // Cleanup
-    glDeleteTextures(1, &framebufferTexture);
-    glDeleteFramebuffers(1, &framebuffer);
+    framePipeline.cleanup();
     glDeleteBuffers(1, &triangleSSBO);
     glDeleteBuffers(1, &nodeSSBO);
     glDeleteBuffers(1, &lightSSBO);
+    glDeleteBuffers(1, &lightNodeSSBO);
+    glDeleteBuffers(1, &lightSourceSSBO);
+    wavefront.cleanup();
+    denoiser.cleanup();
+    visibilityBuffer.cleanup();
+    drawCuller.cleanup();
+    if (streamer) streamer->cleanup();
+    scene.cleanup();
+    lodScene.cleanup();
+    model.cleanup();
+    heatmap.cleanup();
+    profiler.cleanup();
+    frameRing.cleanup();
     quad.cleanup();
     cleanup(window);
     return 0;
@@ -130,6 +666,9 @@ int main() {
 // Callback function for framebuffer size changes
 void framebuffer_size_callback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
+    windowResized = windowResized || width != windowWidth || height != windowHeight;
+    windowWidth = width;
+    windowHeight = height;
 }
 
 // Callback function for mouse movement
@@ -170,4 +709,141 @@ void processInput(GLFWwindow *window) {
         camera.ProcessKeyboard(UP, deltaTime);
     if (glfwGetKey(window, GLFW_KEY_Q) == GLFW_PRESS)
         camera.ProcessKeyboard(DOWN, deltaTime);
+
+    bool traversalKey = glfwGetKey(window, GLFW_KEY_T) == GLFW_PRESS;
+    if (traversalKey && !traversalKeyPressed)
+        useStackless = !useStackless;
+    traversalKeyPressed = traversalKey;
+
+    bool renderModeKey = glfwGetKey(window, GLFW_KEY_R) == GLFW_PRESS;
+    if (renderModeKey && !renderModeKeyPressed)
+        renderMode = static_cast<RenderMode>((renderMode + 1) % 3);
+    renderModeKeyPressed = renderModeKey;
+
+    bool heatmapKey = glfwGetKey(window, GLFW_KEY_H) == GLFW_PRESS;
+    if (heatmapKey && !heatmapKeyPressed)
+        showHeatmap = !showHeatmap;
+    heatmapKeyPressed = heatmapKey;
+
+    bool metricKey = glfwGetKey(window, GLFW_KEY_M) == GLFW_PRESS;
+    if (metricKey && !metricKeyPressed) {
+        heatmapMetric = static_cast<TraversalHeatmap::Metric>((heatmapMetric + 1) % TraversalHeatmap::NUM_METRICS);
+        std::cout << "heatmap: " << TraversalHeatmap::metricName(heatmapMetric) << std::endl;
+    }
+    metricKeyPressed = metricKey;
+
+    bool overlayKey = glfwGetKey(window, GLFW_KEY_O) == GLFW_PRESS;
+    if (overlayKey && !overlayKeyPressed)
+        showOverlay = !showOverlay;
+    overlayKeyPressed = overlayKey;
+
+    bool exportKey = glfwGetKey(window, GLFW_KEY_P) == GLFW_PRESS;
+    if (exportKey && !exportKeyPressed)
+        exportRequested = true;
+    exportKeyPressed = exportKey;
+
+    bool dynamicResolutionKey = glfwGetKey(window, GLFW_KEY_V) == GLFW_PRESS;
+    if (dynamicResolutionKey && !dynamicResolutionKeyPressed)
+        useDynamicResolution = !useDynamicResolution;
+    dynamicResolutionKeyPressed = dynamicResolutionKey;
+
+    bool formatKey = glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS;
+    if (formatKey && !formatKeyPressed) {
+        outputFormat = static_cast<OutputFormat>((outputFormat + 1) % NUM_OUTPUT_FORMATS);
+        kernelsChanged = true;
+    }
+    formatKeyPressed = formatKey;
+
+    bool pathTracingKey = glfwGetKey(window, GLFW_KEY_G) == GLFW_PRESS;
+    if (pathTracingKey && !pathTracingKeyPressed) {
+        usePathTracing = !usePathTracing;
+        kernelsChanged = true;
+    }
+    pathTracingKeyPressed = pathTracingKey;
+
+    bool lightSamplingKey = glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS;
+    if (lightSamplingKey && !lightSamplingKeyPressed) {
+        useLightSampling = !useLightSampling;
+        kernelsChanged = true;
+    }
+    lightSamplingKeyPressed = lightSamplingKey;
+
+    bool denoiserKey = glfwGetKey(window, GLFW_KEY_N) == GLFW_PRESS;
+    if (denoiserKey && !denoiserKeyPressed) {
+        denoiseMode = static_cast<DenoiseMode>((denoiseMode + 1) % NUM_DENOISE_MODES);
+        kernelsChanged = true;
+    }
+    denoiserKeyPressed = denoiserKey;
+
+    bool hybridKey = glfwGetKey(window, GLFW_KEY_X) == GLFW_PRESS;
+    if (hybridKey && !hybridKeyPressed) {
+        useHybrid = !useHybrid;
+        kernelsChanged = true;
+    }
+    hybridKeyPressed = hybridKey;
+
+    bool cullingKey = glfwGetKey(window, GLFW_KEY_Z) == GLFW_PRESS;
+    if (cullingKey && !cullingKeyPressed)
+        useCulling = !useCulling;
+    cullingKeyPressed = cullingKey;
+
+    bool lodKey = glfwGetKey(window, GLFW_KEY_K) == GLFW_PRESS;
+    if (lodKey && !lodKeyPressed) {
+        useLod = !useLod;
+        if (useLod) {
+            useStreaming = false;
+            useScene = false;
+        }
+        kernelsChanged = true;
+    }
+    lodKeyPressed = lodKey;
+
+    bool streamingKey = glfwGetKey(window, GLFW_KEY_U) == GLFW_PRESS;
+    if (streamingKey && !streamingKeyPressed) {
+        useStreaming = !useStreaming;
+        // streaming, the instanced scene and levels of detail each replace the BVH bindings,
+        // only one kernel path is compiled in
+        if (useStreaming) {
+            useScene = false;
+            useLod = false;
+        }
+        kernelsChanged = true;
+    }
+    streamingKeyPressed = streamingKey;
+
+    bool sceneKey = glfwGetKey(window, GLFW_KEY_J) == GLFW_PRESS;
+    if (sceneKey && !sceneKeyPressed) {
+        useScene = !useScene;
+        if (useScene) {
+            useStreaming = false;
+            useLod = false;
+        }
+        kernelsChanged = true;
+    }
+    sceneKeyPressed = sceneKey;
+
+    bool addInstanceKey = glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS;
+    if (addInstanceKey && !addInstanceKeyPressed)
+        addInstanceRequested = true;
+    addInstanceKeyPressed = addInstanceKey;
+
+    bool removeInstanceKey = glfwGetKey(window, GLFW_KEY_Y) == GLFW_PRESS;
+    if (removeInstanceKey && !removeInstanceKeyPressed)
+        removeInstanceRequested = true;
+    removeInstanceKeyPressed = removeInstanceKey;
+
+    bool captureKey = glfwGetKey(window, GLFW_KEY_C) == GLFW_PRESS;
+    if (captureKey && !captureKeyPressed)
+        captureRequested = true;
+    captureKeyPressed = captureKey;
+
+    bool pipeliningKey = glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS;
+    if (pipeliningKey && !pipeliningKeyPressed)
+        usePipelining = !usePipelining;
+    pipeliningKeyPressed = pipeliningKey;
+
+    bool statsKey = glfwGetKey(window, GLFW_KEY_TAB) == GLFW_PRESS;
+    if (statsKey && !statsKeyPressed)
+        printStats = !printStats;
+    statsKeyPressed = statsKey;
 }
@@ -7,6 +7,7 @@
 int main(int argc, char** argv) {
     Model model(SOURCE_DIR "/asset/furina/scene.gltf");
     const std::vector<primitive>& primitives = model.getPrimitives();
-    BVHNode* root = generateBVH(primitives);
+    BVHArena arena;
+    BVHNode* root = generateBVH(primitives, arena);
     return 0;
 }
\ No newline at end of file
@@ -3,26 +3,85 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 
 #include "model.h"
+#include "parallel.h"
+#include "simplify.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
+namespace {
+
+// accessor の i 番目の要素の先頭. byteStride が 0 なら詰めて並んでいる
+const unsigned char *accessorElement(const tinygltf::Model &model, const tinygltf::Accessor &accessor, size_t i) {
+    const tinygltf::BufferView &view = model.bufferViews[accessor.bufferView];
+    const unsigned char *data = model.buffers[view.buffer].data.data() + view.byteOffset + accessor.byteOffset;
+    return data + i * accessor.ByteStride(view);
+}
+
+// インデックスは 8/16/32 ビットのどれでもよい
+unsigned int readIndex(const tinygltf::Model &model, const tinygltf::Accessor &accessor, size_t i) {
+    const unsigned char *element = accessorElement(model, accessor, i);
+    switch (accessor.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE: return *element;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT: return *reinterpret_cast<const unsigned short*>(element);
+    default: return *reinterpret_cast<const unsigned int*>(element);
+    }
+}
+
+} // namespace
+
+// std::min が参照で受けるので定義が要る
+const int Model::MAX_TEXTURE_SIZE;
+const float Model::LOD_ERROR_PIXELS = 1.0f;
+
 Model::Model(const std::string &path) {
     loadModel(path);
 }
 
 void Model::Draw(Shader &shader) {
-    for (auto &mesh : meshes) {
-        if (mesh.textureID != 0) {
-            shader.setTexture("texture_diffuse", 0, mesh.textureID);
-        }
+    Draw(shader, commandBuffer, 0);
+}
 
-        glBindVertexArray(mesh.VAO);
-        if (!mesh.indices.empty()) {
-            glDrawElements(GL_TRIANGLES, mesh.indices.size(), GL_UNSIGNED_INT, 0);
-        } else {
-            glDrawArrays(GL_TRIANGLES, 0, mesh.vertices.size() / 5); // Assuming 5 floats per vertex (3 for position, 2 for texCoord)
-        }
-        glBindVertexArray(0);
+void Model::DrawVisibility(Shader &shader) {
+    DrawVisibility(shader, commandBuffer, 0);
+}
+
+void Model::Draw(Shader &shader, GLuint commandBuffer, GLuint countBuffer) {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, MATERIAL_BINDING, materialSSBO);
+    multiDraw(commandBuffer, countBuffer);
+}
+
+void Model::DrawVisibility(Shader &shader, GLuint commandBuffer, GLuint countBuffer) {
+    multiDraw(commandBuffer, countBuffer);
+}
+
+// countBuffer が 0 なら commandBuffer のコマンドを全部描く
+void Model::multiDraw(GLuint commandBuffer, GLuint countBuffer) {
+    GLsizei maxDraws = static_cast<GLsizei>(drawCommands.size());
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, DRAW_INFO_BINDING, drawInfoSSBO);
+    glBindVertexArray(VAO);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    if (countBuffer) {
+        glBindBuffer(GL_PARAMETER_BUFFER, countBuffer);
+        glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, 0, maxDraws, 0);
+        glBindBuffer(GL_PARAMETER_BUFFER, 0);
+    } else {
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, nullptr, maxDraws, 0);
     }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    glBindVertexArray(0);
+}
+
+void Model::cleanup() {
+    glDeleteVertexArrays(1, &VAO);
+    glDeleteBuffers(1, &VBO);
+    glDeleteBuffers(1, &EBO);
+    glDeleteBuffers(1, &commandBuffer);
+    glDeleteBuffers(1, &drawInfoSSBO);
+    glDeleteBuffers(1, &materialSSBO);
+    glDeleteTextures(1, &textureArray);
 }
 
 void Model::loadModel(const std::string &path) {
@@ -41,14 +100,26 @@ void Model::loadModel(const std::string &path) {
         throw std::runtime_error("Failed to load GLTF model");
     }
 
-    for (const auto &node : model.nodes) {
-        processNode(model, const_cast<tinygltf::Node &>(node));
+    // 子は processNode がたどるので, シーンの根のノードから始める (シーンがなければ全部のノード)
+    if (!model.scenes.empty()) {
+        const tinygltf::Scene &scene = model.scenes[model.defaultScene >= 0 ? model.defaultScene : 0];
+        for (int nodeIndex : scene.nodes) {
+            processNode(model, model.nodes[nodeIndex]);
+        }
+    } else {
+        for (auto &node : model.nodes) {
+            processNode(model, node);
+        }
     }
+
+    loadMaterials(model);
+    buildLods();
+    createBuffers();
 }
 
 void Model::processNode(tinygltf::Model &model, tinygltf::Node &node) {
     if (node.mesh >= 0) {
-        meshes.push_back(processMesh(model, model.meshes[node.mesh]));
+        processMesh(model, model.meshes[node.mesh]);
     }
 
     for (int childIndex : node.children) {
@@ -56,68 +127,176 @@ void Model::processNode(tinygltf::Model &model, tinygltf::Node &node) {
     }
 }
 
-Model::Mesh Model::processMesh(tinygltf::Model &model, tinygltf::Mesh &mesh) {
-    Mesh loadedMesh;
-
+void Model::processMesh(tinygltf::Model &model, tinygltf::Mesh &mesh) {
     for (auto &primitive : mesh.primitives) {
-        // Positions
-        const tinygltf::Accessor &posAccessor = model.accessors[primitive.attributes["POSITION"]];
-        const tinygltf::BufferView &posView = model.bufferViews[posAccessor.bufferView];
-        const tinygltf::Buffer &posBuffer = model.buffers[posView.buffer];
-
-        // Texture Coordinates
-        const tinygltf::Accessor &texAccessor = model.accessors[primitive.attributes["TEXCOORD_0"]];
-        const tinygltf::BufferView &texView = model.bufferViews[texAccessor.bufferView];
-        const tinygltf::Buffer &texBuffer = model.buffers[texView.buffer];
-
-        const float *positions = reinterpret_cast<const float*>(
-            posBuffer.data.data() + posView.byteOffset + posAccessor.byteOffset);
-        const float *texCoords = reinterpret_cast<const float*>(
-            texBuffer.data.data() + texView.byteOffset + texAccessor.byteOffset);
-
+        auto position = primitive.attributes.find("POSITION");
+        if (primitive.mode != TINYGLTF_MODE_TRIANGLES || position == primitive.attributes.end()) continue;
+        const tinygltf::Accessor &posAccessor = model.accessors[position->second];
+        auto texCoord = primitive.attributes.find("TEXCOORD_0");
+        const tinygltf::Accessor *texAccessor =
+            texCoord != primitive.attributes.end() ? &model.accessors[texCoord->second] : nullptr;
+
+        // インデックスは VBO 全体での番号にする. プリミティブの頂点はその前のプリミティブの後ろに並ぶ
+        unsigned int baseVertex = static_cast<unsigned int>(vertices.size() / 5);
         for (size_t i = 0; i < posAccessor.count; ++i) {
-            loadedMesh.vertices.push_back(positions[i * 3]);
-            loadedMesh.vertices.push_back(positions[i * 3 + 1]);
-            loadedMesh.vertices.push_back(positions[i * 3 + 2]);
-
-            loadedMesh.vertices.push_back(texCoords[i * 2]);
-            loadedMesh.vertices.push_back(texCoords[i * 2 + 1]);
+            const float *p = reinterpret_cast<const float*>(accessorElement(model, posAccessor, i));
+            vertices.insert(vertices.end(), p, p + 3);
+            if (texAccessor) {
+                const float *uv = reinterpret_cast<const float*>(accessorElement(model, *texAccessor, i));
+                vertices.insert(vertices.end(), uv, uv + 2);
+            } else {
+                vertices.push_back(0.0f);
+                vertices.push_back(0.0f);
+            }
         }
 
-        // Indices
+        DrawCommand command;
+        command.firstIndex = static_cast<GLuint>(indices.size());
+        command.instanceCount = 1;
+        command.baseVertex = 0;
+        command.baseInstance = static_cast<GLuint>(drawCommands.size() * MAX_LOD_LEVELS);
         if (primitive.indices >= 0) {
             const tinygltf::Accessor &idxAccessor = model.accessors[primitive.indices];
-            const tinygltf::BufferView &idxView = model.bufferViews[idxAccessor.bufferView];
-            const tinygltf::Buffer &idxBuffer = model.buffers[idxView.buffer];
+            for (size_t i = 0; i < idxAccessor.count; ++i) {
+                indices.push_back(baseVertex + readIndex(model, idxAccessor, i));
+            }
+        } else {
+            for (size_t i = 0; i < posAccessor.count; ++i) {
+                indices.push_back(baseVertex + static_cast<unsigned int>(i));
+            }
+        }
+        // 端数の頂点は三角形にならない
+        indices.resize(command.firstIndex + (indices.size() - command.firstIndex) / 3 * 3);
+        command.count = static_cast<GLuint>(indices.size()) - command.firstIndex;
+        if (command.count == 0) continue;
+
+        drawCommands.push_back(command);
+        // 段 0 の分. 残りの段は buildLods が足す
+        DrawInfo info;
+        // マテリアルのないプリミティブは materials の最後 (loadMaterials が足す) を使う
+        info.material = primitive.material >= 0 ? primitive.material : static_cast<GLint>(model.materials.size());
+        info.firstTriangle = static_cast<GLint>(command.firstIndex / 3);
+        drawInfos.push_back(info);
+
+        DrawBounds bounds = {glm::vec4(vertices[baseVertex * 5], vertices[baseVertex * 5 + 1], vertices[baseVertex * 5 + 2], 1.0f),
+                             glm::vec4(0.0f)};
+        bounds.max = bounds.min;
+        for (size_t v = baseVertex; v < vertices.size() / 5; ++v) {
+            glm::vec4 p(vertices[v * 5], vertices[v * 5 + 1], vertices[v * 5 + 2], 1.0f);
+            bounds.min = glm::min(bounds.min, p);
+            bounds.max = glm::max(bounds.max, p);
+        }
+        drawBounds.push_back(bounds);
+        addEmissiveTriangles(model, primitive, command.firstIndex);
+    }
+}
 
-            const unsigned int *indices = reinterpret_cast<const unsigned int*>(
-                idxBuffer.data.data() + idxView.byteOffset + idxAccessor.byteOffset);
+void Model::addEmissiveTriangles(tinygltf::Model &model, const tinygltf::Primitive &primitive, size_t firstIndex) {
+    if (primitive.material < 0) return;
+    const tinygltf::Material &mat = model.materials[primitive.material];
+    if (mat.emissiveFactor.size() < 3) return;
 
-            loadedMesh.indices.insert(loadedMesh.indices.end(), indices, indices + idxAccessor.count);
-        }
+    glm::vec3 emission(mat.emissiveFactor[0], mat.emissiveFactor[1], mat.emissiveFactor[2]);
+    auto strength = mat.extensions.find("KHR_materials_emissive_strength");
+    if (strength != mat.extensions.end() && strength->second.Has("emissiveStrength")) {
+        emission *= static_cast<float>(strength->second.Get("emissiveStrength").GetNumberAsDouble());
+    }
+    if (emission.x <= 0.0f && emission.y <= 0.0f && emission.z <= 0.0f) return;
+
+    for (size_t i = firstIndex; i + 2 < indices.size(); i += 3) {
+        EmissiveTriangle light;
+        light.triangle.v0 = glm::vec3(vertices[indices[i] * 5], vertices[indices[i] * 5 + 1], vertices[indices[i] * 5 + 2]);
+        light.triangle.v1 = glm::vec3(vertices[indices[i + 1] * 5], vertices[indices[i + 1] * 5 + 1], vertices[indices[i + 1] * 5 + 2]);
+        light.triangle.v2 = glm::vec3(vertices[indices[i + 2] * 5], vertices[indices[i + 2] * 5 + 1], vertices[indices[i + 2] * 5 + 2]);
+        light.emission = emission;
+        emissiveTriangles.push_back(light);
+    }
+}
 
-        // Texture
-        if (primitive.material >= 0) {
-            const tinygltf::Material &mat = model.materials[primitive.material];
-            if (mat.pbrMetallicRoughness.baseColorTexture.index >= 0) {
-                loadedMesh.textureID = loadTexture(model, mat.pbrMetallicRoughness.baseColorTexture.index);
-            }
+void Model::loadMaterials(tinygltf::Model &model) {
+    // baseColorTexture が指す画像を 1 つずつ層にする. 層の大きさは一番大きい画像 (MAX_TEXTURE_SIZE まで)
+    std::vector<int> layerOfTexture(model.textures.size(), -1);
+    std::vector<int> layerImages;
+    int layerWidth = 1;
+    int layerHeight = 1;
+    for (const auto &mat : model.materials) {
+        int texIndex = mat.pbrMetallicRoughness.baseColorTexture.index;
+        if (texIndex < 0 || layerOfTexture[texIndex] >= 0) continue;
+        int source = model.textures[texIndex].source;
+        if (source < 0) continue;
+        const tinygltf::Image &image = model.images[source];
+        if (image.component != 4 || image.image.empty()) {
+            std::cerr << "Model: skipping texture " << texIndex << " (" << image.component << " components)" << std::endl;
+            continue;
         }
+        layerOfTexture[texIndex] = static_cast<int>(layerImages.size());
+        layerImages.push_back(source);
+        layerWidth = std::max(layerWidth, std::min(image.width, MAX_TEXTURE_SIZE));
+        layerHeight = std::max(layerHeight, std::min(image.height, MAX_TEXTURE_SIZE));
     }
 
-    glGenVertexArrays(1, &loadedMesh.VAO);
-    glGenBuffers(1, &loadedMesh.VBO);
-    if (!loadedMesh.indices.empty()) glGenBuffers(1, &loadedMesh.EBO);
+    for (const auto &mat : model.materials) {
+        Material material;
+        const std::vector<double> &factor = mat.pbrMetallicRoughness.baseColorFactor;
+        material.baseColorFactor = factor.size() >= 4 ? glm::vec4(factor[0], factor[1], factor[2], factor[3]) : glm::vec4(1.0f);
+        int texIndex = mat.pbrMetallicRoughness.baseColorTexture.index;
+        material.textureLayer = texIndex >= 0 ? layerOfTexture[texIndex] : -1;
+        material.padding[0] = material.padding[1] = material.padding[2] = 0;
+        materials.push_back(material);
+    }
+    Material untextured = {glm::vec4(1.0f), -1, {0, 0, 0}};
+    materials.push_back(untextured);
+
+    int levels = 1;
+    while ((std::max(layerWidth, layerHeight) >> levels) > 0) ++levels;
+    glGenTextures(1, &textureArray);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+    glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, layerWidth, layerHeight,
+                   std::max(static_cast<int>(layerImages.size()), 1));
+
+    // 画像をそのまま 2D テクスチャに上げ, 層の大きさに引き伸ばして写す
+    GLuint framebuffers[2];
+    glGenFramebuffers(2, framebuffers);
+    for (size_t layer = 0; layer < layerImages.size(); ++layer) {
+        const tinygltf::Image &image = model.images[layerImages[layer]];
+        GLuint source;
+        glGenTextures(1, &source);
+        glBindTexture(GL_TEXTURE_2D, source);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, image.width, image.height, 0, GL_RGBA,
+                     image.bits == 16 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, image.image.data());
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffers[0]);
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, source, 0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[1]);
+        glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, textureArray, 0, static_cast<GLint>(layer));
+        glBlitFramebuffer(0, 0, image.width, image.height, 0, 0, layerWidth, layerHeight, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+        glDeleteTextures(1, &source);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(2, framebuffers);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glBindTexture(GL_TEXTURE_2D_ARRAY, textureArray);
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
 
-    glBindVertexArray(loadedMesh.VAO);
+void Model::createBuffers() {
+    glGenVertexArrays(1, &VAO);
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
 
-    glBindBuffer(GL_ARRAY_BUFFER, loadedMesh.VBO);
-    glBufferData(GL_ARRAY_BUFFER, loadedMesh.vertices.size() * sizeof(float), &loadedMesh.vertices[0], GL_STATIC_DRAW);
+    glBindVertexArray(VAO);
 
-    if (!loadedMesh.indices.empty()) {
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, loadedMesh.EBO);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, loadedMesh.indices.size() * sizeof(unsigned int), &loadedMesh.indices[0], GL_STATIC_DRAW);
-    }
+    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
 
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
@@ -125,58 +304,137 @@ Model::Mesh Model::processMesh(tinygltf::Model &model, tinygltf::Mesh &mesh) {
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
     glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-    return loadedMesh;
+    glGenBuffers(1, &commandBuffer);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+    glBufferData(GL_DRAW_INDIRECT_BUFFER, drawCommands.size() * sizeof(DrawCommand), drawCommands.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+    // SSBO は Draw のたびに結び付けるので, ここで binding を取らない
+    glGenBuffers(1, &drawInfoSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawInfoSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, drawInfos.size() * sizeof(DrawInfo), drawInfos.data(), GL_STATIC_DRAW);
+    glGenBuffers(1, &materialSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, materialSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, materials.size() * sizeof(Material), materials.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
 }
 
-GLuint Model::loadTexture(tinygltf::Model &model, int texIndex) {
-    if (texIndex < 0) return 0;
+void Model::buildLods() {
+    // プリミティブごとに段を並列に作る. 頂点はプリミティブの中の番号にして渡す
+    std::vector<std::vector<SimplifiedMesh>> simplified(drawCommands.size());
+    parallelFor(0, static_cast<int>(drawCommands.size()), [&](int draw) {
+        const DrawCommand &command = drawCommands[draw];
+        size_t triangles = command.count / 3;
+        if (triangles < static_cast<size_t>(MIN_LOD_TRIANGLES)) return;
+
+        auto range = std::minmax_element(indices.begin() + command.firstIndex,
+                                         indices.begin() + command.firstIndex + command.count);
+        unsigned int firstVertex = *range.first;
+        std::vector<glm::vec3> positions(*range.second - firstVertex + 1);
+        for (size_t v = 0; v < positions.size(); ++v) {
+            const float *p = &vertices[(firstVertex + v) * 5];
+            positions[v] = glm::vec3(p[0], p[1], p[2]);
+        }
+        std::vector<unsigned int> local(indices.begin() + command.firstIndex,
+                                        indices.begin() + command.firstIndex + command.count);
+        for (unsigned int &index : local) index -= firstVertex;
+
+        std::vector<size_t> targets;
+        for (int level = 1; level < MAX_LOD_LEVELS; ++level) targets.push_back(triangles >> (2 * level));
+        simplified[draw] = simplifyMesh(positions, local, targets);
+        for (SimplifiedMesh &mesh : simplified[draw]) {
+            for (unsigned int &index : mesh.indices) index += firstVertex;
+        }
+    }, 1);
+
+    // 段のインデックスを EBO の後ろに足し, DrawInfo を段ごとに並べ直す
+    std::vector<DrawInfo> baseInfos;
+    baseInfos.swap(drawInfos);
+    size_t lodTriangles = 0;
+    for (size_t draw = 0; draw < drawCommands.size(); ++draw) {
+        DrawLod lod = {drawCommands[draw].firstIndex, drawCommands[draw].count, 0.0f, 0.0f};
+        for (int level = 0; level < MAX_LOD_LEVELS; ++level) {
+            if (level > 0 && static_cast<size_t>(level) <= simplified[draw].size()) {
+                const SimplifiedMesh &mesh = simplified[draw][level - 1];
+                lod.firstIndex = static_cast<GLuint>(indices.size());
+                lod.count = static_cast<GLuint>(mesh.indices.size());
+                lod.error = mesh.error;
+                indices.insert(indices.end(), mesh.indices.begin(), mesh.indices.end());
+                lodTriangles += mesh.indices.size() / 3;
+            }
+            drawLods.push_back(lod);
+            DrawInfo info = baseInfos[draw];
+            info.firstTriangle = static_cast<GLint>(lod.firstIndex / 3);
+            drawInfos.push_back(info);
+        }
+    }
+    std::cout << "Model: " << drawCommands.size() << " draws, " << lodTriangles << " triangles in "
+              << MAX_LOD_LEVELS - 1 << " simplified levels" << std::endl;
+}
 
-    GLuint textureID;
-    glGenTextures(1, &textureID);
+float Model::lodScale(float verticalFov, int renderHeight) {
+    return static_cast<float>(renderHeight) / (2.0f * std::tan(glm::radians(verticalFov) * 0.5f)) / LOD_ERROR_PIXELS;
+}
 
-    const tinygltf::Texture &tex = model.textures[texIndex];
-    const tinygltf::Image &image = model.images[tex.source];
+std::vector<int> Model::selectLods(const glm::vec3& eye, float lodScale) const {
+    std::vector<int> levels(drawCommands.size(), 0);
+    if (lodScale <= 0.0f) return levels;
+    for (size_t draw = 0; draw < drawCommands.size(); ++draw) {
+        // バウンディングボックスの一番近い点までの距離. 中にいれば段 0
+        glm::vec3 lo(drawBounds[draw].min);
+        glm::vec3 hi(drawBounds[draw].max);
+        float distance = glm::length(glm::max(glm::max(lo - eye, eye - hi), glm::vec3(0.0f)));
+        for (int level = MAX_LOD_LEVELS - 1; level > 0; --level) {
+            if (drawLods[draw * MAX_LOD_LEVELS + level].error * lodScale <= distance) {
+                levels[draw] = level;
+                break;
+            }
+        }
+    }
+    return levels;
+}
 
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, &image.image[0]);
-    glGenerateMipmap(GL_TEXTURE_2D);
+void Model::appendTriangles(const DrawLod& lod, std::vector<Triangle>& triangles) const {
+    for (GLuint i = lod.firstIndex; i + 2 < lod.firstIndex + lod.count; i += 3) {
+        triangles.push_back({
+            glm::vec3(vertices[indices[i] * 5], vertices[indices[i] * 5 + 1], vertices[indices[i] * 5 + 2]),
+            glm::vec3(vertices[indices[i+1] * 5], vertices[indices[i+1] * 5 + 1], vertices[indices[i+1] * 5 + 2]),
+            glm::vec3(vertices[indices[i+2] * 5], vertices[indices[i+2] * 5 + 1], vertices[indices[i+2] * 5 + 2])
+        });
+    }
+}
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+std::vector<Triangle> Model::getTriangles(const std::vector<int>& lodLevels) const {
+    std::vector<Triangle> triangles;
+    for (size_t draw = 0; draw < drawCommands.size(); ++draw) {
+        appendTriangles(drawLods[draw * MAX_LOD_LEVELS + lodLevels[draw]], triangles);
+    }
+    return triangles;
+}
 
-    return textureID;
+void Model::getTriangles(size_t draw, int level, std::vector<Triangle>& triangles) const {
+    triangles.clear();
+    appendTriangles(drawLods[draw * MAX_LOD_LEVELS + level], triangles);
 }
 
 std::vector<Triangle> Model::getTriangles() const {
-    std::vector<Triangle> triangles;
+    return getTriangles(std::vector<int>(drawCommands.size(), 0));
+}
 
-    for (const auto& mesh : meshes) {
-        const auto& vertices = mesh.vertices;
-        const auto& indices = mesh.indices;
-
-        if (!indices.empty()) {
-            for (size_t i = 0; i < indices.size(); i += 3) {
-                triangles.push_back({ 
-                    glm::vec3(vertices[indices[i] * 5], vertices[indices[i] * 5 + 1], vertices[indices[i] * 5 + 2]),
-                    glm::vec3(vertices[indices[i+1] * 5], vertices[indices[i+1] * 5 + 1], vertices[indices[i+1] * 5 + 2]),
-                    glm::vec3(vertices[indices[i+2] * 5], vertices[indices[i+2] * 5 + 1], vertices[indices[i+2] * 5 + 2])
-                });
-            }
-        } else {
-            for (size_t i = 0; i < vertices.size() / 5; i += 3) {
-                triangles.push_back({ 
-                    glm::vec3(vertices[i * 5], vertices[i * 5 + 1], vertices[i * 5 + 2]),
-                    glm::vec3(vertices[(i+1) * 5], vertices[(i+1) * 5 + 1], vertices[(i+1) * 5 + 2]),
-                    glm::vec3(vertices[(i+2) * 5], vertices[(i+2) * 5 + 1], vertices[(i+2) * 5 + 2])
-                });
-            }
-        }
+std::vector<Triangle> Model::getIndexBufferTriangles() const {
+    std::vector<Triangle> triangles;
+    triangles.reserve(indices.size() / 3);
+
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+        triangles.push_back({
+            glm::vec3(vertices[indices[i] * 5], vertices[indices[i] * 5 + 1], vertices[indices[i] * 5 + 2]),
+            glm::vec3(vertices[indices[i+1] * 5], vertices[indices[i+1] * 5 + 1], vertices[indices[i+1] * 5 + 2]),
+            glm::vec3(vertices[indices[i+2] * 5], vertices[indices[i+2] * 5 + 1], vertices[indices[i+2] * 5 + 2])
+        });
     }
 
     return triangles;
-}
\ No newline at end of file
+}
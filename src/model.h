@@ -11,23 +11,121 @@ struct Triangle {
     glm::vec3 v0, v1, v2;
 };
 
+// emissiveFactor (と KHR_materials_emissive_strength) が 0 でないマテリアルの三角形. LightBVH の光源になる
+struct EmissiveTriangle {
+    Triangle triangle;
+    glm::vec3 emission;
+};
+
+// コマンドごとの頂点の範囲 (DrawCuller の入力). std430 で vec3 の配列を避けて vec4 にする
+struct DrawBounds {
+    glm::vec4 min;
+    glm::vec4 max;
+};
+
+// コマンドの詳細度の段ごとのインデックスの範囲 (std430). 段 0 は元のメッシュ
+struct DrawLod {
+    GLuint firstIndex;
+    GLuint count;
+    float error;            // 元の面からの距離の見積もり. 投影した大きさで段を選ぶ
+    float padding;
+};
+
+// GL の DrawElementsIndirectCommand と同じ並び. baseInstance は DrawInfo の番号
+// (コマンドの元の番号 * MAX_LOD_LEVELS + 段. DrawCuller が詰めても変わらない)
+struct DrawCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// 全部のプリミティブを 1 つの VBO/EBO にまとめ, glMultiDrawElementsIndirect の 1 回で描く.
+// テクスチャは 1 つの 2D 配列テクスチャの層にし, コマンドごとのマテリアルは SSBO から gl_BaseInstance で読む.
+// 読み込み時にプリミティブごとに並列に簡略化した詳細度の段 (simplify.h) を作り, 同じ頂点を指すインデックスを
+// EBO の後ろに足す. 段は selectLods が投影した大きさで選び, BVH と DrawCuller の両方に使う
 class Model {
 public:
+    // Draw が使う SSBO の binding (vertex_shader.glsl, fragment_shader.glsl, visibility_vertex.glsl)
+    static const GLuint DRAW_INFO_BINDING = 12;
+    static const GLuint MATERIAL_BINDING = 13;
+    // テクスチャの層の大きさの上限. 大きいテクスチャは縮めてから層にする
+    static const int MAX_TEXTURE_SIZE = 2048;
+    // 詳細度の段数 (元のメッシュを含む). 段ごとに三角形を 1/4 にする
+    static const int MAX_LOD_LEVELS = 4;
+    // これより三角形の少ないプリミティブは簡略化しない
+    static const int MIN_LOD_TRIANGLES = 64;
+    // 段の誤差を画面に投影してこの画素数以下なら使う
+    static const float LOD_ERROR_PIXELS;
+
     Model(const std::string &path);
+    // マテリアルのテクスチャを texture unit 0 (sampler2DArray) に結び付けて描く
     void Draw(Shader &shader);
+    // テクスチャなしで描く. DrawInfo の firstTriangle と gl_PrimitiveID から getIndexBufferTriangles() の番号が分かる
+    void DrawVisibility(Shader &shader);
+    // DrawCuller が commandBuffer に詰めたコマンドを countBuffer の数だけ描く
+    void Draw(Shader &shader, GLuint commandBuffer, GLuint countBuffer);
+    void DrawVisibility(Shader &shader, GLuint commandBuffer, GLuint countBuffer);
+    void cleanup();
 
+    // 元のメッシュ (段 0) の三角形
     std::vector<Triangle> getTriangles() const;
+    // コマンドごとに lodLevels の段の三角形を並べる
+    std::vector<Triangle> getTriangles(const std::vector<int>& lodLevels) const;
+    // コマンド draw の段 level の三角形だけを triangles に入れる (中身は置き換える)
+    void getTriangles(size_t draw, int level, std::vector<Triangle>& triangles) const;
+    // EBO のすべての三角形 (詳細度の段を含む). VisibilityBuffer の三角形の番号はこの順で, 段 0 が先頭に並ぶ
+    std::vector<Triangle> getIndexBufferTriangles() const;
+    // 高さ renderHeight, 縦の画角 verticalFov (度) で見たときの画面上の画素数 / 距離.
+    // 0 ならいつも段 0 を使う
+    static float lodScale(float verticalFov, int renderHeight);
+    // eye から見たときのコマンドごとの段. 誤差の投影が LOD_ERROR_PIXELS 以下になる一番粗い段
+    std::vector<int> selectLods(const glm::vec3& eye, float lodScale) const;
+    const std::vector<EmissiveTriangle>& getEmissiveTriangles() const { return emissiveTriangles; }
+    size_t getDrawCount() const { return drawCommands.size(); }
+    const std::vector<DrawBounds>& getDrawBounds() const { return drawBounds; }
+    // コマンドごとに MAX_LOD_LEVELS 個. 作れなかった段は一つ前の段と同じ
+    const std::vector<DrawLod>& getDrawLods() const { return drawLods; }
+    // すべてのコマンド. DrawCuller は SSBO として読む
+    GLuint getCommandBuffer() const { return commandBuffer; }
 
 private:
-    struct Mesh {
-        GLuint VAO, VBO, EBO, textureID;
-        std::vector<float> vertices;
-        std::vector<unsigned int> indices;
+    // vertex_shader.glsl と visibility_vertex.glsl の DrawInfo (std430)
+    struct DrawInfo {
+        GLint material;         // materials の番号
+        GLint firstTriangle;    // getIndexBufferTriangles() での段の最初の三角形
+    };
+
+    // fragment_shader.glsl の Material (std430)
+    struct Material {
+        glm::vec4 baseColorFactor;
+        GLint textureLayer;     // 負ならテクスチャなし
+        GLint padding[3];
     };
 
-    std::vector<Mesh> meshes;
+    std::vector<float> vertices;            // 位置 3 + テクスチャ座標 2
+    std::vector<unsigned int> indices;      // 全体での頂点番号. baseVertex はいつも 0
+    std::vector<DrawCommand> drawCommands;  // glTF のプリミティブごと
+    std::vector<DrawInfo> drawInfos;        // コマンドと段ごと (DrawCommand::baseInstance の順)
+    std::vector<DrawBounds> drawBounds;     // コマンドごと
+    std::vector<DrawLod> drawLods;          // コマンドと段ごと
+    std::vector<Material> materials;        // glTF のマテリアルの順. 最後はマテリアルのないプリミティブ用
+    std::vector<EmissiveTriangle> emissiveTriangles;
+
+    GLuint VAO, VBO, EBO;
+    GLuint commandBuffer;
+    GLuint drawInfoSSBO;
+    GLuint materialSSBO;
+    GLuint textureArray;
+
     void loadModel(const std::string &path);
     void processNode(tinygltf::Model &model, tinygltf::Node &node);
-    Mesh processMesh(tinygltf::Model &model, tinygltf::Mesh &mesh);
-    GLuint loadTexture(tinygltf::Model &model, int texIndex);
+    void processMesh(tinygltf::Model &model, tinygltf::Mesh &mesh);
+    void addEmissiveTriangles(tinygltf::Model &model, const tinygltf::Primitive &primitive, size_t firstIndex);
+    void loadMaterials(tinygltf::Model &model);
+    void buildLods();
+    void appendTriangles(const DrawLod& lod, std::vector<Triangle>& triangles) const;
+    void createBuffers();
+    void multiDraw(GLuint commandBuffer, GLuint countBuffer);
 };
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// [begin, end) をスレッド数で均等に分割して fn(i) を実行する
+template <typename Fn>
+void parallelFor(int begin, int end, Fn fn, int minChunk = 1024) {
+    int count = end - begin;
+    if (count <= 0) return;
+
+    int numThreads = static_cast<int>(std::thread::hardware_concurrency());
+    numThreads = std::max(1, std::min(numThreads, (count + minChunk - 1) / minChunk));
+    if (numThreads == 1) {
+        for (int i = begin; i < end; ++i) fn(i);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads);
+    int chunk = (count + numThreads - 1) / numThreads;
+    for (int t = 0; t < numThreads; ++t) {
+        int chunkBegin = begin + t * chunk;
+        int chunkEnd = std::min(end, chunkBegin + chunk);
+        if (chunkBegin >= chunkEnd) break;
+        threads.emplace_back([=]() {
+            for (int i = chunkBegin; i < chunkEnd; ++i) fn(i);
+        });
+    }
+    for (auto& thread : threads) thread.join();
+}
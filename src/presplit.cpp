@@ -0,0 +1,165 @@
+#include "presplit.h"
+#include "parallel.h"
+#include <algorithm>
+#include <limits>
+
+namespace {
+
+float surfaceArea(const glm::vec3& min, const glm::vec3& max) {
+    glm::vec3 extent = glm::max(max - min, glm::vec3(0.0f));
+    return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+}
+
+void grow(glm::vec3& min, glm::vec3& max, const glm::vec3& p) {
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+}
+
+// 三角形を平面 (axis = pos) で切ったときの左右のバウンディングボックスを求める
+void splitTriangle(const glm::vec3 v[3], int axis, float pos,
+                   glm::vec3& leftMin, glm::vec3& leftMax, glm::vec3& rightMin, glm::vec3& rightMax) {
+    leftMin = rightMin = glm::vec3(std::numeric_limits<float>::max());
+    leftMax = rightMax = glm::vec3(std::numeric_limits<float>::lowest());
+
+    for (int i = 0; i < 3; ++i) {
+        const glm::vec3& a = v[i];
+        const glm::vec3& b = v[(i + 1) % 3];
+        if (a[axis] <= pos) grow(leftMin, leftMax, a);
+        if (a[axis] >= pos) grow(rightMin, rightMax, a);
+
+        // 辺が平面をまたぐ場合は交点を両側に含める
+        if ((a[axis] < pos && b[axis] > pos) || (a[axis] > pos && b[axis] < pos)) {
+            float t = (pos - a[axis]) / (b[axis] - a[axis]);
+            glm::vec3 p = a + (b - a) * t;
+            p[axis] = pos;
+            grow(leftMin, leftMax, p);
+            grow(rightMin, rightMax, p);
+        }
+    }
+}
+
+bool isEmpty(const PrimRef& ref) {
+    return ref.min.x > ref.max.x || ref.min.y > ref.max.y || ref.min.z > ref.max.z;
+}
+
+// 最長軸の中点で再帰的に分割し, 面積に比例して pieces を左右に配分する
+void splitRef(const glm::vec3 v[3], const PrimRef& ref, int pieces, PrimRef* out, int& count) {
+    glm::vec3 extent = ref.max - ref.min;
+    int axis = 0;
+    if (extent.y > extent.x && extent.y > extent.z) {
+        axis = 1;
+    } else if (extent.z > extent.x) {
+        axis = 2;
+    }
+
+    if (pieces <= 1 || extent[axis] <= 0.0f) {
+        out[count++] = ref;
+        return;
+    }
+
+    float pos = (ref.min[axis] + ref.max[axis]) * 0.5f;
+    glm::vec3 leftMin, leftMax, rightMin, rightMax;
+    splitTriangle(v, axis, pos, leftMin, leftMax, rightMin, rightMax);
+
+    PrimRef left = ref;
+    left.min = glm::max(leftMin, ref.min);
+    left.max = glm::min(leftMax, ref.max);
+    PrimRef right = ref;
+    right.min = glm::max(rightMin, ref.min);
+    right.max = glm::min(rightMax, ref.max);
+
+    if (isEmpty(left) || isEmpty(right)) {
+        out[count++] = ref;
+        return;
+    }
+
+    float leftArea = surfaceArea(left.min, left.max);
+    float rightArea = surfaceArea(right.min, right.max);
+    float ratio = leftArea + rightArea > 0.0f ? leftArea / (leftArea + rightArea) : 0.5f;
+    int leftPieces = std::max(1, std::min(pieces - 1, static_cast<int>(pieces * ratio + 0.5f)));
+
+    splitRef(v, left, leftPieces, out, count);
+    splitRef(v, right, pieces - leftPieces, out, count);
+}
+
+struct Scratch {
+    std::vector<PrimRef> bounds;
+    std::vector<float> areas;
+    std::vector<int> pieces;
+    std::vector<int> offsets;
+    std::vector<PrimRef> slots;
+    std::vector<int> counts;
+};
+
+Scratch& threadScratch() {
+    static thread_local Scratch scratch;
+    return scratch;
+}
+
+} // namespace
+
+void presplit(const std::vector<Data>& dataArray, std::vector<PrimRef>& refs, const PresplitOptions& options) {
+    int numData = static_cast<int>(dataArray.size());
+    refs.clear();
+    if (numData == 0) return;
+
+    // 各三角形のバウンディングボックスと表面積
+    Scratch& scratch = threadScratch();
+    std::vector<PrimRef>& bounds = scratch.bounds;
+    std::vector<float>& areas = scratch.areas;
+    bounds.resize(numData);
+    areas.resize(numData);
+    parallelFor(0, numData, [&](int i) {
+        bounds[i] = makePrimRef(dataArray[i], i);
+        areas[i] = surfaceArea(bounds[i].min, bounds[i].max);
+    });
+
+    double totalArea = 0.0;
+    for (float area : areas) totalArea += area;
+    float threshold = static_cast<float>(totalArea / numData) * options.areaThreshold;
+
+    // 分割数を決める. 予算を超える場合は全体を縮小する
+    std::vector<int>& pieces = scratch.pieces;
+    pieces.assign(numData, 1);
+    long long extra = 0;
+    if (threshold > 0.0f) {
+        for (int i = 0; i < numData; ++i) {
+            if (areas[i] > threshold) {
+                pieces[i] = std::min(options.maxSplitsPerTriangle, static_cast<int>(areas[i] / threshold));
+                pieces[i] = std::max(1, pieces[i]);
+                extra += pieces[i] - 1;
+            }
+        }
+    }
+
+    long long maxExtra = static_cast<long long>(options.budget * numData);
+    if (extra > maxExtra) {
+        double scale = static_cast<double>(maxExtra) / static_cast<double>(extra);
+        for (int i = 0; i < numData; ++i) {
+            pieces[i] = 1 + static_cast<int>((pieces[i] - 1) * scale);
+        }
+    }
+
+    std::vector<int>& offsets = scratch.offsets;
+    offsets.assign(numData + 1, 0);
+    for (int i = 0; i < numData; ++i) {
+        offsets[i + 1] = offsets[i] + pieces[i];
+    }
+
+    // 三角形ごとに独立なので並列に分割する
+    std::vector<PrimRef>& slots = scratch.slots;
+    std::vector<int>& counts = scratch.counts;
+    slots.resize(offsets[numData]);
+    counts.assign(numData, 0);
+    parallelFor(0, numData, [&](int i) {
+        const Data& data = dataArray[i];
+        glm::vec3 v[3] = {glm::vec3(data.v0), glm::vec3(data.v1), glm::vec3(data.v2)};
+        splitRef(v, bounds[i], pieces[i], &slots[offsets[i]], counts[i]);
+    });
+
+    // 分割できなかった分を詰める
+    refs.reserve(offsets[numData]);
+    for (int i = 0; i < numData; ++i) {
+        refs.insert(refs.end(), slots.begin() + offsets[i], slots.begin() + offsets[i] + counts[i]);
+    }
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <vector>
+#include "bvh.h"
+
+// BVH 構築前に大きな三角形のバウンディングボックスを分割する (ジオメトリは分割しない)
+struct PresplitOptions {
+    float areaThreshold;        // 平均表面積の何倍を超えたら分割するか
+    float budget;               // 追加できる参照数 (三角形数に対する割合)
+    int maxSplitsPerTriangle;   // 一つの三角形から作る参照の上限
+
+    PresplitOptions() : areaThreshold(4.0f), budget(0.3f), maxSplitsPerTriangle(16) {}
+};
+
+// 参照を refs に書く. refs と作業用の配列 (スレッドごと) は容量を使い回すので, BVH と並べて持っておけば
+// 同じくらいの大きさで作り直すときにヒープを確保しない
+void presplit(const std::vector<Data>& dataArray, std::vector<PrimRef>& refs,
+              const PresplitOptions& options = PresplitOptions());
@@ -0,0 +1,282 @@
+#include "profiler.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "json.hpp"
+
+void Profiler::RollingStat::add(float value) {
+    samples[next] = value;
+    next = (next + 1) % HISTORY;
+    count = std::min(count + 1, HISTORY);
+}
+
+float Profiler::RollingStat::mean() const {
+    if (count == 0) return 0.0f;
+    float sum = 0.0f;
+    for (int i = 0; i < count; ++i) sum += samples[i];
+    return sum / count;
+}
+
+float Profiler::RollingStat::max() const {
+    if (count == 0) return 0.0f;
+    return *std::max_element(samples.begin(), samples.begin() + count);
+}
+
+float Profiler::RollingStat::last() const {
+    if (count == 0) return 0.0f;
+    return samples[(next + HISTORY - 1) % HISTORY];
+}
+
+Profiler::Profiler()
+    : origin(std::chrono::steady_clock::now()), frameIndex(0), frameStartUs(0.0), currentPhase(-1),
+      phaseStartUs(0.0), droppedQueries(0), latestGpuFrameMs(0.0f), latestGpuFrameFresh(false),
+      overlay(SOURCE_DIR "/src/shader/simple_vertex.glsl", SOURCE_DIR "/src/shader/profiler_overlay.glsl") {
+    glGenQueries(FRAME_LATENCY * MAX_PHASES, &queries[0][0]);
+    for (FrameSlot& slot : slots) {
+        slot.frame = -1;
+        std::fill(slot.issued, slot.issued + MAX_PHASES, false);
+        slot.gpuStartUs = -1.0;
+    }
+
+    const Shader& shader = overlay.getShader();
+    numPhasesLocation = shader.getUniformLocation("numPhases");
+    frameMsLocation = shader.getUniformLocation("frameMs");
+    scaleMsLocation = shader.getUniformLocation("scaleMs");
+    gpuMsLocation = shader.getUniformLocation("gpuMs");
+    cpuMsLocation = shader.getUniformLocation("cpuMs");
+
+    // 配列の長さがずれていると後ろのフェーズが描かれないか, 範囲外に書く
+    GLuint gpuMsIndex = glGetProgramResourceIndex(shader.ID, GL_UNIFORM, "gpuMs[0]");
+    GLint arraySize = 0;
+    if (gpuMsIndex != GL_INVALID_INDEX) {
+        GLenum property = GL_ARRAY_SIZE;
+        glGetProgramResourceiv(shader.ID, GL_UNIFORM, gpuMsIndex, 1, &property, 1, nullptr, &arraySize);
+    }
+    if (arraySize != MAX_PHASES) {
+        std::cerr << "Profiler: profiler_overlay.glsl has " << arraySize << " phases, expected " << MAX_PHASES
+                  << std::endl;
+    }
+}
+
+double Profiler::nowUs() const {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+}
+
+int Profiler::findPhase(const char* name, bool gpu) {
+    for (size_t i = 0; i < phases.size(); ++i) {
+        if (phases[i].name == name) return static_cast<int>(i);
+    }
+    if (phases.size() >= MAX_PHASES) {
+        if (ignoredPhases.insert(name).second) {
+            std::cerr << "Profiler: too many phases (" << MAX_PHASES << "), ignoring " << name << std::endl;
+        }
+        return -1;
+    }
+    Phase phase;
+    phase.name = name;
+    phase.gpu = gpu;
+    phases.push_back(phase);
+    return static_cast<int>(phases.size()) - 1;
+}
+
+void Profiler::collect(FrameSlot& slot, GLuint* slotQueries) {
+    if (slot.frame < 0) return;
+
+    double startUs = slot.gpuStartUs;
+    double frameUs = 0.0;
+    bool complete = true;
+    for (size_t i = 0; i < phases.size(); ++i) {
+        if (!slot.issued[i]) continue;
+        slot.issued[i] = false;
+
+        // FRAME_LATENCY フレーム経っても終わっていない結果は捨てる (読むとストールする)
+        GLint available = 0;
+        glGetQueryObjectiv(slotQueries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            ++droppedQueries;
+            complete = false;
+            continue;
+        }
+        GLuint64 elapsedNs = 0;
+        glGetQueryObjectui64v(slotQueries[i], GL_QUERY_RESULT, &elapsedNs);
+
+        double durationUs = elapsedNs / 1000.0;
+        phases[i].gpuMs.add(static_cast<float>(durationUs / 1000.0));
+        addEvent(static_cast<int>(i), true, slot.frame, startUs, durationUs);
+        startUs += durationUs;
+        frameUs += durationUs;
+    }
+    if (complete && frameUs > 0.0) {
+        latestGpuFrameMs = static_cast<float>(frameUs / 1000.0);
+        latestGpuFrameFresh = true;
+    }
+    slot.frame = -1;
+}
+
+bool Profiler::takeGpuFrameMs(float& ms) {
+    if (!latestGpuFrameFresh) return false;
+    latestGpuFrameFresh = false;
+    ms = latestGpuFrameMs;
+    return true;
+}
+
+void Profiler::addEvent(int phase, bool gpu, long long frame, double startUs, double durationUs) {
+    TraceEvent event = {phase, gpu, frame, startUs, durationUs};
+    events.push_back(event);
+    if (events.size() > MAX_TRACE_EVENTS) events.pop_front();
+}
+
+void Profiler::beginFrame() {
+    int index = static_cast<int>(frameIndex % FRAME_LATENCY);
+    collect(slots[index], queries[index]);
+    slots[index].frame = frameIndex;
+    slots[index].gpuStartUs = -1.0;
+    frameStartUs = nowUs();
+}
+
+void Profiler::endFrame() {
+    if (currentPhase >= 0) endPhase();
+    double durationUs = nowUs() - frameStartUs;
+    frameMs.add(static_cast<float>(durationUs / 1000.0));
+    addEvent(-1, false, frameIndex, frameStartUs, durationUs);
+    ++frameIndex;
+}
+
+void Profiler::beginPhase(const char* name, bool gpu) {
+    if (currentPhase >= 0) endPhase();
+    currentPhase = findPhase(name, gpu);
+    phaseStartUs = nowUs();
+    if (currentPhase < 0 || !phases[currentPhase].gpu) return;
+
+    int index = static_cast<int>(frameIndex % FRAME_LATENCY);
+    FrameSlot& slot = slots[index];
+    if (slot.gpuStartUs < 0.0) slot.gpuStartUs = phaseStartUs;
+    slot.issued[currentPhase] = true;
+    glBeginQuery(GL_TIME_ELAPSED, queries[index][currentPhase]);
+}
+
+void Profiler::endPhase() {
+    if (currentPhase < 0) return;
+    if (phases[currentPhase].gpu) glEndQuery(GL_TIME_ELAPSED);
+
+    double durationUs = nowUs() - phaseStartUs;
+    phases[currentPhase].cpuMs.add(static_cast<float>(durationUs / 1000.0));
+    addEvent(currentPhase, false, frameIndex, phaseStartUs, durationUs);
+    currentPhase = -1;
+}
+
+float Profiler::getLatestGpuMs(const char* name) const {
+    for (const Phase& phase : phases) {
+        if (phase.gpu && phase.name == name) return phase.gpuMs.last();
+    }
+    return 0.0f;
+}
+
+std::vector<Profiler::PhaseStats> Profiler::getStats() const {
+    std::vector<PhaseStats> stats;
+    for (const Phase& phase : phases) {
+        PhaseStats s;
+        s.name = phase.name;
+        s.gpu = phase.gpu;
+        s.cpuMs = phase.cpuMs.mean();
+        s.cpuMaxMs = phase.cpuMs.max();
+        s.gpuMs = phase.gpuMs.mean();
+        s.gpuMaxMs = phase.gpuMs.max();
+        stats.push_back(s);
+    }
+    return stats;
+}
+
+std::string Profiler::summary() const {
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(2);
+    out << "frame " << frameMs.mean() << " ms (max " << frameMs.max() << ")";
+    for (const Phase& phase : phases) {
+        out << " | " << phase.name << " ";
+        if (phase.gpu) out << "gpu " << phase.gpuMs.mean() << " / ";
+        out << "cpu " << phase.cpuMs.mean();
+    }
+    if (droppedQueries > 0) out << " | dropped " << droppedQueries;
+    return out.str();
+}
+
+void Profiler::drawOverlay(int x, int y, int width, int height, float scaleMs) {
+    float gpuMs[MAX_PHASES] = {};
+    float cpuMs[MAX_PHASES] = {};
+    for (size_t i = 0; i < phases.size(); ++i) {
+        gpuMs[i] = phases[i].gpu ? phases[i].gpuMs.mean() : 0.0f;
+        cpuMs[i] = phases[i].cpuMs.mean();
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glViewport(x, y, width, height);
+
+    Shader& shader = overlay.getShader();
+    shader.use();
+    shader.setInt(numPhasesLocation, static_cast<int>(phases.size()));
+    shader.setFloat(frameMsLocation, frameMs.mean());
+    shader.setFloat(scaleMsLocation, scaleMs);
+    glUniform1fv(gpuMsLocation, MAX_PHASES, gpuMs);
+    glUniform1fv(cpuMsLocation, MAX_PHASES, cpuMs);
+    overlay.draw();
+
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    glDisable(GL_BLEND);
+    if (depthTest) glEnable(GL_DEPTH_TEST);
+}
+
+bool Profiler::writeChromeTrace(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "Profiler: failed to open " << path << std::endl;
+        return false;
+    }
+
+    nlohmann::json trace;
+    trace["displayTimeUnit"] = "ms";
+    nlohmann::json& list = trace["traceEvents"];
+    list.push_back({{"name", "thread_name"}, {"ph", "M"}, {"pid", 0}, {"tid", 0}, {"args", {{"name", "CPU"}}}});
+    list.push_back({{"name", "thread_name"}, {"ph", "M"}, {"pid", 0}, {"tid", 1}, {"args", {{"name", "GPU"}}}});
+    for (const TraceEvent& event : events) {
+        list.push_back({
+            {"name", event.phase < 0 ? std::string("frame") : phases[event.phase].name},
+            {"cat", event.gpu ? "gpu" : "cpu"},
+            {"ph", "X"},
+            {"ts", event.startUs},
+            {"dur", event.durationUs},
+            {"pid", 0},
+            {"tid", event.gpu ? 1 : 0},
+            {"args", {{"frame", event.frame}}},
+        });
+    }
+    file << trace.dump() << std::endl;
+    return true;
+}
+
+bool Profiler::writeCsv(const std::string& path) const {
+    std::ofstream file(path);
+    if (!file) {
+        std::cerr << "Profiler: failed to open " << path << std::endl;
+        return false;
+    }
+
+    file << "frame,phase,timeline,start_us,duration_us\n";
+    for (const TraceEvent& event : events) {
+        file << event.frame << "," << (event.phase < 0 ? std::string("frame") : phases[event.phase].name) << ","
+             << (event.gpu ? "gpu" : "cpu") << "," << event.startUs << "," << event.durationUs << "\n";
+    }
+    return true;
+}
+
+void Profiler::cleanup() {
+    glDeleteQueries(FRAME_LATENCY * MAX_PHASES, &queries[0][0]);
+    overlay.cleanup();
+}
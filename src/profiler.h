@@ -0,0 +1,118 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <set>
+#include <string>
+#include <vector>
+#include <glad/gl.h>
+#include "quad.h"
+
+// フレームをフェーズに分けて計測するプロファイラ.
+// GPU フェーズは GL_TIME_ELAPSED クエリで測り, FRAME_LATENCY フレーム後に結果を読む (待たない).
+// CPU 時間はすべてのフェーズで測る
+class Profiler {
+public:
+    static const int FRAME_LATENCY = 4;         // クエリのリングの長さ
+    static const int MAX_PHASES = 16;           // profiler_overlay.glsl の MAX_PHASES (作るときに照らし合わせる)
+    static const int HISTORY = 120;             // 統計を取るフレーム数
+    static const size_t MAX_TRACE_EVENTS = 1 << 16;
+
+    struct PhaseStats {
+        std::string name;
+        bool gpu;
+        float cpuMs;        // HISTORY フレームの平均
+        float cpuMaxMs;
+        float gpuMs;
+        float gpuMaxMs;
+    };
+
+    Profiler();
+    void beginFrame();
+    void endFrame();
+    // 1 フレームに同じ名前のフェーズは 1 回だけ. GPU フェーズは入れ子にできない
+    void beginPhase(const char* name, bool gpu = true);
+    void endPhase();
+
+    std::vector<PhaseStats> getStats() const;
+    float getFrameMs() const { return frameMs.mean(); }
+    // 読み出し済みの最新の GPU 時間 (FRAME_LATENCY フレーム前). 未計測なら 0
+    float getLatestGpuMs(const char* name) const;
+    // 同じフレームのすべての GPU フェーズの合計. 捨てたクエリがあったフレームは飛ばす.
+    // 前回の呼び出しから新しいフレームが読み出されたときだけ ms に書いて true を返す
+    bool takeGpuFrameMs(float& ms);
+    int getDroppedQueries() const { return droppedQueries; }
+    std::string summary() const;
+
+    // フェーズごとの時間を積み上げた棒グラフ (上段 GPU, 中段 CPU, 下段フレーム時間) を描く
+    void drawOverlay(int x, int y, int width, int height, float scaleMs = 1000.0f / 30.0f);
+
+    // chrome://tracing や Perfetto で開ける形式
+    bool writeChromeTrace(const std::string& path) const;
+    bool writeCsv(const std::string& path) const;
+
+    void cleanup();
+
+private:
+    class RollingStat {
+    public:
+        RollingStat() : samples(HISTORY, 0.0f), count(0), next(0) {}
+        void add(float value);
+        float mean() const;
+        float max() const;
+        float last() const;
+
+    private:
+        std::vector<float> samples;
+        int count;
+        int next;
+    };
+
+    struct Phase {
+        std::string name;
+        bool gpu;
+        RollingStat cpuMs;
+        RollingStat gpuMs;
+    };
+
+    struct TraceEvent {
+        int phase;          // -1 はフレーム全体
+        bool gpu;
+        long long frame;
+        double startUs;
+        double durationUs;
+    };
+
+    // リングの 1 要素. そのフレームで発行したクエリと CPU 側の開始時刻
+    struct FrameSlot {
+        long long frame;
+        bool issued[MAX_PHASES];
+        double gpuStartUs;  // GL_TIME_ELAPSED には開始時刻がないので, 最初の GPU フェーズの CPU 開始時刻に並べる
+    };
+
+    double nowUs() const;
+    int findPhase(const char* name, bool gpu);
+    void collect(FrameSlot& slot, GLuint* queries);
+    void addEvent(int phase, bool gpu, long long frame, double startUs, double durationUs);
+
+    std::chrono::steady_clock::time_point origin;
+    std::vector<Phase> phases;
+    std::set<std::string> ignoredPhases;    // MAX_PHASES を超えて捨てた名前. 警告は名前ごとに 1 回
+    GLuint queries[FRAME_LATENCY][MAX_PHASES];
+    FrameSlot slots[FRAME_LATENCY];
+    long long frameIndex;
+    double frameStartUs;
+    int currentPhase;
+    double phaseStartUs;
+    int droppedQueries;
+    RollingStat frameMs;
+    float latestGpuFrameMs;
+    bool latestGpuFrameFresh;   // latestGpuFrameMs がまだ takeGpuFrameMs で読まれていない
+    std::deque<TraceEvent> events;
+    Quad overlay;
+    GLint numPhasesLocation;
+    GLint frameMsLocation;
+    GLint scaleMsLocation;
+    GLint gpuMsLocation;
+    GLint cpuMsLocation;
+};
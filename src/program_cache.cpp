@@ -0,0 +1,133 @@
+#include "program_cache.h"
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+namespace {
+
+const uint32_t CACHE_MAGIC = 0x42505452; // "RTPB"
+
+uint64_t fnv1a(const std::string& text) {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string glString(GLenum name) {
+    const GLubyte* value = glGetString(name);
+    return value ? reinterpret_cast<const char*>(value) : "";
+}
+
+void makeDirectory(const std::string& path) {
+#ifdef _WIN32
+    _mkdir(path.c_str());
+#else
+    mkdir(path.c_str(), 0755);
+#endif
+}
+
+} // namespace
+
+ProgramCache::ProgramCache(const std::string& directory)
+    : directory(directory), hits(0), misses(0) {
+    driver = glString(GL_VENDOR) + "\n" + glString(GL_RENDERER) + "\n" + glString(GL_VERSION);
+
+    // バイナリ形式を 1 つも持たないドライバではキャッシュしない
+    GLint formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    supported = formats > 0;
+    if (supported) makeDirectory(directory);
+}
+
+std::string ProgramCache::cacheKey(const std::string& source) const {
+    return driver + "\n" + source;
+}
+
+std::string ProgramCache::cachePath(const std::string& key) const {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bin", static_cast<unsigned long long>(fnv1a(key)));
+    return directory + "/" + name;
+}
+
+// ファイル形式: magic, binaryFormat, キーの長さ, キー, バイナリの長さ, バイナリ.
+// キーを丸ごと保存して比較するので, ハッシュが衝突しても別のプログラムを読むことはない
+GLuint ProgramCache::load(const std::string& source) {
+    if (!supported) return 0;
+
+    std::string key = cacheKey(source);
+    std::ifstream file(cachePath(key), std::ios::binary);
+    uint32_t magic = 0;
+    uint32_t format = 0;
+    uint64_t keySize = 0;
+    if (!file.read(reinterpret_cast<char*>(&magic), sizeof(magic)) || magic != CACHE_MAGIC ||
+        !file.read(reinterpret_cast<char*>(&format), sizeof(format)) ||
+        !file.read(reinterpret_cast<char*>(&keySize), sizeof(keySize)) || keySize != key.size()) {
+        ++misses;
+        return 0;
+    }
+
+    std::string storedKey(keySize, '\0');
+    uint64_t binarySize = 0;
+    if (!file.read(&storedKey[0], keySize) || storedKey != key ||
+        !file.read(reinterpret_cast<char*>(&binarySize), sizeof(binarySize))) {
+        ++misses;
+        return 0;
+    }
+    std::vector<char> binary(binarySize);
+    if (!file.read(binary.data(), binarySize)) {
+        ++misses;
+        return 0;
+    }
+
+    GLuint program = glCreateProgram();
+    glProgramBinary(program, format, binary.data(), static_cast<GLsizei>(binarySize));
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        // ドライバの更新などで受け付けられなかった. コンパイルし直して上書きする
+        glDeleteProgram(program);
+        ++misses;
+        return 0;
+    }
+    ++hits;
+    return program;
+}
+
+void ProgramCache::store(const std::string& source, GLuint program) {
+    if (!supported) return;
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0) return;
+
+    std::vector<char> binary(length);
+    GLenum format = 0;
+    glGetProgramBinary(program, length, nullptr, &format, binary.data());
+
+    std::string key = cacheKey(source);
+    std::ofstream file(cachePath(key), std::ios::binary);
+    if (!file) {
+        std::cerr << "ProgramCache: failed to write " << cachePath(key) << std::endl;
+        return;
+    }
+    uint32_t magic = CACHE_MAGIC;
+    uint32_t storedFormat = format;
+    uint64_t keySize = key.size();
+    uint64_t binarySize = binary.size();
+    file.write(reinterpret_cast<const char*>(&magic), sizeof(magic));
+    file.write(reinterpret_cast<const char*>(&storedFormat), sizeof(storedFormat));
+    file.write(reinterpret_cast<const char*>(&keySize), sizeof(keySize));
+    file.write(key.data(), keySize);
+    file.write(reinterpret_cast<const char*>(&binarySize), sizeof(binarySize));
+    file.write(binary.data(), binarySize);
+}
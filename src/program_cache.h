@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+#include <glad/gl.h>
+
+// リンク済みプログラムを glGetProgramBinary でディスクに保存し, 次回の起動でコンパイルを省く.
+// キーはシェーダーのソース (defines 込み) とドライバ (GL_VENDOR, GL_RENDERER, GL_VERSION) のハッシュ.
+// ドライバが変わったり読み込みに失敗した場合は普通にコンパイルし直す
+class ProgramCache {
+public:
+    explicit ProgramCache(const std::string& directory);
+
+    // 見つかればプログラムを作って返す. なければ 0
+    GLuint load(const std::string& source);
+    void store(const std::string& source, GLuint program);
+
+    int getHits() const { return hits; }
+    int getMisses() const { return misses; }
+
+private:
+    std::string cacheKey(const std::string& source) const;
+    std::string cachePath(const std::string& key) const;
+
+    std::string directory;
+    std::string driver;
+    bool supported;
+    int hits;
+    int misses;
+};
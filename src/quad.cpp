@@ -14,6 +14,24 @@ float quadVertices[] = {
 Quad::Quad(const char* vertexPath, const char* fragmentPath)
     : shader(vertexPath, fragmentPath) {
     setupQuad();
+
+    // the sampler always reads unit 0, so it is set once instead of every draw
+    shader.use();
+    shader.setInt("screenTexture", 0);
+    textureScaleLocation = shader.getUniformLocation("textureScale");
+    setTextureScale(1.0f, 1.0f);
+    encodeOutputLocation = shader.getUniformLocation("encodeOutput");
+    setEncodeOutput(false);
+}
+
+void Quad::setTextureScale(float x, float y) {
+    shader.use();
+    glUniform2f(textureScaleLocation, x, y);
+}
+
+void Quad::setEncodeOutput(bool encode) {
+    shader.use();
+    glUniform1i(encodeOutputLocation, encode ? 1 : 0);
 }
 
 void Quad::cleanup() {
@@ -45,7 +63,6 @@ void Quad::setupQuad() {
 
 void Quad::draw() {
     shader.use();
-    shader.setInt("screenTexture", 0);
     glBindVertexArray(quadVAO);
     glDrawArrays(GL_TRIANGLES, 0, 6);
     glBindVertexArray(0);
@@ -10,10 +10,17 @@ public:
      const char* fragmentPath = SOURCE_DIR "/src/shader/simple_fragment.glsl");
     void cleanup();
     void draw();
+    Shader& getShader() { return shader; } // for extra uniforms of custom fragment shaders
+    // draw only shows the lower-left part of the texture, used for dynamic resolution
+    void setTextureScale(float x, float y);
+    // true when the texture holds linear HDR (accumulation OutputFormat): tonemap and convert to sRGB on draw
+    void setEncodeOutput(bool encode);
 
 private:
     GLuint quadVAO, quadVBO;
     Shader shader;
+    GLint textureScaleLocation;
+    GLint encodeOutputLocation;
     void setupQuad();
 
     const char* vertexPath;
@@ -0,0 +1,57 @@
+#include "raysort.h"
+#include <algorithm>
+
+namespace {
+
+const int RADIX_BITS = 8;
+const int RADIX = 1 << RADIX_BITS;
+
+// 下位 CELL_BITS ビットを 3 つおきに広げる
+uint32_t expandBits(uint32_t v) {
+    uint32_t result = 0;
+    for (int i = 0; i < RayBinner::CELL_BITS; ++i) {
+        result |= ((v >> i) & 1u) << (3 * i);
+    }
+    return result;
+}
+
+} // namespace
+
+RayBinner::RayBinner(const glm::vec3& inSceneMin, const glm::vec3& sceneMax) : sceneMin(inSceneMin) {
+    glm::vec3 extent = glm::max(sceneMax - sceneMin, glm::vec3(1e-6f));
+    cellScale = static_cast<float>(1 << CELL_BITS) / extent;
+}
+
+uint32_t RayBinner::key(const glm::vec3& origin, const glm::vec3& dir) const {
+    const float maxCell = static_cast<float>((1 << CELL_BITS) - 1);
+    glm::vec3 cell = glm::clamp((origin - sceneMin) * cellScale, glm::vec3(0.0f), glm::vec3(maxCell));
+    uint32_t morton = expandBits(static_cast<uint32_t>(cell.x)) |
+                      (expandBits(static_cast<uint32_t>(cell.y)) << 1) |
+                      (expandBits(static_cast<uint32_t>(cell.z)) << 2);
+    uint32_t octant = (dir.x < 0.0f ? 1u : 0u) | (dir.y < 0.0f ? 2u : 0u) | (dir.z < 0.0f ? 4u : 0u);
+    return (octant << (3 * CELL_BITS)) | morton;
+}
+
+void sortRayKeys(const std::vector<uint32_t>& keys, int keyBits, std::vector<int>& order) {
+    int count = static_cast<int>(keys.size());
+    order.resize(count);
+    for (int i = 0; i < count; ++i) order[i] = i;
+
+    std::vector<int> temp(count);
+    for (int shift = 0; shift < keyBits; shift += RADIX_BITS) {
+        int histogram[RADIX] = {};
+        for (int i = 0; i < count; ++i) {
+            ++histogram[(keys[order[i]] >> shift) & (RADIX - 1)];
+        }
+        int sum = 0;
+        for (int b = 0; b < RADIX; ++b) {
+            int c = histogram[b];
+            histogram[b] = sum;
+            sum += c;
+        }
+        for (int i = 0; i < count; ++i) {
+            temp[histogram[(keys[order[i]] >> shift) & (RADIX - 1)]++] = order[i];
+        }
+        order.swap(temp);
+    }
+}
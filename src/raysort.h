@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <glm/glm.hpp>
+
+// レイを原点のセル (Morton 順) と方向の八分円でまとめるためのキー
+class RayBinner {
+public:
+    static const int CELL_BITS = 6;     // 軸ごとのビット数 (GPU のキーは Wavefront::CELL_BITS で, より粗い)
+    static const int KEY_BITS = 3 * CELL_BITS + 3;
+
+    RayBinner(const glm::vec3& sceneMin, const glm::vec3& sceneMax);
+
+    uint32_t key(const glm::vec3& origin, const glm::vec3& dir) const;
+
+private:
+    glm::vec3 sceneMin;
+    glm::vec3 cellScale;
+};
+
+// keys の昇順に並べたときのインデックス列を order に返す (LSD radix sort, 安定)
+void sortRayKeys(const std::vector<uint32_t>& keys, int keyBits, std::vector<int>& order);
@@ -0,0 +1,63 @@
+#include "reflection.h"
+
+namespace {
+
+std::string resourceName(GLuint program, GLenum interface, GLuint index, GLint length) {
+    std::string name(length, '\0');
+    glGetProgramResourceName(program, interface, index, length, nullptr, &name[0]);
+    name.resize(length > 0 ? length - 1 : 0); // 終端の '\0' を除く
+    return name;
+}
+
+} // namespace
+
+void ProgramReflection::reflect(GLuint program) {
+    uniforms.clear();
+    uniformBlocks.clear();
+    storageBlocks.clear();
+
+    GLint count = 0;
+    glGetProgramInterfaceiv(program, GL_UNIFORM, GL_ACTIVE_RESOURCES, &count);
+    for (GLint i = 0; i < count; ++i) {
+        const GLenum props[] = {GL_NAME_LENGTH, GL_BLOCK_INDEX, GL_LOCATION};
+        GLint values[3];
+        glGetProgramResourceiv(program, GL_UNIFORM, i, 3, props, 3, nullptr, values);
+        if (values[1] != -1) continue; // block のメンバーには location がない
+
+        std::string name = resourceName(program, GL_UNIFORM, i, values[0]);
+        uniforms[name] = values[2];
+        // 配列は "name[0]" で返るので "name" でも引けるようにする
+        if (name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0) {
+            uniforms[name.substr(0, name.size() - 3)] = values[2];
+        }
+    }
+
+    const GLenum blockInterfaces[] = {GL_UNIFORM_BLOCK, GL_SHADER_STORAGE_BLOCK};
+    LocationMap* blockMaps[] = {&uniformBlocks, &storageBlocks};
+    for (int k = 0; k < 2; ++k) {
+        glGetProgramInterfaceiv(program, blockInterfaces[k], GL_ACTIVE_RESOURCES, &count);
+        for (GLint i = 0; i < count; ++i) {
+            const GLenum props[] = {GL_NAME_LENGTH, GL_BUFFER_BINDING};
+            GLint values[2];
+            glGetProgramResourceiv(program, blockInterfaces[k], i, 2, props, 2, nullptr, values);
+            (*blockMaps[k])[resourceName(program, blockInterfaces[k], i, values[0])] = values[1];
+        }
+    }
+}
+
+GLint ProgramReflection::find(const LocationMap& map, const std::string& name) {
+    LocationMap::const_iterator it = map.find(name);
+    return it == map.end() ? -1 : it->second;
+}
+
+GLint ProgramReflection::uniformLocation(const std::string& name) const {
+    return find(uniforms, name);
+}
+
+GLint ProgramReflection::uniformBlockBinding(const std::string& name) const {
+    return find(uniformBlocks, name);
+}
+
+GLint ProgramReflection::storageBlockBinding(const std::string& name) const {
+    return find(storageBlocks, name);
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <glad/gl.h>
+
+// リンク直後のプログラムから uniform の location と block の binding を読んでおく.
+// 毎回 glGetUniformLocation を呼ばずに済む. 見つからなければ -1
+class ProgramReflection {
+public:
+    void reflect(GLuint program);
+
+    GLint uniformLocation(const std::string& name) const;
+    GLint uniformBlockBinding(const std::string& name) const;
+    GLint storageBlockBinding(const std::string& name) const;
+
+private:
+    typedef std::unordered_map<std::string, GLint> LocationMap;
+    static GLint find(const LocationMap& map, const std::string& name);
+
+    LocationMap uniforms;
+    LocationMap uniformBlocks;
+    LocationMap storageBlocks;
+};
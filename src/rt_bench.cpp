@@ -0,0 +1,517 @@
+// rt_bench: CPU ray-tracing benchmark with fixed scenes, camera paths and lights.
+// Usage: rt_bench [--scene name] [--lights name] [--width W] [--height H] [--frames N]
+//                 [--bounces B] [--sort] [--path] [--light-samples N] [--spp N] [--denoise] [--temporal] [--stats]
+//                 [--asset path.gltf] [--json out.json]
+// --path traces diffuse paths with Russian roulette instead of mirror bounces
+// --light-samples N shades N lights per hit picked through a LightBVH instead of every light.
+//   mean_luminance of the run should match the run without it (the estimate is unbiased)
+// --spp N averages N samples per pixel per frame, --denoise runs atrousFilter on the result (timed in frame_ms)
+// --temporal accumulates the frames along the camera path with a TemporalAccumulator before the filter;
+//   history_reused is the fraction of pixels that found their previous position (raise --frames to slow the camera)
+// --stats adds traversal counters (nodes, AABB/triangle tests, stack depth) and slows the timed runs
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "json.hpp"
+#include "util.h"
+#include "bvh.h"
+#include "presplit.h"
+#include "tracer.h"
+#include "atrous.h"
+#include "temporal.h"
+
+namespace {
+
+struct BenchScene {
+    std::string name;
+    std::vector<Data> data;
+    std::vector<EmissiveTriangle> emissive;   // --light-samples のときだけ光源になる
+};
+
+struct LightSetup {
+    std::string name;
+    std::vector<Light> lights;
+};
+
+struct BenchOptions {
+    std::string scene;
+    std::string lights;
+    std::string asset;
+    std::string jsonPath;
+    int width;
+    int height;
+    int frames;
+    int bounces;
+    bool sortRays;
+    bool pathTrace;
+    int lightSamples;       // 0 なら全部の光源を足す
+    int samplesPerPixel;
+    bool denoise;
+    bool temporal;          // --denoise の前にフレームを時間方向に蓄積する
+    bool traversalStats;
+
+    BenchOptions()
+        : scene("all"), lights("all"), asset(SOURCE_DIR "/asset/furina/scene.gltf"), width(320), height(240),
+          frames(16), bounces(2), sortRays(false), pathTrace(false), lightSamples(0), samplesPerPixel(1),
+          denoise(false), temporal(false), traversalStats(false) {}
+};
+
+// 再現性のために乱数は固定のシードの LCG を使う
+class Random {
+public:
+    explicit Random(uint32_t seed) : state(seed) {}
+    float next() {
+        state = state * 1664525u + 1013904223u;
+        return static_cast<float>(state >> 8) / 16777216.0f;
+    }
+
+private:
+    uint32_t state;
+};
+
+Data makeTriangle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    Data d;
+    d.v0 = glm::vec4(a, 0.0f);
+    d.v1 = glm::vec4(b, 0.0f);
+    d.v2 = glm::vec4(c, 0.0f);
+    return d;
+}
+
+void addSphere(std::vector<Data>& data, const glm::vec3& center, float radius, int rings) {
+    const float pi = 3.14159265f;
+    for (int i = 0; i < rings; ++i) {
+        for (int j = 0; j < 2 * rings; ++j) {
+            glm::vec3 p[4];
+            for (int k = 0; k < 4; ++k) {
+                float theta = pi * (i + (k >> 1)) / rings;
+                float phi = pi * (j + (k & 1)) / rings;
+                p[k] = center + radius * glm::vec3(std::sin(theta) * std::cos(phi), std::cos(theta),
+                                                   std::sin(theta) * std::sin(phi));
+            }
+            data.push_back(makeTriangle(p[0], p[3], p[2]));
+            data.push_back(makeTriangle(p[0], p[1], p[3]));
+        }
+    }
+}
+
+void addBox(std::vector<Data>& data, const glm::vec3& min, const glm::vec3& max) {
+    glm::vec3 c[8];
+    for (int i = 0; i < 8; ++i) {
+        c[i] = glm::vec3(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z);
+    }
+    const int faces[6][4] = {{0, 2, 6, 4}, {1, 5, 7, 3}, {0, 4, 5, 1}, {2, 3, 7, 6}, {0, 1, 3, 2}, {4, 6, 7, 5}};
+    for (const auto& f : faces) {
+        data.push_back(makeTriangle(c[f[0]], c[f[1]], c[f[2]]));
+        data.push_back(makeTriangle(c[f[0]], c[f[2]], c[f[3]]));
+    }
+}
+
+void addFloor(std::vector<Data>& data, float size, float y) {
+    data.push_back(makeTriangle(glm::vec3(-size, y, -size), glm::vec3(-size, y, size), glm::vec3(size, y, size)));
+    data.push_back(makeTriangle(glm::vec3(-size, y, -size), glm::vec3(size, y, size), glm::vec3(size, y, -size)));
+}
+
+// 手続き的に作るストレスシーン
+BenchScene makeSpheres() {
+    BenchScene scene;
+    for (int i = 0; i < 10; ++i) {
+        for (int j = 0; j < 10; ++j) {
+            addSphere(scene.data, glm::vec3(i * 2.5f - 11.25f, 0.3f * ((i + j) % 3), j * 2.5f - 11.25f), 1.0f, 32);
+        }
+    }
+    addFloor(scene.data, 40.0f, -1.0f);
+    return scene;
+}
+
+BenchScene makeSoup() {
+    BenchScene scene;
+    Random random(1);
+    for (int i = 0; i < 100000; ++i) {
+        glm::vec3 p(random.next(), random.next(), random.next());
+        p = p * 20.0f - 10.0f;
+        glm::vec3 a(random.next(), random.next(), random.next());
+        glm::vec3 b(random.next(), random.next(), random.next());
+        scene.data.push_back(makeTriangle(p, p + (a - 0.5f) * 0.4f, p + (b - 0.5f) * 0.4f));
+    }
+    return scene;
+}
+
+// 細長い三角形が多いシーン (presplit の効果が大きい)
+BenchScene makeSlivers() {
+    BenchScene scene;
+    Random random(2);
+    for (int i = 0; i < 20000; ++i) {
+        glm::vec3 p(random.next() * 20.0f - 10.0f, random.next() * 10.0f, random.next() * 20.0f - 10.0f);
+        glm::vec3 d = glm::normalize(glm::vec3(random.next(), random.next(), random.next()) - 0.5f) * 3.0f;
+        glm::vec3 w(random.next() * 0.05f, random.next() * 0.05f, random.next() * 0.05f);
+        scene.data.push_back(makeTriangle(p - d, p + d, p + w));
+    }
+    addFloor(scene.data, 40.0f, -1.0f);
+    return scene;
+}
+
+BenchScene makeCity() {
+    BenchScene scene;
+    Random random(3);
+    for (int i = 0; i < 64; ++i) {
+        for (int j = 0; j < 64; ++j) {
+            float height = 0.5f + 6.0f * random.next() * random.next();
+            glm::vec3 min(i - 32.0f, -1.0f, j - 32.0f);
+            addBox(scene.data, min + glm::vec3(0.1f, 0.0f, 0.1f), min + glm::vec3(0.9f, height, 0.9f));
+        }
+    }
+    addFloor(scene.data, 40.0f, -1.0f);
+    return scene;
+}
+
+typedef BenchScene (*SceneFactory)();
+
+// --scene で選べる手続き的なシーン. 名前で選んでから作る
+struct SceneEntry {
+    const char* name;
+    SceneFactory factory;
+};
+
+const SceneEntry SCENES[] = {
+    {"spheres", makeSpheres},
+    {"soup", makeSoup},
+    {"slivers", makeSlivers},
+    {"city", makeCity},
+};
+
+bool isKnownScene(const std::string& name) {
+    if (name == "all" || name == "asset") return true;
+    for (const SceneEntry& entry : SCENES) {
+        if (name == entry.name) return true;
+    }
+    return false;
+}
+
+bool loadAsset(const std::string& path, BenchScene& scene) {
+    if (!std::ifstream(path).good()) {
+        std::cerr << "rt_bench: asset " << path << " not found, skipping" << std::endl;
+        return false;
+    }
+
+    // Model はテクスチャと VAO を作るので非表示のウィンドウでコンテキストを用意する
+    if (!initializeGLFW()) return false;
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    GLFWwindow* window = createWindow(64, 64, "rt_bench");
+    if (!window) return false;
+    if (!initializeGLAD()) {
+        cleanup(window);
+        return false;
+    }
+
+    bool loaded = true;
+    try {
+        Model model(path);
+        scene.name = "asset";
+        scene.data = makeData(model.getTriangles());
+        scene.emissive = model.getEmissiveTriangles();
+    } catch (const std::exception& e) {
+        std::cerr << "rt_bench: " << e.what() << std::endl;
+        loaded = false;
+    }
+    cleanup(window);
+    return loaded;
+}
+
+void sceneBounds(const std::vector<BVHNode>& nodes, glm::vec3& min, glm::vec3& max) {
+    min = nodes.empty() ? glm::vec3(-1.0f) : nodes[0].min;
+    max = nodes.empty() ? glm::vec3(1.0f) : nodes[0].max;
+}
+
+std::vector<LightSetup> makeLightSetups(const glm::vec3& min, const glm::vec3& max) {
+    glm::vec3 center = (min + max) * 0.5f;
+    glm::vec3 extent = max - min;
+
+    std::vector<LightSetup> setups(3);
+    setups[0].name = "single";
+    Light top = {glm::vec4(center + glm::vec3(0.0f, extent.y, 0.0f), 1.0f), glm::vec4(1.0f)};
+    setups[0].lights.push_back(top);
+
+    setups[1].name = "four";
+    for (int i = 0; i < 4; ++i) {
+        glm::vec3 offset((i & 1 ? 0.5f : -0.5f) * extent.x, extent.y, (i & 2 ? 0.5f : -0.5f) * extent.z);
+        Light light = {glm::vec4(center + offset, 1.0f), glm::vec4(0.25f)};
+        setups[1].lights.push_back(light);
+    }
+
+    // 16 x 16 の格子. 合計の明るさは他と同じ
+    setups[2].name = "many";
+    for (int i = 0; i < 16; ++i) {
+        for (int j = 0; j < 16; ++j) {
+            glm::vec3 offset((i / 15.0f - 0.5f) * extent.x, 0.75f * extent.y, (j / 15.0f - 0.5f) * extent.z);
+            Light light = {glm::vec4(center + offset, 1.0f), glm::vec4(1.0f / 256.0f)};
+            setups[2].lights.push_back(light);
+        }
+    }
+    return setups;
+}
+
+// シーンの境界を回る固定のカメラパス (高さを変えながら一周)
+Camera cameraOnPath(const glm::vec3& min, const glm::vec3& max, int frame, int frames) {
+    glm::vec3 center = (min + max) * 0.5f;
+    float radius = 0.75f * glm::length(max - min);
+    float angle = 6.2831853f * frame / frames;
+    glm::vec3 position = center + glm::vec3(radius * std::cos(angle),
+                                            0.25f * radius * (1.0f + std::sin(2.0f * angle)),
+                                            radius * std::sin(angle));
+    glm::vec3 dir = glm::normalize(center - position);
+    float yaw = glm::degrees(std::atan2(dir.z, dir.x));
+    float pitch = glm::degrees(std::asin(dir.y));
+    return Camera(position, glm::vec3(0.0f, 1.0f, 0.0f), yaw, pitch);
+}
+
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) return 0.0;
+    std::sort(values.begin(), values.end());
+    size_t index = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+    return values[std::min(index, values.size() - 1)];
+}
+
+double mrays(long long rays, double seconds) {
+    return seconds > 0.0 ? rays / seconds / 1e6 : 0.0;
+}
+
+nlohmann::json runScene(const BenchScene& scene, const BenchOptions& options) {
+    nlohmann::json result;
+    result["scene"] = scene.name;
+    result["triangles"] = scene.data.size();
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::vector<PrimRef> refs;
+    presplit(scene.data, refs);
+    BVH bvh(scene.data, refs);
+    double buildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    // 2 回目は作業用の配列とノードの容量を使い回す (アニメーションで毎フレーム作り直すときの時間)
+    start = std::chrono::steady_clock::now();
+    bvh.rebuild(scene.data, refs);
+    double rebuildSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    const std::vector<BVHNode>& nodes = bvh.getNodes();
+    const std::vector<Data>& data = bvh.getDataArray();
+    result["bvh"] = {
+        {"build_ms", buildSeconds * 1000.0},
+        {"rebuild_ms", rebuildSeconds * 1000.0},
+        {"nodes", nodes.size()},
+        {"references", data.size()},
+        {"memory_bytes", nodes.size() * sizeof(BVHNode) + data.size() * sizeof(Data)},
+    };
+
+    glm::vec3 min, max;
+    sceneBounds(nodes, min, max);
+    Tracer tracer(bvh);
+    TraceOptions traceOptions;
+    traceOptions.maxBounces = options.bounces;
+    traceOptions.sortRays = options.sortRays;
+    traceOptions.pathTrace = options.pathTrace;
+
+    std::vector<LightSetup> setups = makeLightSetups(min, max);
+    std::vector<glm::vec4> image;
+    std::vector<glm::vec4> sampleImage;
+    std::vector<GBufferTexel> gbuffer;
+    std::vector<float> variance;
+    std::vector<TraversalStats> pixelStats;
+    for (const LightSetup& setup : setups) {
+        if (options.lights != "all" && options.lights != setup.name) continue;
+
+        LightBVH lightBVH(setup.lights, scene.emissive);
+        traceOptions.lightBVH = options.lightSamples > 0 ? &lightBVH : nullptr;
+        traceOptions.lightSamples = options.lightSamples;
+
+        RenderStats total = {};
+        double luminanceSum = 0.0;
+        TraversalStats traversal;
+        std::vector<double> frameMs;
+        std::vector<double> denoiseMs;
+        TemporalAccumulator accumulator;
+        long long reusedPixels = 0;
+        for (int frame = 0; frame < options.frames; ++frame) {
+            Camera camera = cameraOnPath(min, max, frame, options.frames);
+            std::chrono::steady_clock::time_point frameStart = std::chrono::steady_clock::now();
+            for (int sample = 0; sample < options.samplesPerPixel; ++sample) {
+                traceOptions.frameIndex = static_cast<unsigned int>(frame * options.samplesPerPixel + sample);
+                // 一次レイは毎回同じなので G-buffer は最初のサンプルから取る
+                RenderStats stats = tracer.render(camera, setup.lights, options.width, options.height,
+                                                  sample == 0 ? image : sampleImage, traceOptions,
+                                                  options.traversalStats ? &pixelStats : nullptr,
+                                                  (options.denoise || options.temporal) && sample == 0 ? &gbuffer
+                                                                                                     : nullptr);
+                if (sample > 0) {
+                    for (size_t i = 0; i < image.size(); ++i) image[i] += sampleImage[i];
+                }
+
+                total.primaryRays += stats.primaryRays;
+                total.shadowRays += stats.shadowRays;
+                total.secondaryRays += stats.secondaryRays;
+                total.primarySeconds += stats.primarySeconds;
+                total.shadowSeconds += stats.shadowSeconds;
+                total.secondarySeconds += stats.secondarySeconds;
+                total.terminatedPaths += stats.terminatedPaths;
+                for (const TraversalStats& p : pixelStats) traversal.add(p);
+            }
+            if (options.samplesPerPixel > 1) {
+                for (glm::vec4& p : image) p /= static_cast<float>(options.samplesPerPixel);
+            }
+            if (options.denoise || options.temporal) {
+                std::chrono::steady_clock::time_point denoiseStart = std::chrono::steady_clock::now();
+                if (options.temporal)
+                    reusedPixels += accumulator.accumulate(image, gbuffer, camera, options.width, options.height, variance);
+                if (options.denoise)
+                    atrousFilter(image, gbuffer, options.width, options.height, AtrousOptions(),
+                                 options.temporal ? &variance : nullptr);
+                denoiseMs.push_back(
+                    std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - denoiseStart).count());
+            }
+            frameMs.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart).count());
+            for (const glm::vec4& p : image) luminanceSum += 0.2126 * p.x + 0.7152 * p.y + 0.0722 * p.z;
+        }
+
+        result["runs"].push_back({
+            {"lights", setup.name},
+            {"mrays_per_sec", {
+                {"primary", mrays(total.primaryRays, total.primarySeconds)},
+                {"shadow", mrays(total.shadowRays, total.shadowSeconds)},
+                {"secondary", mrays(total.secondaryRays, total.secondarySeconds)},
+            }},
+            {"rays", {
+                {"primary", total.primaryRays},
+                {"shadow", total.shadowRays},
+                {"secondary", total.secondaryRays},
+            }},
+            {"roulette_terminated", total.terminatedPaths},
+            {"mean_luminance", luminanceSum / (static_cast<double>(options.width) * options.height * options.frames)},
+            {"frame_ms", {
+                {"p50", percentile(frameMs, 0.5)},
+                {"p90", percentile(frameMs, 0.9)},
+                {"p99", percentile(frameMs, 0.99)},
+                {"max", percentile(frameMs, 1.0)},
+            }},
+        });
+
+        if (options.temporal) {
+            result["runs"].back()["history_reused"] =
+                reusedPixels / (static_cast<double>(options.width) * options.height * options.frames);
+        }
+        if (options.denoise || options.temporal) {
+            result["runs"].back()["denoise_ms"] = {
+                {"p50", percentile(denoiseMs, 0.5)},
+                {"max", percentile(denoiseMs, 1.0)},
+            };
+        }
+        if (options.traversalStats) {
+            double rays = static_cast<double>(total.primaryRays + total.shadowRays + total.secondaryRays);
+            result["runs"].back()["traversal_per_ray"] = {
+                {"nodes_visited", traversal.nodesVisited / rays},
+                {"aabb_tests", traversal.aabbTests / rays},
+                {"triangle_tests", traversal.triangleTests / rays},
+                {"max_stack_depth", traversal.maxStackDepth},
+            };
+        }
+    }
+    return result;
+}
+
+bool parseArguments(int argc, char** argv, BenchOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--sort") {
+            options.sortRays = true;
+        } else if (arg == "--path") {
+            options.pathTrace = true;
+        } else if (arg == "--denoise") {
+            options.denoise = true;
+        } else if (arg == "--temporal") {
+            options.temporal = true;
+        } else if (arg == "--stats") {
+            options.traversalStats = true;
+        } else if (arg == "--scene" && hasValue) {
+            options.scene = argv[++i];
+        } else if (arg == "--lights" && hasValue) {
+            options.lights = argv[++i];
+        } else if (arg == "--asset" && hasValue) {
+            options.asset = argv[++i];
+        } else if (arg == "--json" && hasValue) {
+            options.jsonPath = argv[++i];
+        } else if (arg == "--width" && hasValue) {
+            options.width = std::atoi(argv[++i]);
+        } else if (arg == "--height" && hasValue) {
+            options.height = std::atoi(argv[++i]);
+        } else if (arg == "--frames" && hasValue) {
+            options.frames = std::atoi(argv[++i]);
+        } else if (arg == "--bounces" && hasValue) {
+            options.bounces = std::atoi(argv[++i]);
+        } else if (arg == "--spp" && hasValue) {
+            options.samplesPerPixel = std::atoi(argv[++i]);
+        } else if (arg == "--light-samples" && hasValue) {
+            options.lightSamples = std::atoi(argv[++i]);
+        } else {
+            std::cerr << "rt_bench: unknown argument " << arg << std::endl;
+            return false;
+        }
+    }
+    if (!isKnownScene(options.scene)) {
+        std::cerr << "rt_bench: unknown scene " << options.scene << std::endl;
+        return false;
+    }
+    return options.width > 0 && options.height > 0 && options.frames > 0 && options.bounces > 0 &&
+           options.lightSamples >= 0 && options.samplesPerPixel > 0;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    BenchOptions options;
+    if (!parseArguments(argc, argv, options)) {
+        std::cerr << "usage: rt_bench [--scene all|asset|spheres|soup|slivers|city] [--lights all|single|four|many]\n"
+                     "                [--width W] [--height H] [--frames N] [--bounces B] [--sort] [--path]\n"
+                     "                [--light-samples N] [--spp N] [--denoise] [--temporal] [--stats]\n"
+                     "                [--asset path.gltf] [--json out.json]" << std::endl;
+        return 1;
+    }
+
+    nlohmann::json report;
+    report["config"] = {
+        {"width", options.width},
+        {"height", options.height},
+        {"frames", options.frames},
+        {"bounces", options.bounces},
+        {"sort_rays", options.sortRays},
+        {"path_trace", options.pathTrace},
+        {"light_samples", options.lightSamples},
+        {"spp", options.samplesPerPixel},
+        {"denoise", options.denoise},
+        {"temporal", options.temporal},
+    };
+    report["scenes"] = nlohmann::json::array();
+
+    if (options.scene == "all" || options.scene == "asset") {
+        BenchScene scene;
+        if (loadAsset(options.asset, scene)) {
+            report["scenes"].push_back(runScene(scene, options));
+        }
+    }
+    for (const SceneEntry& entry : SCENES) {
+        if (options.scene != "all" && options.scene != entry.name) continue;
+        BenchScene scene = entry.factory();
+        scene.name = entry.name;
+        std::cerr << "rt_bench: " << scene.name << " (" << scene.data.size() << " triangles)" << std::endl;
+        report["scenes"].push_back(runScene(scene, options));
+    }
+
+    if (options.jsonPath.empty()) {
+        std::cout << report.dump(2) << std::endl;
+    } else {
+        std::ofstream out(options.jsonPath);
+        out << report.dump(2) << std::endl;
+    }
+    return 0;
+}
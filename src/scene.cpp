@@ -0,0 +1,466 @@
+#include "scene.h"
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include "presplit.h"
+
+namespace {
+
+// 変わった要素の範囲 [begin, end) を広げる
+void markRange(int& begin, int& end, int index) {
+    begin = std::min(begin, index);
+    end = std::max(end, index + 1);
+}
+
+void clearRange(int& begin, int& end) {
+    begin = std::numeric_limits<int>::max();
+    end = 0;
+}
+
+} // namespace
+
+SceneBuffer::SceneBuffer(GLuint binding) : binding(binding), buffer(0), capacity(0) {}
+
+void SceneBuffer::reserve(size_t bytes) {
+    if (bytes <= capacity) return;
+    size_t newCapacity = std::max(bytes, capacity * 2);
+    GLuint newBuffer;
+    glGenBuffers(1, &newBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, newBuffer);
+    glBufferData(GL_COPY_WRITE_BUFFER, newCapacity, nullptr, GL_DYNAMIC_DRAW);
+    if (buffer) {
+        glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, capacity);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    buffer = newBuffer;
+    capacity = newCapacity;
+}
+
+void SceneBuffer::upload(size_t offset, size_t bytes, const void* data) {
+    if (bytes == 0) return;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, offset, bytes, data);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+void SceneBuffer::bind() const {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer);
+}
+
+void SceneBuffer::cleanup() {
+    if (buffer) glDeleteBuffers(1, &buffer);
+    buffer = 0;
+    capacity = 0;
+}
+
+int RangeAllocator::allocate(int count) {
+    for (std::map<int, int>::iterator it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+        if (it->second < count) continue;
+        int offset = it->first;
+        int remaining = it->second - count;
+        freeRanges.erase(it);
+        if (remaining > 0) freeRanges[offset + count] = remaining;
+        return offset;
+    }
+    int offset = end;
+    end += count;
+    return offset;
+}
+
+void RangeAllocator::free(int offset, int count) {
+    if (count <= 0) return;
+    std::map<int, int>::iterator next = freeRanges.lower_bound(offset);
+    if (next != freeRanges.end() && offset + count == next->first) {
+        count += next->second;
+        freeRanges.erase(next);
+    }
+    std::map<int, int>::iterator previous = freeRanges.lower_bound(offset);
+    if (previous != freeRanges.begin()) {
+        --previous;
+        if (previous->first + previous->second == offset) {
+            offset = previous->first;
+            count += previous->second;
+            freeRanges.erase(previous);
+        }
+    }
+    // 最後の範囲なら使った範囲を縮める
+    if (offset + count == end) {
+        end = offset;
+    } else {
+        freeRanges[offset] = count;
+    }
+}
+
+Scene::Scene()
+    : liveMeshes(0), liveInstances(0), instanceTreeDirty(true), builder(std::vector<Data>()),
+      triangleBuffer(0), nodeBuffer(1), lightBuffer(2), instanceNodeBuffer(INSTANCE_NODE_BINDING),
+      instanceBuffer(INSTANCE_BINDING) {
+    clearRange(dirtyNodeBegin, dirtyNodeEnd);
+    clearRange(dirtyInstanceBegin, dirtyInstanceEnd);
+    clearRange(dirtyLightBegin, dirtyLightEnd);
+}
+
+MeshHandle Scene::addMesh(const std::vector<Data>& triangles) {
+    int index;
+    if (!freeMeshes.empty()) {
+        index = freeMeshes.back();
+        freeMeshes.pop_back();
+    } else {
+        index = static_cast<int>(meshes.size());
+        meshes.push_back(Mesh());
+    }
+    Mesh& mesh = meshes[index];
+    mesh.alive = true;
+    mesh.dirty = true;
+    mesh.triangles = triangles;
+    mesh.min = mesh.max = glm::vec3(0.0f);
+    mesh.nodeOffset = mesh.nodeCount = 0;
+    mesh.triangleOffset = mesh.triangleCount = 0;
+    mesh.instanceCount = 0;
+    ++liveMeshes;
+    MeshHandle handle = {index};
+    return handle;
+}
+
+void Scene::updateMesh(MeshHandle handle, const std::vector<Data>& triangles) {
+    Mesh& mesh = meshes[handle.index];
+    mesh.triangles = triangles;
+    mesh.dirty = true;
+}
+
+bool Scene::removeMesh(MeshHandle handle) {
+    Mesh& mesh = meshes[handle.index];
+    if (mesh.instanceCount > 0) {
+        std::cerr << "Scene: mesh " << handle.index << " still has " << mesh.instanceCount << " instances" << std::endl;
+        return false;
+    }
+    nodeRanges.free(mesh.nodeOffset, mesh.nodeCount);
+    triangleRanges.free(mesh.triangleOffset, mesh.triangleCount);
+    std::vector<Data>().swap(mesh.triangles);
+    mesh.alive = false;
+    mesh.dirty = false;
+    freeMeshes.push_back(handle.index);
+    --liveMeshes;
+    return true;
+}
+
+InstanceHandle Scene::addInstance(MeshHandle mesh, const glm::mat4& objectToWorld) {
+    int index;
+    if (!freeInstances.empty()) {
+        index = freeInstances.back();
+        freeInstances.pop_back();
+    } else {
+        index = static_cast<int>(instances.size());
+        instances.push_back(Instance());
+    }
+    Instance& instance = instances[index];
+    instance.alive = true;
+    instance.dirty = true;
+    instance.mesh = mesh.index;
+    instance.objectToWorld = objectToWorld;
+    instance.min = instance.max = glm::vec3(0.0f);
+    instance.leaf = -1;
+    ++meshes[mesh.index].instanceCount;
+    ++liveInstances;
+    instanceTreeDirty = true;
+    InstanceHandle handle = {index};
+    return handle;
+}
+
+void Scene::setTransform(InstanceHandle handle, const glm::mat4& objectToWorld) {
+    Instance& instance = instances[handle.index];
+    instance.objectToWorld = objectToWorld;
+    instance.dirty = true;
+}
+
+void Scene::setMesh(InstanceHandle handle, MeshHandle mesh) {
+    Instance& instance = instances[handle.index];
+    if (instance.mesh == mesh.index) return;
+    --meshes[instance.mesh].instanceCount;
+    ++meshes[mesh.index].instanceCount;
+    instance.mesh = mesh.index;
+    instance.dirty = true;
+}
+
+void Scene::removeInstance(InstanceHandle handle) {
+    Instance& instance = instances[handle.index];
+    instance.alive = false;
+    instance.dirty = false;
+    --meshes[instance.mesh].instanceCount;
+    freeInstances.push_back(handle.index);
+    --liveInstances;
+    instanceTreeDirty = true;
+}
+
+LightHandle Scene::addLight(const Light& light) {
+    int handle;
+    if (!freeLights.empty()) {
+        handle = freeLights.back();
+        freeLights.pop_back();
+    } else {
+        handle = static_cast<int>(lightSlot.size());
+        lightSlot.push_back(-1);
+    }
+    int slot = static_cast<int>(lights.size());
+    lights.push_back(light);
+    lightHandle.push_back(handle);
+    lightSlot[handle] = slot;
+    markRange(dirtyLightBegin, dirtyLightEnd, slot);
+    LightHandle result = {handle};
+    return result;
+}
+
+void Scene::setLight(LightHandle handle, const Light& value) {
+    int slot = lightSlot[handle.index];
+    lights[slot] = value;
+    markRange(dirtyLightBegin, dirtyLightEnd, slot);
+}
+
+// カーネルは先頭から numLights 個を読むので, 最後の光源を空いたところに移す
+void Scene::removeLight(LightHandle handle) {
+    int slot = lightSlot[handle.index];
+    int last = static_cast<int>(lights.size()) - 1;
+    if (slot != last) {
+        lights[slot] = lights[last];
+        lightHandle[slot] = lightHandle[last];
+        lightSlot[lightHandle[slot]] = slot;
+        markRange(dirtyLightBegin, dirtyLightEnd, slot);
+    }
+    lights.pop_back();
+    lightHandle.pop_back();
+    lightSlot[handle.index] = -1;
+    freeLights.push_back(handle.index);
+}
+
+SceneCommitStats Scene::commit() {
+    SceneCommitStats stats;
+    bool meshesChanged = false;
+    for (Mesh& mesh : meshes) {
+        if (mesh.alive && mesh.dirty) {
+            buildMesh(mesh, stats);
+            meshesChanged = true;
+        }
+    }
+
+    // 作り直したメッシュを置いているインスタンスも根と境界が変わる
+    gpuInstances.resize(instances.size());
+    for (size_t i = 0; i < instances.size(); ++i) {
+        const Instance& instance = instances[i];
+        if (instance.alive && (instance.dirty || (meshesChanged && meshes[instance.mesh].dirty))) {
+            updateInstance(static_cast<int>(i), stats);
+        }
+    }
+    for (Mesh& mesh : meshes) {
+        mesh.dirty = false;
+    }
+
+    if (instanceTreeDirty) {
+        buildInstanceTree();
+        instanceTreeDirty = false;
+        stats.instanceTreeRebuilt = true;
+    }
+    uploadInstanceState(stats);
+    return stats;
+}
+
+// メッシュの BVH を作ってプールに置く. ノードの番号はプールのものに直す
+void Scene::buildMesh(Mesh& mesh, SceneCommitStats& stats) {
+    nodeRanges.free(mesh.nodeOffset, mesh.nodeCount);
+    triangleRanges.free(mesh.triangleOffset, mesh.triangleCount);
+    presplit(mesh.triangles, refs);
+    builder.rebuild(mesh.triangles, refs);
+    const std::vector<BVHNode>& nodes = builder.getNodes();
+    const std::vector<Data>& data = builder.getDataArray();
+    stats.trianglesBuilt += mesh.triangles.size();
+    ++stats.meshesBuilt;
+    std::vector<Data>().swap(mesh.triangles);
+
+    mesh.nodeCount = static_cast<int>(nodes.size());
+    mesh.triangleCount = static_cast<int>(data.size());
+    mesh.nodeOffset = nodeRanges.allocate(mesh.nodeCount);
+    mesh.triangleOffset = triangleRanges.allocate(mesh.triangleCount);
+    if (nodes.empty()) {
+        mesh.min = mesh.max = glm::vec3(0.0f);
+        return;
+    }
+    mesh.min = nodes[0].min;
+    mesh.max = nodes[0].max;
+
+    rebased.assign(nodes.begin(), nodes.end());
+    for (BVHNode& node : rebased) {
+        if (node.parent >= 0) node.parent += mesh.nodeOffset;
+        if (node.sibling >= 0) node.sibling += mesh.nodeOffset;
+        if (node.dataOffset >= 0) {
+            node.dataOffset += mesh.triangleOffset;
+        } else {
+            node.left += mesh.nodeOffset;
+            node.right += mesh.nodeOffset;
+        }
+    }
+    nodeBuffer.reserve(nodeRanges.getEnd() * sizeof(BVHNode));
+    triangleBuffer.reserve(triangleRanges.getEnd() * sizeof(Data));
+    nodeBuffer.upload(mesh.nodeOffset * sizeof(BVHNode), rebased.size() * sizeof(BVHNode), rebased.data());
+    triangleBuffer.upload(mesh.triangleOffset * sizeof(Data), data.size() * sizeof(Data), data.data());
+    stats.bytesUploaded += rebased.size() * sizeof(BVHNode) + data.size() * sizeof(Data);
+}
+
+// ワールドの境界はメッシュの境界の 8 つの角を移して囲む
+void Scene::updateInstance(int index, SceneCommitStats& stats) {
+    Instance& instance = instances[index];
+    const Mesh& mesh = meshes[instance.mesh];
+    instance.min = glm::vec3(std::numeric_limits<float>::max());
+    instance.max = glm::vec3(std::numeric_limits<float>::lowest());
+    for (int corner = 0; corner < 8; ++corner) {
+        glm::vec3 p((corner & 1) ? mesh.max.x : mesh.min.x,
+                    (corner & 2) ? mesh.max.y : mesh.min.y,
+                    (corner & 4) ? mesh.max.z : mesh.min.z);
+        glm::vec3 world = glm::vec3(instance.objectToWorld * glm::vec4(p, 1.0f));
+        instance.min = glm::min(instance.min, world);
+        instance.max = glm::max(instance.max, world);
+    }
+
+    GpuInstance& gpu = gpuInstances[index];
+    gpu.worldToObject = glm::inverse(instance.objectToWorld);
+    gpu.root = mesh.nodeCount > 0 ? mesh.nodeOffset : -1;
+    gpu.mesh = instance.mesh;
+    gpu.padding[0] = gpu.padding[1] = 0;
+    markRange(dirtyInstanceBegin, dirtyInstanceEnd, index);
+
+    if (!instanceTreeDirty && instance.leaf >= 0) refitInstanceTree(index);
+    instance.dirty = false;
+    ++stats.instancesUpdated;
+}
+
+// インスタンスの重心の最長軸の中央値で分ける. 葉はインスタンス 1 つ (data.z がその番号)
+void Scene::buildInstanceTree() {
+    instanceNodes.clear();
+    instanceOrder.clear();
+    for (size_t i = 0; i < instances.size(); ++i) {
+        instances[i].leaf = -1;
+        if (instances[i].alive) instanceOrder.push_back(static_cast<int>(i));
+    }
+    if (instanceOrder.empty()) {
+        // 空の木も葉を 1 つ置く. 中のインスタンスは 0 個
+        BVHNode empty;
+        empty.min = empty.max = glm::vec3(0.0f);
+        empty.parent = empty.sibling = -1;
+        empty.data = glm::ivec4(-1, -1, 0, 0);
+        instanceNodes.push_back(empty);
+    } else {
+        buildInstanceNode(0, static_cast<int>(instanceOrder.size()), -1);
+    }
+    markRange(dirtyNodeBegin, dirtyNodeEnd, 0);
+    markRange(dirtyNodeBegin, dirtyNodeEnd, static_cast<int>(instanceNodes.size()) - 1);
+}
+
+int Scene::buildInstanceNode(int start, int end, int parent) {
+    int index = static_cast<int>(instanceNodes.size());
+    instanceNodes.push_back(BVHNode());
+    BVHNode node;
+    node.parent = parent;
+    node.sibling = -1;
+    node.min = glm::vec3(std::numeric_limits<float>::max());
+    node.max = glm::vec3(std::numeric_limits<float>::lowest());
+    glm::vec3 centroidMin = node.min;
+    glm::vec3 centroidMax = node.max;
+    for (int i = start; i < end; ++i) {
+        const Instance& instance = instances[instanceOrder[i]];
+        node.min = glm::min(node.min, instance.min);
+        node.max = glm::max(node.max, instance.max);
+        centroidMin = glm::min(centroidMin, (instance.min + instance.max) * 0.5f);
+        centroidMax = glm::max(centroidMax, (instance.min + instance.max) * 0.5f);
+    }
+
+    if (end - start == 1) {
+        node.data = glm::ivec4(-1, -1, instanceOrder[start], 1);
+        instances[instanceOrder[start]].leaf = index;
+        instanceNodes[index] = node;
+        return index;
+    }
+
+    glm::vec3 extent = centroidMax - centroidMin;
+    int axis = extent.y > extent.x ? 1 : 0;
+    if (extent.z > extent[axis]) axis = 2;
+    int mid = start + (end - start) / 2;
+    std::nth_element(instanceOrder.begin() + start, instanceOrder.begin() + mid, instanceOrder.begin() + end,
+                     [&](int a, int b) {
+                         return instances[a].min[axis] + instances[a].max[axis] <
+                                instances[b].min[axis] + instances[b].max[axis];
+                     });
+
+    int left = buildInstanceNode(start, mid, index);
+    int right = buildInstanceNode(mid, end, index);
+    instanceNodes[left].sibling = right;
+    instanceNodes[right].sibling = left;
+    node.data = glm::ivec4(left, right, -1, -1);
+    instanceNodes[index] = node;
+    return index;
+}
+
+// 動いたインスタンスの葉から根に向かって境界を直す. 境界が変わらなくなったらそこで止める
+void Scene::refitInstanceTree(int index) {
+    const Instance& instance = instances[index];
+    int node = instance.leaf;
+    instanceNodes[node].min = instance.min;
+    instanceNodes[node].max = instance.max;
+    markRange(dirtyNodeBegin, dirtyNodeEnd, node);
+    for (int parent = instanceNodes[node].parent; parent >= 0; parent = instanceNodes[parent].parent) {
+        BVHNode& p = instanceNodes[parent];
+        glm::vec3 min = glm::min(instanceNodes[p.left].min, instanceNodes[p.right].min);
+        glm::vec3 max = glm::max(instanceNodes[p.left].max, instanceNodes[p.right].max);
+        if (min == p.min && max == p.max) break;
+        p.min = min;
+        p.max = max;
+        markRange(dirtyNodeBegin, dirtyNodeEnd, parent);
+    }
+}
+
+// 変わった範囲だけを上げる. 空でもカーネルが読めるように 1 要素分は確保する
+void Scene::uploadInstanceState(SceneCommitStats& stats) {
+    nodeBuffer.reserve(sizeof(BVHNode));
+    triangleBuffer.reserve(sizeof(Data));
+    instanceNodeBuffer.reserve(instanceNodes.size() * sizeof(BVHNode));
+    instanceBuffer.reserve(std::max<size_t>(gpuInstances.size(), 1) * sizeof(GpuInstance));
+    lightBuffer.reserve(std::max<size_t>(lights.size(), 1) * sizeof(Light));
+
+    dirtyNodeEnd = std::min(dirtyNodeEnd, static_cast<int>(instanceNodes.size()));
+    if (dirtyNodeBegin < dirtyNodeEnd) {
+        size_t bytes = (dirtyNodeEnd - dirtyNodeBegin) * sizeof(BVHNode);
+        instanceNodeBuffer.upload(dirtyNodeBegin * sizeof(BVHNode), bytes, &instanceNodes[dirtyNodeBegin]);
+        stats.bytesUploaded += bytes;
+    }
+    dirtyInstanceEnd = std::min(dirtyInstanceEnd, static_cast<int>(gpuInstances.size()));
+    if (dirtyInstanceBegin < dirtyInstanceEnd) {
+        size_t bytes = (dirtyInstanceEnd - dirtyInstanceBegin) * sizeof(GpuInstance);
+        instanceBuffer.upload(dirtyInstanceBegin * sizeof(GpuInstance), bytes, &gpuInstances[dirtyInstanceBegin]);
+        stats.bytesUploaded += bytes;
+    }
+    dirtyLightEnd = std::min(dirtyLightEnd, static_cast<int>(lights.size()));
+    if (dirtyLightBegin < dirtyLightEnd) {
+        size_t bytes = (dirtyLightEnd - dirtyLightBegin) * sizeof(Light);
+        lightBuffer.upload(dirtyLightBegin * sizeof(Light), bytes, &lights[dirtyLightBegin]);
+        stats.bytesUploaded += bytes;
+    }
+    clearRange(dirtyNodeBegin, dirtyNodeEnd);
+    clearRange(dirtyInstanceBegin, dirtyInstanceEnd);
+    clearRange(dirtyLightBegin, dirtyLightEnd);
+}
+
+void Scene::bind() const {
+    triangleBuffer.bind();
+    nodeBuffer.bind();
+    lightBuffer.bind();
+    instanceNodeBuffer.bind();
+    instanceBuffer.bind();
+}
+
+void Scene::cleanup() {
+    triangleBuffer.cleanup();
+    nodeBuffer.cleanup();
+    lightBuffer.cleanup();
+    instanceNodeBuffer.cleanup();
+    instanceBuffer.cleanup();
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include "bvh.h"
+#include "util.h"
+
+// 編集の後で返すハンドル. 消した後のハンドルは使わない (番号は次に追加したものに使い回される)
+struct MeshHandle {
+    int index;
+};
+
+struct InstanceHandle {
+    int index;
+};
+
+struct LightHandle {
+    int index;
+};
+
+// compute_raytracing_1.glsl の Instance (std430, binding 23). 80 bytes
+struct GpuInstance {
+    glm::mat4 worldToObject;    // レイを物体の座標に移す. t は変わらないので当たった点はワールドのレイで求める
+    GLint root;                 // メッシュの BVH の根 (ノードのプールでの番号)
+    GLint mesh;
+    GLint padding[2];
+};
+
+// 1 回の commit でしたこと
+struct SceneCommitStats {
+    int meshesBuilt;
+    size_t trianglesBuilt;
+    int instancesUpdated;
+    bool instanceTreeRebuilt;   // false なら動いたインスタンスの葉から根までを直しただけ
+    size_t bytesUploaded;
+
+    SceneCommitStats()
+        : meshesBuilt(0), trianglesBuilt(0), instancesUpdated(0), instanceTreeRebuilt(false), bytesUploaded(0) {}
+};
+
+// 大きさの変わる SSBO. 足りなくなったら倍にして, 中身は GPU の上で写す
+class SceneBuffer {
+public:
+    explicit SceneBuffer(GLuint binding);
+
+    void reserve(size_t bytes);
+    void upload(size_t offset, size_t bytes, const void* data);
+    void bind() const;
+    void cleanup();
+
+    size_t getCapacity() const { return capacity; }
+
+private:
+    GLuint binding;
+    GLuint buffer;
+    size_t capacity;
+};
+
+// プールの中の範囲を配る. 空いた範囲は隣とまとめ, 最初に入るところに置く
+class RangeAllocator {
+public:
+    RangeAllocator() : end(0) {}
+
+    int allocate(int count);
+    void free(int offset, int count);
+    int getEnd() const { return end; }     // これまでに使った範囲の終わり
+
+private:
+    std::map<int, int> freeRanges;          // 始まり -> 長さ
+    int end;
+};
+
+// メッシュ (物体の座標の三角形と BVH), それを置くインスタンス, 点光源を少しずつ編集するシーン.
+// 編集は CPU の状態を変えるだけで, フレームに一度の commit でまとめて反映する:
+//   - 追加か更新されたメッシュだけ BVH を作り, ノードと三角形のプールのその範囲だけを上げる
+//   - インスタンスを足すか消したときはインスタンスの木 (TLAS) を作り直し, 動かしただけなら葉から根までを直す
+//   - インスタンス, 木のノード, 光源は変わった範囲だけ glBufferSubData で上げる
+// compute_raytracing_1.glsl を INSTANCES 付きでコンパイルし, bind() してからトレースする
+class Scene {
+public:
+    // カーネルの SSBO の binding. ノードと三角形のプールと光源は BVH と同じ 1, 0, 2 に置く
+    static const GLuint INSTANCE_NODE_BINDING = 22;
+    static const GLuint INSTANCE_BINDING = 23;
+
+    Scene();
+
+    MeshHandle addMesh(const std::vector<Data>& triangles);
+    // 三角形を入れ替えて, このメッシュの BVH だけを作り直す. 置いているインスタンスも付いてくる
+    void updateMesh(MeshHandle mesh, const std::vector<Data>& triangles);
+    // インスタンスが残っていれば消さずに false
+    bool removeMesh(MeshHandle mesh);
+
+    InstanceHandle addInstance(MeshHandle mesh, const glm::mat4& objectToWorld);
+    void setTransform(InstanceHandle instance, const glm::mat4& objectToWorld);
+    // インスタンスに別のメッシュを置く (詳細度の段の切り替えなど). 木は作り直さず葉から根までを直す
+    void setMesh(InstanceHandle instance, MeshHandle mesh);
+    void removeInstance(InstanceHandle instance);
+
+    LightHandle addLight(const Light& light);
+    void setLight(LightHandle light, const Light& value);
+    void removeLight(LightHandle light);
+
+    // 溜めた編集を反映して GPU に上げる. トレースの前に呼ぶ
+    SceneCommitStats commit();
+    void bind() const;
+    void cleanup();
+
+    int getMeshCount() const { return liveMeshes; }
+    int getInstanceCount() const { return liveInstances; }
+    int getLightCount() const { return static_cast<int>(lights.size()); }
+
+    // 確認用. commit の後の CPU の写し
+    const std::vector<BVHNode>& getInstanceNodes() const { return instanceNodes; }
+    const std::vector<GpuInstance>& getInstances() const { return gpuInstances; }
+
+private:
+    struct Mesh {
+        bool alive;
+        bool dirty;                     // commit で BVH を作る
+        std::vector<Data> triangles;    // commit までの入力. 作った後は捨てる
+        glm::vec3 min;
+        glm::vec3 max;
+        int nodeOffset;
+        int nodeCount;
+        int triangleOffset;
+        int triangleCount;
+        int instanceCount;
+    };
+
+    struct Instance {
+        bool alive;
+        bool dirty;                     // commit で境界と GPU の値を直す
+        int mesh;
+        glm::mat4 objectToWorld;
+        glm::vec3 min;
+        glm::vec3 max;
+        int leaf;                       // インスタンスの木の葉. 木を作り直すまで -1
+    };
+
+    void buildMesh(Mesh& mesh, SceneCommitStats& stats);
+    void updateInstance(int index, SceneCommitStats& stats);
+    void buildInstanceTree();
+    int buildInstanceNode(int start, int end, int parent);
+    void refitInstanceTree(int index);
+    void markInstanceNode(int node);
+    void uploadInstanceState(SceneCommitStats& stats);
+
+    std::vector<Mesh> meshes;
+    std::vector<int> freeMeshes;
+    std::vector<Instance> instances;
+    std::vector<int> freeInstances;
+    int liveMeshes;
+    int liveInstances;
+    bool instanceTreeDirty;
+
+    // 光源は詰めて並べる. ハンドルから並びの位置へ
+    std::vector<Light> lights;
+    std::vector<int> lightSlot;         // ハンドル -> 位置 (消したものは -1)
+    std::vector<int> lightHandle;       // 位置 -> ハンドル
+    std::vector<int> freeLights;
+
+    // 作り直すたびにノードの配列と作業用の配列を使い回す
+    BVH builder;
+    std::vector<PrimRef> refs;          // presplit の出力
+    std::vector<BVHNode> rebased;
+    RangeAllocator nodeRanges;
+    RangeAllocator triangleRanges;
+
+    std::vector<BVHNode> instanceNodes;
+    std::vector<int> instanceOrder;     // 木を作るときに並べ替えるインスタンスの番号
+    std::vector<GpuInstance> gpuInstances;
+    // 変わった要素の範囲 [begin, end). 空なら begin >= end
+    int dirtyNodeBegin, dirtyNodeEnd;
+    int dirtyInstanceBegin, dirtyInstanceEnd;
+    int dirtyLightBegin, dirtyLightEnd;
+
+    SceneBuffer triangleBuffer;
+    SceneBuffer nodeBuffer;
+    SceneBuffer lightBuffer;
+    SceneBuffer instanceNodeBuffer;
+    SceneBuffer instanceBuffer;
+};
@@ -1,14 +1,17 @@
 #include "shader.h"
 
-Shader::Shader(const char* vertexPath, const char* fragmentPath) {
+Shader::Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath) {
     // シェーダーのコードを読み込む
     std::string vertexCode;
     std::string fragmentCode;
+    std::string geometryCode;
     std::ifstream vShaderFile;
     std::ifstream fShaderFile;
+    std::ifstream gShaderFile;
 
     vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
     fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+    gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
 
     try {
         // ファイルを開く
@@ -27,6 +30,14 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath) {
         // ファイルを閉じる
         vShaderFile.close();
         fShaderFile.close();
+
+        if (geometryPath) {
+            gShaderFile.open(geometryPath);
+            std::stringstream gShaderStream;
+            gShaderStream << gShaderFile.rdbuf();
+            geometryCode = gShaderStream.str();
+            gShaderFile.close();
+        }
     } catch (std::ifstream::failure e) {
         std::cerr << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
     }
@@ -49,16 +60,29 @@ Shader::Shader(const char* vertexPath, const char* fragmentPath) {
     glCompileShader(fragment);
     checkCompileErrors(fragment, "FRAGMENT");
 
+    // ジオメトリシェーダー
+    GLuint geometry = 0;
+    if (geometryPath) {
+        const char* gShaderCode = geometryCode.c_str();
+        geometry = glCreateShader(GL_GEOMETRY_SHADER);
+        glShaderSource(geometry, 1, &gShaderCode, nullptr);
+        glCompileShader(geometry);
+        checkCompileErrors(geometry, "GEOMETRY");
+    }
+
     // シェーダープログラムをリンクする
     ID = glCreateProgram();
     glAttachShader(ID, vertex);
     glAttachShader(ID, fragment);
+    if (geometry) glAttachShader(ID, geometry);
     glLinkProgram(ID);
     checkCompileErrors(ID, "PROGRAM");
+    reflection.reflect(ID);
 
     // シェーダーを削除する
     glDeleteShader(vertex);
     glDeleteShader(fragment);
+    if (geometry) glDeleteShader(geometry);
 }
 
 void Shader::use() {
@@ -66,29 +90,49 @@ void Shader::use() {
 }
 
 void Shader::setBool(const std::string &name, bool value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
+    glUniform1i(reflection.uniformLocation(name), (int)value);
 }
 
 void Shader::setInt(const std::string &name, int value) const {
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1i(reflection.uniformLocation(name), value);
 }
 
 void Shader::setFloat(const std::string &name, float value) const {
-    glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+    glUniform1f(reflection.uniformLocation(name), value);
 }
 
 void Shader::setMat4(const std::string &name, const glm::mat4 &mat) const {
-    glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+    glUniformMatrix4fv(reflection.uniformLocation(name), 1, GL_FALSE, &mat[0][0]);
 }
 
 void Shader::setVec3(const std::string &name, const glm::vec3 &value) const {
-    glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
+    glUniform3fv(reflection.uniformLocation(name), 1, &value[0]);
 }
 
 void Shader::setTexture(const std::string &name, int unit, GLuint texture) {
     glActiveTexture(GL_TEXTURE0 + unit);
     glBindTexture(GL_TEXTURE_2D, texture);
-    glUniform1i(glGetUniformLocation(ID, name.c_str()), unit);
+    glUniform1i(reflection.uniformLocation(name), unit);
+}
+
+GLint Shader::getUniformLocation(const std::string &name) const {
+    return reflection.uniformLocation(name);
+}
+
+void Shader::setBool(GLint location, bool value) const {
+    glUniform1i(location, (int)value);
+}
+
+void Shader::setInt(GLint location, int value) const {
+    glUniform1i(location, value);
+}
+
+void Shader::setFloat(GLint location, float value) const {
+    glUniform1f(location, value);
+}
+
+void Shader::setVec3(GLint location, const glm::vec3 &value) const {
+    glUniform3fv(location, 1, &value[0]);
 }
 
 void Shader::checkCompileErrors(GLuint shader, std::string type) {
@@ -7,12 +7,14 @@
 #include <sstream>
 #include <iostream>
 #include <glm/glm.hpp>
+#include "reflection.h"
 
 class Shader {
 public:
     GLuint ID;
 
-    Shader(const char* vertexPath, const char* fragmentPath);
+    // geometryPath は省略できる (VisibilityBuffer が三角形ごとの重心座標を作るのに使う)
+    Shader(const char* vertexPath, const char* fragmentPath, const char* geometryPath = nullptr);
     void use();
     void setBool(const std::string &name, bool value) const;
     void setInt(const std::string &name, int value) const;
@@ -21,7 +23,17 @@ public:
     void setVec3(const std::string &name, const glm::vec3 &value) const;
     void setTexture(const std::string &name, int unit, GLuint texture);
 
+    // location はリンク時に読んだものを返す. 毎フレームの更新には location を保持して下の版を使う
+    GLint getUniformLocation(const std::string &name) const;
+    const ProgramReflection& getReflection() const { return reflection; }
+    void setBool(GLint location, bool value) const;
+    void setInt(GLint location, int value) const;
+    void setFloat(GLint location, float value) const;
+    void setVec3(GLint location, const glm::vec3 &value) const;
+
 private:
+    ProgramReflection reflection;
+
     void checkCompileErrors(GLuint shader, std::string type);
 };
 
@@ -0,0 +1,213 @@
+#version 460 core
+layout(local_size_x = 16, local_size_y = 16) in;
+
+// Edge-avoiding a-trous wavelet filter, the spatial part of SVGF (Denoiser in denoiser.cpp), and its
+// temporal part: the previous frames' accumulated colour reprojected through the motion buffer.
+// Same computation as atrousFilter in atrous.cpp and TemporalAccumulator in temporal.cpp.
+// Denoiser injects the defines below after #version:
+//   TEMPORAL_PASS   first pass: blends this frame into the reprojected history instead of estimating the variance
+//   FINAL_PASS      last iteration: multiplies the albedo back in and writes the render target
+//   OUTPUT_FORMAT   image format qualifier of filterOutput, rgba16f between the iterations
+//   ENCODE_OUTPUT   1 stores tonemapped sRGB values for the display formats (as compute_raytracing_1.glsl)
+#ifndef OUTPUT_FORMAT
+#define OUTPUT_FORMAT rgba16f
+#endif
+#ifndef ENCODE_OUTPUT
+#define ENCODE_OUTPUT 0
+#endif
+
+// Must match AtrousOptions (atrous.h)
+const float COLOR_PHI = 3.0;    // allowed luminance difference in standard deviations
+const float NORMAL_PHI = 128.0; // exponent of dot(n, nq)
+const float DEPTH_PHI = 0.005;  // allowed distance difference per pixel, relative to the distance
+
+// stepSize 0: the traced image, otherwise rgb: colour divided by the albedo, a: luminance variance
+layout(binding = 0) uniform sampler2D filterInput;
+// Written by compute_raytracing_1.glsl with GBUFFER. xyz: normal, w: hit distance (negative for a miss)
+layout(binding = 1) uniform sampler2D gNormalDepth;
+layout(binding = 2) uniform sampler2D gAlbedo;
+
+layout(OUTPUT_FORMAT, binding = 0) writeonly uniform image2D filterOutput;
+
+layout(location = 0) uniform int stepSize;      // 2^iteration, 0: variance estimate (FINAL_PASS: no filtering)
+layout(location = 1) uniform ivec2 renderSize;  // filtered region, taps outside it are skipped
+
+#ifdef TEMPORAL_PASS
+// Must match TemporalAccumulator (temporal.cpp)
+const float MAX_HISTORY = 32.0;     // the blend weight of a new frame never drops below 1 / MAX_HISTORY
+const float DEPTH_TOLERANCE = 0.05; // relative distance difference that still counts as the same surface
+const float NORMAL_TOLERANCE = 0.9; // minimum cosine between the current and previous normal
+
+// xy: offset to the previous pixel, z: distance from the previous camera, w: 1 when valid
+layout(binding = 3) uniform sampler2D gMotion;
+// Previous frame: its G-buffer, accumulated colour (a: history length) and luminance moments
+layout(binding = 4) uniform sampler2D previousNormalDepth;
+layout(binding = 5) uniform sampler2D historyColor;
+layout(binding = 6) uniform sampler2D historyMoments;
+
+layout(rgba16f, binding = 1) writeonly uniform image2D historyColorOut;
+layout(rg16f, binding = 2) writeonly uniform image2D historyMomentsOut;
+
+layout(location = 2) uniform bool historyValid; // false after a resize or when the history was not written
+#endif
+
+#if ENCODE_OUTPUT
+// Same curve as compute_raytracing_1.glsl: ACES fit, then the sRGB transfer function
+vec3 encodeOutput(vec3 color) {
+    vec3 x = max(color, vec3(0.0));
+    vec3 mapped = clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+    return mix(12.92 * mapped, 1.055 * pow(mapped, vec3(1.0 / 2.4)) - 0.055, greaterThan(mapped, vec3(0.0031308)));
+}
+#else
+vec3 encodeOutput(vec3 color) {
+    return color;
+}
+#endif
+
+float luminance(vec3 color) {
+    return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+bool inside(ivec2 pixel) {
+    return all(greaterThanEqual(pixel, ivec2(0))) && all(lessThan(pixel, renderSize));
+}
+
+vec3 demodulated(ivec2 pixel) {
+    return texelFetch(filterInput, pixel, 0).rgb / max(texelFetch(gAlbedo, pixel, 0).rgb, vec3(1e-3));
+}
+
+// Demodulated colour and the luminance variance of the 3x3 neighbourhood
+vec4 prepare(ivec2 pixel) {
+    float sum = 0.0;
+    float sumSquared = 0.0;
+    int count = 0;
+    for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+            ivec2 q = pixel + ivec2(dx, dy);
+            if (!inside(q) || texelFetch(gNormalDepth, q, 0).w < 0.0) continue;
+            float l = luminance(demodulated(q));
+            sum += l;
+            sumSquared += l * l;
+            ++count;
+        }
+    }
+    float mean = count > 0 ? sum / float(count) : 0.0;
+    float variance = count > 0 ? max(sumSquared / float(count) - mean * mean, 0.0) : 0.0;
+    return vec4(demodulated(pixel), variance);
+}
+
+#ifdef TEMPORAL_PASS
+// Bilinear reprojection of the history. Taps whose distance or normal differ were occluded in the previous
+// frame (disocclusion) and are dropped; without any valid tap the history starts over
+vec4 temporal(ivec2 pixel) {
+    vec3 color = demodulated(pixel);
+    float l = luminance(color);
+    vec4 center = texelFetch(gNormalDepth, pixel, 0);
+    vec4 motion = texelFetch(gMotion, pixel, 0);
+
+    vec3 history = vec3(0.0);
+    vec2 moments = vec2(0.0);
+    float historyLength = 0.0;
+    float weightSum = 0.0;
+    if (historyValid && center.w >= 0.0 && motion.w > 0.0) {
+        vec2 position = vec2(pixel) + motion.xy;
+        ivec2 base = ivec2(floor(position));
+        vec2 f = position - vec2(base);
+        for (int i = 0; i < 4; ++i) {
+            ivec2 offset = ivec2(i & 1, i >> 1);
+            ivec2 q = base + offset;
+            if (!inside(q)) continue;
+            vec4 previous = texelFetch(previousNormalDepth, q, 0);
+            if (previous.w < 0.0 || abs(previous.w - motion.z) > DEPTH_TOLERANCE * motion.z ||
+                dot(previous.xyz, center.xyz) < NORMAL_TOLERANCE) continue;
+            float w = (offset.x == 1 ? f.x : 1.0 - f.x) * (offset.y == 1 ? f.y : 1.0 - f.y);
+            vec4 h = texelFetch(historyColor, q, 0);
+            history += w * h.rgb;
+            historyLength += w * h.a;
+            moments += w * texelFetch(historyMoments, q, 0).rg;
+            weightSum += w;
+        }
+    }
+    if (weightSum > 1e-3) {
+        history /= weightSum;
+        moments /= weightSum;
+        historyLength /= weightSum;
+    } else {
+        historyLength = 0.0;
+    }
+
+    historyLength = min(historyLength + 1.0, MAX_HISTORY);
+    float alpha = 1.0 / historyLength;
+    vec3 accumulated = mix(history, color, alpha);
+    moments = mix(moments, vec2(l, l * l), alpha);
+    imageStore(historyColorOut, pixel, vec4(accumulated, historyLength));
+    imageStore(historyMomentsOut, pixel, vec4(moments, 0.0, 0.0));
+
+    // The temporal variance needs a few frames, until then the spatial estimate stands in
+    float variance = historyLength >= 4.0 ? max(moments.y - moments.x * moments.x, 0.0) : prepare(pixel).a;
+    return vec4(accumulated, variance);
+}
+#endif
+
+// One iteration: 5x5 B3-spline taps stepSize pixels apart, stopped at normal, distance and luminance edges
+vec4 filterPixel(ivec2 pixel) {
+    const float kernel[3] = float[3](3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0);
+    vec4 centerColor = texelFetch(filterInput, pixel, 0);
+    vec4 center = texelFetch(gNormalDepth, pixel, 0);
+    if (center.w < 0.0) return centerColor; // background passes through
+
+    // The variance is blurred over 3x3 before use
+    float variance = 0.0;
+    float varianceWeight = 0.0;
+    for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+            ivec2 q = pixel + ivec2(dx, dy);
+            if (!inside(q)) continue;
+            float w = (dx == 0 ? 0.5 : 0.25) * (dy == 0 ? 0.5 : 0.25);
+            variance += w * texelFetch(filterInput, q, 0).a;
+            varianceWeight += w;
+        }
+    }
+    float phiColor = COLOR_PHI * sqrt(max(variance / varianceWeight, 0.0)) + 1e-4;
+    float centerLuminance = luminance(centerColor.rgb);
+
+    vec3 sum = vec3(0.0);
+    float sumVariance = 0.0;
+    float sumWeight = 0.0;
+    for (int dy = -2; dy <= 2; ++dy) {
+        for (int dx = -2; dx <= 2; ++dx) {
+            ivec2 q = pixel + ivec2(dx, dy) * stepSize;
+            if (!inside(q)) continue;
+            vec4 tap = texelFetch(gNormalDepth, q, 0);
+            if (tap.w < 0.0) continue;
+            vec4 color = texelFetch(filterInput, q, 0);
+
+            float depthScale = DEPTH_PHI * center.w * float(stepSize) * length(vec2(dx, dy)) + 1e-6;
+            float depthTerm = abs(center.w - tap.w) / depthScale;
+            float colorTerm = abs(centerLuminance - luminance(color.rgb)) / phiColor;
+            float normalWeight = pow(max(dot(center.xyz, tap.xyz), 0.0), NORMAL_PHI);
+            float w = kernel[abs(dx)] * kernel[abs(dy)] * normalWeight * exp(-depthTerm - colorTerm);
+
+            sum += w * color.rgb;
+            sumVariance += w * w * color.a;
+            sumWeight += w;
+        }
+    }
+    // the centre always contributes kernel[0]^2
+    return vec4(sum / sumWeight, sumVariance / (sumWeight * sumWeight));
+}
+
+void main() {
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (!inside(pixel)) return;
+
+#if defined(FINAL_PASS)
+    vec4 filtered = stepSize == 0 ? texelFetch(filterInput, pixel, 0) : filterPixel(pixel);
+    vec3 color = filtered.rgb * max(texelFetch(gAlbedo, pixel, 0).rgb, vec3(1e-3));
+    imageStore(filterOutput, pixel, vec4(encodeOutput(color), 1.0));
+#elif defined(TEMPORAL_PASS)
+    imageStore(filterOutput, pixel, temporal(pixel));
+#else
+    imageStore(filterOutput, pixel, stepSize == 0 ? prepare(pixel) : filterPixel(pixel));
+#endif
+}
@@ -1,5 +1,70 @@
 #version 460 core
-layout(local_size_x = 16, local_size_y = 16) in;
+// Master ray tracing kernel. ShaderVariant (shader_variant.h) injects the defines below after
+// #version, each variant only keeps the code it uses. Defaults match the plain stack kernel.
+//   LOCAL_SIZE_X, LOCAL_SIZE_Y  workgroup shape
+//   MORTON_SWIZZLE, TILE_X/Y    single-pass kernel: a workgroup covers a TILE_X x TILE_Y tile in Morton order
+//   MAX_BOUNCES                 bounces of the single-pass kernel
+//   PATH_TRACE                  1: cosine-weighted diffuse bounces with Russian roulette, 0: mirror bounces
+//   LIGHT_SAMPLES               > 0: shade that many lights per hit picked through the light BVH, 0: every light
+//   TRAVERSAL_KIND              TRAVERSAL_STACK, TRAVERSAL_STACKLESS or TRAVERSAL_BRUTE_FORCE
+//   SHADOWS                     0 skips the shadow rays
+//   TRAVERSAL_STATS             per-pixel traversal counters
+//   WAVEFRONT                   one bounce per dispatch (Wavefront in wavefront.cpp)
+//   OUTPUT_FORMAT               image format qualifier of imgOutput (OutputFormat in util.h)
+//   ENCODE_OUTPUT               1 stores tonemapped sRGB values for the display formats, 0 stores linear HDR
+//   GBUFFER                     also stores the first hit's normal, distance, albedo and motion for the denoiser
+//   VISIBILITY_BUFFER           reads the first hit from the rasterized visibility buffer instead of tracing it
+//   STREAMING                   traces the resident cluster pages of GeometryStreamer through its top-level tree
+//   INSTANCES                   traces the instances of Scene through its instance tree, each in its mesh's BVH
+#ifndef LOCAL_SIZE_X
+#define LOCAL_SIZE_X 16
+#endif
+#ifndef LOCAL_SIZE_Y
+#define LOCAL_SIZE_Y 16
+#endif
+#ifndef MORTON_SWIZZLE
+#define MORTON_SWIZZLE 0
+#endif
+#ifndef MAX_BOUNCES
+#define MAX_BOUNCES 1
+#endif
+#ifndef SHADOWS
+#define SHADOWS 1
+#endif
+#ifndef PATH_TRACE
+#define PATH_TRACE 0
+#endif
+#ifndef LIGHT_SAMPLES
+#define LIGHT_SAMPLES 0
+#endif
+#ifndef OUTPUT_FORMAT
+#define OUTPUT_FORMAT rgba32f
+#endif
+#ifndef ENCODE_OUTPUT
+#define ENCODE_OUTPUT 0
+#endif
+
+#define TRAVERSAL_STACK 0
+#define TRAVERSAL_STACKLESS 1
+#define TRAVERSAL_BRUTE_FORCE 2
+#ifndef TRAVERSAL_KIND
+#define TRAVERSAL_KIND TRAVERSAL_STACK
+#endif
+
+#if defined(WAVEFRONT) && LOCAL_SIZE_X * LOCAL_SIZE_Y != 256
+#error WAVEFRONT needs 256 invocations per workgroup, ray_sort.glsl builds the indirect dispatch for it
+#endif
+#if defined(STREAMING) && TRAVERSAL_KIND == TRAVERSAL_BRUTE_FORCE
+#error STREAMING walks cluster BVHs and cannot use TRAVERSAL_BRUTE_FORCE
+#endif
+#if defined(INSTANCES) && (defined(STREAMING) || TRAVERSAL_KIND == TRAVERSAL_BRUTE_FORCE)
+#error INSTANCES walks mesh BVHs and cannot be combined with STREAMING or TRAVERSAL_BRUTE_FORCE
+#endif
+#if defined(WAVEFRONT) && ENCODE_OUTPUT
+#error WAVEFRONT accumulates bounces in imgOutput and needs a linear format
+#endif
+
+layout(local_size_x = LOCAL_SIZE_X, local_size_y = LOCAL_SIZE_Y) in;
 
 struct Data {
     vec4 v0;
@@ -8,8 +73,10 @@ struct Data {
 };
 
 struct BVHNode {
-    vec4 min;
-    vec4 max;
+    vec3 min;
+    int parent;
+    vec3 max;
+    int sibling;
     ivec4 data; // x: left, y: right, z: dataOffset, w: dataCount
 };
 
@@ -30,19 +97,85 @@ layout(std430, binding = 2) buffer Lights {
     Light lights[];
 };
 
-layout(rgba32f, binding = 0) uniform image2D imgOutput;
+layout(OUTPUT_FORMAT, binding = 0) uniform image2D imgOutput;
 
-uniform vec3 cameraPosition;
-uniform vec3 cameraFront;
-uniform vec3 cameraUp;
-uniform vec3 cameraRight;
-uniform float aspectRatio;
-uniform float fov;
-uniform int numLights;
+#if ENCODE_OUTPUT
+// Same curve as simple_fragment.glsl and encodeChannel in util.cpp: ACES fit, then the sRGB transfer function
+vec3 encodeOutput(vec3 color) {
+    vec3 x = max(color, vec3(0.0));
+    vec3 mapped = clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+    return mix(12.92 * mapped, 1.055 * pow(mapped, vec3(1.0 / 2.4)) - 0.055, greaterThan(mapped, vec3(0.0031308)));
+}
+#else
+vec3 encodeOutput(vec3 color) {
+    return color;
+}
+#endif
+
+// Per-frame state, written once per frame through UniformRing (FrameUniforms in util.h)
+layout(std140, binding = 0) uniform FrameUniforms {
+    vec3 cameraPosition;
+    float aspectRatio;
+    vec3 cameraFront;
+    float fov;
+    vec3 cameraUp;
+    int numLights;
+    vec3 cameraRight;
+    uint frameIndex;
+    ivec2 renderSize; // traced region of imgOutput, smaller than the image under dynamic resolution
+    mat4 previousViewProjection; // camera of the previous frame, for the motion buffer
+    vec3 previousCameraPosition;
+};
+
+#ifdef GBUFFER
+// Guide images of the denoiser (Denoiser in denoiser.cpp, atrous.glsl)
+layout(rgba16f, binding = 1) writeonly uniform image2D gNormalDepth;
+layout(rgba8, binding = 2) writeonly uniform image2D gAlbedo;
+layout(rgba32f, binding = 3) writeonly uniform image2D gMotion;
+
+// gNormalDepth xyz: normal facing the camera, w: hit distance (negative for a miss). Direct lighting is not
+// scaled by a surface colour yet, so the albedo is white; textured materials would store their base colour here.
+// gMotion xy: offset to the pixel the hit point had in the previous frame, z: its distance from the previous
+// camera, w: 1 when it was in front of the previous camera
+void writeGBuffer(ivec2 pixel, bool hit, vec3 dir, vec3 hitPoint, vec3 normal, float t) {
+    vec3 facing = dot(normal, dir) > 0.0 ? -normal : normal;
+    imageStore(gNormalDepth, pixel, hit ? vec4(facing, t) : vec4(0.0, 0.0, 0.0, -1.0));
+    imageStore(gAlbedo, pixel, vec4(1.0));
+
+    vec4 clip = previousViewProjection * vec4(hitPoint, 1.0);
+    vec2 previousPixel = (clip.xy / clip.w * 0.5 + 0.5) * vec2(renderSize);
+    vec2 motion = previousPixel - vec2(pixel);
+    bool visible = hit && clip.w > 0.0;
+    imageStore(gMotion, pixel, visible ? vec4(motion, distance(hitPoint, previousCameraPosition), 1.0) : vec4(0.0));
+}
+#define GBUFFER_WRITE(x) x
+#else
+#define GBUFFER_WRITE(x)
+#endif
 
 const float BIAS = 0.001;
-const int MAX_BOUNCES = 1;
 const float INF = 1e30;
+const int STACK_SIZE = 64; // BVH_STACK_SIZE in bvh.h. The builder keeps depth below this
+
+// Traversal counters for the heatmap (TraversalHeatmap in heatmap.cpp), enabled with TRAVERSAL_STATS.
+// Without it STATS(...) expands to nothing, so the production variants carry no instrumentation
+#ifdef TRAVERSAL_STATS
+#define STATS(x) x
+
+layout(std430, binding = 8) buffer TraversalCounters {
+    uvec4 traversalCounters[]; // per pixel, x: nodes visited, y: AABB tests, z: triangle tests, w: max stack depth
+};
+
+uvec4 traversalStats = uvec4(0u); // all rays traced by this invocation
+
+// Each pixel is handled by one invocation per dispatch, so no atomics are needed
+void writeTraversalStats(int pixel) {
+    uvec4 counters = traversalCounters[pixel];
+    traversalCounters[pixel] = uvec4(counters.xyz + traversalStats.xyz, max(counters.w, traversalStats.w));
+}
+#else
+#define STATS(x)
+#endif
 
 vec3 rayDirection(float fov, float aspectRatio, vec2 uv) {
     float tanFov = tan(radians(fov) / 2.0);
@@ -59,6 +192,18 @@ bool intersectAABB(vec3 rayOrigin, vec3 rayDir, vec3 boxMin, vec3 boxMax) {
     return tNear <= tFar && tFar > 0;
 }
 
+// Also returns the distance where the ray enters the box, 0 from inside
+bool intersectAABB(vec3 rayOrigin, vec3 rayDir, vec3 boxMin, vec3 boxMax, out float tEnter) {
+    vec3 tMin = (boxMin - rayOrigin) / rayDir;
+    vec3 tMax = (boxMax - rayOrigin) / rayDir;
+    vec3 t1 = min(tMin, tMax);
+    vec3 t2 = max(tMin, tMax);
+    float tNear = max(max(t1.x, t1.y), t1.z);
+    float tFar = min(min(t2.x, t2.y), t2.z);
+    tEnter = max(tNear, 0.0);
+    return tNear <= tFar && tFar > 0;
+}
+
 bool intersectTriangle(vec3 origin, vec3 dir, Data triangle, out float t) {
     const float EPSILON = 0.0000001;
     vec3 edge1, edge2, h, s, q;
@@ -94,39 +239,438 @@ bool intersectTriangle(vec3 origin, vec3 dir, Data triangle, out float t) {
     return t > EPSILON;
 }
 
-bool traverseBVH(vec3 origin, vec3 dir, out vec3 hitPoint, out vec3 hitNormal, out float tMin) {
-    int stack[64];
-    int stackPtr = 0;
-    stack[stackPtr++] = 0;
+void intersectLeaf(BVHNode node, vec3 origin, vec3 dir, inout bool hit, inout vec3 hitPoint, inout vec3 hitNormal, inout float tMin) {
+    STATS(traversalStats.z += uint(node.data.w));
+    for (int i = 0; i < node.data.w; ++i) {
+        Data triangle = triangles[node.data.z + i];
+        float t;
+        if (intersectTriangle(origin, dir, triangle, t) && t < tMin) {
+            hit = true;
+            tMin = t;
+            hitPoint = origin + dir * t;
+            hitNormal = normalize(cross(triangle.v1.xyz - triangle.v0.xyz, triangle.v2.xyz - triangle.v0.xyz));
+        }
+    }
+}
 
+#if TRAVERSAL_KIND != TRAVERSAL_BRUTE_FORCE
+// Stackless traversal: walks the parent/sibling links emitted by the builder,
+// so no per-invocation stack is kept in private memory
+const int FROM_PARENT = 0;
+const int FROM_SIBLING = 1;
+const int FROM_CHILD = 2;
+
+void traverseStackless(int root, vec3 origin, vec3 dir, inout bool hit, inout vec3 hitPoint, inout vec3 hitNormal, inout float tMin) {
+    int current = root;
+    int state = FROM_PARENT;
+    STATS(int depth = 0); // no stack here, the depth in the tree is reported instead
+
+    while (true) {
+        if (state == FROM_CHILD) {
+            // Coming back up: the left child is always stored before its sibling
+            if (current == root) break;
+            int sibling = nodes[current].sibling;
+            if (sibling > current) {
+                current = sibling;
+                state = FROM_SIBLING;
+            } else {
+                current = nodes[current].parent;
+                STATS(--depth);
+            }
+            continue;
+        }
+
+        BVHNode node = nodes[current];
+        bool descend = false;
+        STATS(traversalStats.y++);
+        if (intersectAABB(origin, dir, node.min, node.max)) {
+            STATS(traversalStats.x++);
+            if (node.data.z >= 0) { // Leaf node
+                intersectLeaf(node, origin, dir, hit, hitPoint, hitNormal, tMin);
+            } else { // Internal node
+                current = node.data.x;
+                state = FROM_PARENT;
+                descend = true;
+                STATS(traversalStats.w = max(traversalStats.w, uint(++depth)));
+            }
+        }
+
+        if (!descend) {
+            if (current == root) break;
+            if (state == FROM_PARENT) {
+                current = node.sibling;
+                state = FROM_SIBLING;
+            } else {
+                current = node.parent;
+                state = FROM_CHILD;
+                STATS(--depth);
+            }
+        }
+    }
+}
+#endif
+
+#if TRAVERSAL_KIND == TRAVERSAL_STACKLESS
+void traverseNodes(int root, vec3 origin, vec3 dir, inout bool hit, inout vec3 hitPoint, inout vec3 hitNormal, inout float tMin) {
+    traverseStackless(root, origin, dir, hit, hitPoint, hitNormal, tMin);
+}
+#elif TRAVERSAL_KIND == TRAVERSAL_BRUTE_FORCE
+// Tests every triangle (what compute_without_bvh.glsl did), kept as a reference for the BVH kernels
+bool traverseBVH(vec3 origin, vec3 dir, out vec3 hitPoint, out vec3 hitNormal, out float tMin) {
     bool hit = false;
-    tMin = 1e30;  // 非常に大きな値で初期化
+    tMin = 1e30;
+
+    BVHNode all;
+    all.data = ivec4(-1, -1, 0, triangles.length());
+    intersectLeaf(all, origin, dir, hit, hitPoint, hitNormal, tMin);
+    return hit;
+}
+#else
+void traverseNodes(int root, vec3 origin, vec3 dir, inout bool hit, inout vec3 hitPoint, inout vec3 hitNormal, inout float tMin) {
+    int stack[STACK_SIZE];
+    int stackPtr = 0;
+    stack[stackPtr++] = root;
 
     while (stackPtr > 0) {
         int nodeIdx = stack[--stackPtr];
         BVHNode node = nodes[nodeIdx];
 
-        if (intersectAABB(origin, dir, node.min.xyz, node.max.xyz)) {
+        STATS(traversalStats.y++);
+        if (intersectAABB(origin, dir, node.min, node.max)) {
+            STATS(traversalStats.x++);
             if (node.data.z >= 0) { // Leaf node
-                for (int i = 0; i < node.data.w; ++i) {
-                    Data triangle = triangles[node.data.z + i];
-                    float t;
-                    if (intersectTriangle(origin, dir, triangle, t) && t < tMin) {
-                        hit = true;
-                        tMin = t;
-                        hitPoint = origin + dir * t;
-                        hitNormal = normalize(cross(triangle.v1.xyz - triangle.v0.xyz, triangle.v2.xyz - triangle.v0.xyz));
-                    }
-                }
-            } else { // Internal node
+                intersectLeaf(node, origin, dir, hit, hitPoint, hitNormal, tMin);
+            } else if (stackPtr + 2 <= STACK_SIZE) { // Internal node
                 stack[stackPtr++] = node.data.y; // Right child
                 stack[stackPtr++] = node.data.x; // Left child
+            } else {
+                // Stack full (a tree deeper than BVH_STACK_SIZE - 1, which BVH never builds):
+                // finish this subtree through its parent/sibling links instead of dropping a child
+                traverseStackless(nodeIdx, origin, dir, hit, hitPoint, hitNormal, tMin);
+            }
+            STATS(traversalStats.w = max(traversalStats.w, uint(stackPtr)));
+        }
+    }
+}
+#endif
+
+#if TRAVERSAL_KIND != TRAVERSAL_BRUTE_FORCE
+#ifdef STREAMING
+// Out-of-core geometry (GeometryStreamer in streaming.cpp). Triangles and BVHNodes hold the resident cluster pages
+// with absolute indices, the top-level tree over the clusters stays resident. The tree is walked front to back and
+// every cluster the ray enters before its closest hit gets stamped with frameIndex + 1, so the host loads what is
+// visible and evicts what is hidden behind it; clusters that are not resident yet are skipped, so their geometry
+// is missing until the page arrives.
+// The cluster tree is a median split (ClusterWriter in cluster_file.cpp), so its depth is at most
+// ceil(log2(clusters)) and a walk never holds more than depth + 1 entries: 32 covers any int cluster count
+const int CLUSTER_STACK_SIZE = 32;
+
+layout(std430, binding = 19) readonly buffer ClusterNodes {
+    BVHNode clusterNodes[]; // leaves: data.z is the cluster index
+};
+
+layout(std430, binding = 20) readonly buffer PageTable {
+    int pageRoots[]; // root node of the cluster's page in BVHNodes, -1 while not resident
+};
+
+layout(std430, binding = 21) buffer ClusterFeedback {
+    uint clusterFeedback[];
+};
+
+bool traverseBVH(vec3 origin, vec3 dir, out vec3 hitPoint, out vec3 hitNormal, out float tMin) {
+    bool hit = false;
+    tMin = 1e30;
+
+    // Each entry keeps where the ray enters the node, so nodes behind a hit found since they were pushed are
+    // dropped without reading them
+    int stack[CLUSTER_STACK_SIZE];
+    float stackNear[CLUSTER_STACK_SIZE];
+    int stackPtr = 0;
+    float rootNear;
+    if (intersectAABB(origin, dir, clusterNodes[0].min, clusterNodes[0].max, rootNear)) {
+        stack[stackPtr] = 0;
+        stackNear[stackPtr++] = rootNear;
+    }
+    while (stackPtr > 0) {
+        --stackPtr;
+        if (stackNear[stackPtr] >= tMin) continue;
+        BVHNode node = clusterNodes[stack[stackPtr]];
+        if (node.data.z < 0) {
+            // The farther child goes below the nearer one, so the nearer is entered first
+            BVHNode left = clusterNodes[node.data.x];
+            BVHNode right = clusterNodes[node.data.y];
+            float leftNear;
+            float rightNear;
+            bool hitLeft = intersectAABB(origin, dir, left.min, left.max, leftNear) && leftNear < tMin;
+            bool hitRight = intersectAABB(origin, dir, right.min, right.max, rightNear) && rightNear < tMin;
+            if (hitLeft && hitRight) {
+                bool leftFirst = leftNear <= rightNear;
+                stack[stackPtr] = leftFirst ? node.data.y : node.data.x;
+                stackNear[stackPtr++] = leftFirst ? rightNear : leftNear;
+                stack[stackPtr] = leftFirst ? node.data.x : node.data.y;
+                stackNear[stackPtr++] = leftFirst ? leftNear : rightNear;
+            } else if (hitLeft || hitRight) {
+                stack[stackPtr] = hitLeft ? node.data.x : node.data.y;
+                stackNear[stackPtr++] = hitLeft ? leftNear : rightNear;
+            }
+            continue;
+        }
+
+        // The ray reaches this cluster before any hit found so far, so its page is needed.
+        // Most invocations hitting a cluster agree on the stamp, skip the redundant stores
+        if (clusterFeedback[cluster] != frameIndex + 1u) {
+            clusterFeedback[cluster] = frameIndex + 1u;
+        }
+        int root = pageRoots[cluster];
+        if (root >= 0) {
+            traverseNodes(root, origin, dir, hit, hitPoint, hitNormal, tMin);
+        }
+    }
+    return hit;
+}
+#elif defined(INSTANCES)
+// Instanced meshes (Scene in scene.cpp). Triangles and BVHNodes pool the BVHs of every mesh with absolute
+// indices; the instance tree's leaves each name one instance. The ray is moved into the mesh's space without
+// renormalizing the direction, so t, tMin and the hit point along the world ray stay the same.
+// The instance tree is a median split with one instance per leaf (Scene::buildInstanceNode), so like the
+// cluster tree its depth stays below log2(instances) + 1 and 32 entries always suffice
+const int INSTANCE_STACK_SIZE = 32;
+
+struct Instance {
+    mat4 worldToObject;
+    ivec4 data; // x: root node of the mesh's BVH in BVHNodes (-1 for an empty mesh), y: mesh
+};
+
+layout(std430, binding = 22) readonly buffer InstanceNodes {
+    BVHNode instanceNodes[]; // leaves: data.z is the instance, data.w is 1 (0 for an empty scene)
+};
+
+layout(std430, binding = 23) readonly buffer Instances {
+    Instance instances[];
+};
+
+bool traverseBVH(vec3 origin, vec3 dir, out vec3 hitPoint, out vec3 hitNormal, out float tMin) {
+    bool hit = false;
+    tMin = 1e30;
+
+    int stack[INSTANCE_STACK_SIZE];
+    int stackPtr = 0;
+    stack[stackPtr++] = 0;
+    while (stackPtr > 0) {
+        BVHNode node = instanceNodes[stack[--stackPtr]];
+        if (!intersectAABB(origin, dir, node.min, node.max)) continue;
+        if (node.data.z < 0) {
+            stack[stackPtr++] = node.data.y;
+            stack[stackPtr++] = node.data.x;
+            continue;
+        }
+
+        for (int i = 0; i < node.data.w; ++i) {
+            Instance instance = instances[node.data.z + i];
+            if (instance.data.x < 0) continue;
+            vec3 objectOrigin = (instance.worldToObject * vec4(origin, 1.0)).xyz;
+            vec3 objectDir = mat3(instance.worldToObject) * dir;
+            bool instanceHit = false;
+            vec3 objectPoint;
+            vec3 objectNormal;
+            traverseNodes(instance.data.x, objectOrigin, objectDir, instanceHit, objectPoint, objectNormal, tMin);
+            if (instanceHit) {
+                hit = true;
+                hitPoint = origin + dir * tMin;
+                hitNormal = normalize(transpose(mat3(instance.worldToObject)) * objectNormal);
             }
         }
     }
     return hit;
 }
+#else
+bool traverseBVH(vec3 origin, vec3 dir, out vec3 hitPoint, out vec3 hitNormal, out float tMin) {
+    bool hit = false;
+    tMin = 1e30;  // 非常に大きな値で初期化
+    traverseNodes(0, origin, dir, hit, hitPoint, hitNormal, tMin);
+    return hit;
+}
+#endif
+#endif
+
+#ifdef VISIBILITY_BUFFER
+// Rasterized first hits (VisibilityBuffer in visibility.cpp). x: triangle index + 1 in Primitives, 0 for a miss,
+// y: barycentrics of v1 and v2 as unorm16
+layout(binding = 0) uniform usampler2D visibilityBuffer;
+
+// The triangles in Model::getIndexBufferTriangles order, before the BVH builder reorders and splits them
+layout(std430, binding = 11) readonly buffer Primitives {
+    Data primitives[];
+};
+
+// The raster samples sit on the primary rays, so the hit is rebuilt from the triangle instead of traversed.
+// The point is an affine combination of the vertices and stays on the triangle's plane
+bool firstHit(ivec2 pixel, vec3 origin, vec3 dir, out vec3 hitPoint, out vec3 hitNormal, out float tMin) {
+    uvec2 visibility = texelFetch(visibilityBuffer, pixel, 0).xy;
+    tMin = 1e30;
+    if (visibility.x == 0u) return false;
+
+    Data triangle = primitives[visibility.x - 1u];
+    vec2 barycentrics = unpackUnorm2x16(visibility.y);
+    vec3 edge1 = triangle.v1.xyz - triangle.v0.xyz;
+    vec3 edge2 = triangle.v2.xyz - triangle.v0.xyz;
+    hitPoint = triangle.v0.xyz + barycentrics.x * edge1 + barycentrics.y * edge2;
+    hitNormal = normalize(cross(edge1, edge2));
+    tMin = distance(origin, hitPoint);
+    return true;
+}
+#else
+bool firstHit(ivec2 pixel, vec3 origin, vec3 dir, out vec3 hitPoint, out vec3 hitNormal, out float tMin) {
+    return traverseBVH(origin, dir, hitPoint, hitNormal, tMin);
+}
+#endif
+
+// Per-path random numbers: PCG hash, seeded from the pixel and frame and carried across bounces
+uint rngState;
+
+uint pcgHash(uint value) {
+    uint state = value * 747796405u + 2891336453u;
+    uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+void seedRandom(int pixel) {
+    rngState = pcgHash(uint(pixel) ^ pcgHash(frameIndex));
+}
+
+float random() {
+    rngState = pcgHash(rngState);
+    return float(rngState >> 8u) * (1.0 / 16777216.0);
+}
+
+// Must match Tracer (tracer.cpp)
+const float ALBEDO = 0.8;       // every surface is a grey Lambertian reflector
+const int ROULETTE_START = 2;   // bounces before Russian roulette may end a path
+#if PATH_TRACE
+// Direct light uses the same Lambertian BRDF (albedo / pi) as the cosine-sampled bounces in scatter()
+const float DIRECT_BRDF = ALBEDO / 3.14159265359;
+#else
+const float DIRECT_BRDF = 1.0;  // the mirror mode keeps its plain N.L shading
+#endif
+
+#if LIGHT_SAMPLES > 0
+// Many-light sampling (LightBVH in light_bvh.cpp): numLights is the number of light sources and each hit
+// shades LIGHT_SAMPLES of them, picked in proportion to power / distance^2 and weighted by 1 / pdf
+#define LIGHT_POINT 0.0
+#define LIGHT_TRIANGLE 1.0
+
+struct LightSource {
+    vec4 position; // xyz: point light position or triangle v0, w: LIGHT_POINT or LIGHT_TRIANGLE
+    vec4 edge1;    // triangle v1 - v0
+    vec4 edge2;    // triangle v2 - v0
+    vec4 emission; // rgb: point light intensity or triangle radiance, w: triangle area
+};
+
+struct LightNode {
+    vec3 min;
+    float power; // summed power of the subtree
+    vec3 max;
+    int child;   // >= 0: children at child and child + 1, < 0: leaf holding light -child - 1
+};
+
+layout(std430, binding = 9) readonly buffer LightNodes {
+    LightNode lightNodes[];
+};
+
+layout(std430, binding = 10) readonly buffer LightSources {
+    LightSource lightSources[];
+};
+
+// Same estimate as importance() in light_bvh.cpp; inside the box the distance is clamped to its size
+float lightImportance(LightNode node, vec3 point) {
+    vec3 center = 0.5 * (node.min + node.max);
+    vec3 halfExtent = 0.5 * (node.max - node.min);
+    vec3 offset = point - center;
+    float distanceSquared = max(dot(offset, offset), dot(halfExtent, halfExtent));
+    return node.power / max(distanceSquared, 1e-6);
+}
+
+// Walks from the root choosing a child by importance, reusing the rescaled random number at each level
+int pickLight(vec3 point, float u, out float pdf) {
+    pdf = 1.0;
+    int index = 0;
+    while (lightNodes[index].child >= 0) {
+        int child = lightNodes[index].child;
+        float left = lightImportance(lightNodes[child], point);
+        float right = lightImportance(lightNodes[child + 1], point);
+        float probability = left / (left + right);
+        if (u < probability) {
+            u = min(u / probability, 0.99999994);
+            pdf *= probability;
+            index = child;
+        } else {
+            u = min((u - probability) / (1.0 - probability), 0.99999994);
+            pdf *= 1.0 - probability;
+            index = child + 1;
+        }
+    }
+    return -lightNodes[index].child - 1;
+}
+
+// Same as LightBVH::sample. radiance excludes the cosine at the shading point
+bool sampleLight(vec3 point, out vec3 direction, out float distance, out vec3 radiance) {
+    float pdf;
+    LightSource light = lightSources[pickLight(point, random(), pdf)];
+    float u1 = random();
+    float u2 = random();
+    if (pdf <= 0.0) return false;
+
+    if (light.position.w == LIGHT_POINT) {
+        vec3 toLight = light.position.xyz - point;
+        distance = length(toLight);
+        if (distance <= 0.0) return false;
+        direction = toLight / distance;
+        radiance = light.emission.rgb / pdf;
+        return true;
+    }
+
+    // Uniform point on the triangle (area pdf 1 / area), emitting from both sides
+    float su = sqrt(u1);
+    vec3 target = light.position.xyz + light.edge1.xyz * (su * (1.0 - u2)) + light.edge2.xyz * (su * u2);
+    vec3 toLight = target - point;
+    float distanceSquared = dot(toLight, toLight);
+    if (distanceSquared <= 0.0) return false;
+    distance = sqrt(distanceSquared);
+    direction = toLight / distance;
+    float cosLight = abs(dot(normalize(cross(light.edge1.xyz, light.edge2.xyz)), direction));
+    if (cosLight <= 0.0) return false;
+    radiance = light.emission.rgb * (cosLight * light.emission.w / (distanceSquared * pdf));
+    return true;
+}
+
+vec3 computeLighting(vec3 hitPoint, vec3 normal, vec3 viewDir) {
+    vec3 totalLight = vec3(0.0);
+    if (numLights == 0) return totalLight;
+
+    for (int i = 0; i < LIGHT_SAMPLES; ++i) {
+        vec3 lightDir, radiance;
+        float lightDistance;
+        if (!sampleLight(hitPoint, lightDir, lightDistance, radiance)) continue;
+        float diffuseFactor = max(dot(normal, lightDir), 0.0);
+        if (diffuseFactor <= 0.0) continue;
 
+        vec3 shadowOrigin = hitPoint + normal * BIAS;
+        vec3 shadowHitPoint, shadowHitNormal;
+        float shadowTMin;
+#if SHADOWS
+        // Only hits in front of the sampled point block it, so a triangle light does not shadow itself
+        if (!traverseBVH(shadowOrigin, lightDir, shadowHitPoint, shadowHitNormal, shadowTMin) ||
+            shadowTMin >= lightDistance * 0.999) {
+#else
+        {
+#endif
+            totalLight += radiance * (diffuseFactor * DIRECT_BRDF);
+        }
+    }
+
+    return totalLight / float(LIGHT_SAMPLES);
+}
+#else
 vec3 computeLighting(vec3 hitPoint, vec3 normal, vec3 viewDir) {
     vec3 totalLight = vec3(0.0);
 
@@ -138,20 +682,224 @@ vec3 computeLighting(vec3 hitPoint, vec3 normal, vec3 viewDir) {
         vec3 shadowOrigin = hitPoint + normal * 0.001; // シャドウアクネを防ぐための微小オフセット
         vec3 shadowHitPoint, shadowHitNormal;
         float shadowTMin;
+#if SHADOWS
         if (!traverseBVH(shadowOrigin, lightDir, shadowHitPoint, shadowHitNormal, shadowTMin)) {
+#else
+        {
+#endif
             // Diffuse reflection (Lambertian)
             float diffuseFactor = max(dot(normal, lightDir), 0.0);
-            vec3 diffuseColor = light.intensity.xyz * diffuseFactor;
+            vec3 diffuseColor = light.intensity.xyz * (diffuseFactor * DIRECT_BRDF);
             totalLight += diffuseColor;
         }
     }
 
     return totalLight;
 }
+#endif
+
+
+// Continues the path at hitPoint. Returns false when the path ends
+bool scatter(vec3 hitPoint, vec3 normal, inout vec3 origin, inout vec3 dir, inout vec3 throughput, int bounce) {
+#if PATH_TRACE
+    // Cosine-weighted direction around the normal on the side of the incoming ray.
+    // The Lambertian BRDF times cosine over this pdf leaves just the albedo
+    vec3 n = dot(normal, dir) < 0.0 ? normal : -normal;
+    float side = n.z >= 0.0 ? 1.0 : -1.0;
+    float a = -1.0 / (side + n.z);
+    float b = n.x * n.y * a;
+    vec3 tangent = vec3(1.0 + side * n.x * n.x * a, side * b, -side * n.x);
+    vec3 bitangent = vec3(b, side + n.y * n.y * a, -n.y);
+    float u1 = random();
+    float phi = 6.28318530718 * random();
+    float r = sqrt(u1);
+    origin = hitPoint + n * BIAS;
+    dir = normalize(tangent * (r * cos(phi)) + bitangent * (r * sin(phi)) + n * sqrt(max(1.0 - u1, 0.0)));
+    throughput *= ALBEDO;
+
+    // Russian roulette: dim paths end early, survivors are reweighted so the estimate stays unbiased
+    if (bounce + 1 >= ROULETTE_START) {
+        float survive = clamp(max(throughput.x, max(throughput.y, throughput.z)), 0.05, 0.95);
+        if (random() >= survive) return false;
+        throughput /= survive;
+    }
+#else
+    origin = hitPoint + normal * BIAS;
+    dir = reflect(dir, normal);
+    throughput *= 0.5;
+#endif
+    return true;
+}
+
+#ifdef WAVEFRONT
+// Multi-pass pipeline (Wavefront in wavefront.cpp): one bounce per dispatch.
+// Bounce 0 starts at the camera, later bounces read the ray queue in the order built by ray_sort.glsl
+// 3 position bits per axis (Wavefront::CELL_BITS), coarser than RayBinner's 6: one workgroup scans every bin
+// per bounce, and 8 << 18 bins would make that scan and the RayQueue buffer 64 times larger
+const uint CELL_BITS = 3u;
+const uint NUM_BINS = 8u << (3u * CELL_BITS); // octant x origin cell, must match ray_sort.glsl
+
+struct RayState {
+    vec3 origin;
+    int pixel;
+    vec3 direction;
+    uint rngState;
+    vec3 throughput;
+    float padding1;
+};
+
+layout(std430, binding = 3) readonly buffer InRays {
+    RayState inRays[];
+};
+
+layout(std430, binding = 4) writeonly buffer OutRays {
+    RayState outRays[];
+};
+
+layout(std430, binding = 5) writeonly buffer RayKeys {
+    uint rayKeys[];
+};
+
+layout(std430, binding = 6) readonly buffer RayOrder {
+    uint rayOrder[];
+};
+
+layout(std430, binding = 7) buffer RayQueue {
+    uvec4 dispatchArgs;
+    uint inCount;
+    uint outCount;
+    uint padding2;
+    uint padding3;
+    uint binCounts[NUM_BINS];
+    uint binOffsets[NUM_BINS];
+};
+
+// Explicit locations so Wavefront can set them without a lookup (wavefront.cpp)
+layout(location = 0) uniform int bounce;
+layout(location = 1) uniform int maxBounces;
+layout(location = 2) uniform bool sortRays;
+
+// Survivors of a workgroup are compacted in shared memory, so the queue takes one atomic per group
+shared uint groupCount;
+shared uint groupBase;
+
+// Origin cell in the root bounds (Morton order) and direction octant, laid out like RayBinner::key but with
+// CELL_BITS bits per axis
+uint rayKey(vec3 origin, vec3 dir) {
+    vec3 sceneMin = nodes[0].min;
+    vec3 extent = max(nodes[0].max - sceneMin, vec3(1e-6));
+    float cells = float(1u << CELL_BITS);
+    uvec3 cell = uvec3(clamp((origin - sceneMin) / extent * cells, vec3(0.0), vec3(cells - 1.0)));
+
+    uint morton = 0u;
+    for (uint i = 0u; i < CELL_BITS; ++i) {
+        morton |= ((cell.x >> i) & 1u) << (3u * i);
+        morton |= ((cell.y >> i) & 1u) << (3u * i + 1u);
+        morton |= ((cell.z >> i) & 1u) << (3u * i + 2u);
+    }
+    uint octant = (dir.x < 0.0 ? 1u : 0u) | (dir.y < 0.0 ? 2u : 0u) | (dir.z < 0.0 ? 4u : 0u);
+    return (octant << (3u * CELL_BITS)) | morton;
+}
 
 void main() {
-    ivec2 pixelCoords = ivec2(gl_GlobalInvocationID.xy);
-    ivec2 imgSize = imageSize(imgOutput);
+    ivec2 imgSize = renderSize;
+    ivec2 pixelCoords;
+    vec3 origin;
+    vec3 dir;
+    vec3 throughput;
+    vec3 color;
+
+    // No early returns: every invocation has to reach the barriers below
+    bool live;
+    if (gl_LocalInvocationIndex == 0u) groupCount = 0u;
+    if (bounce == 0) {
+        pixelCoords = ivec2(gl_GlobalInvocationID.xy);
+        live = pixelCoords.x < imgSize.x && pixelCoords.y < imgSize.y;
+
+        vec2 uv = (vec2(pixelCoords) / vec2(imgSize)) * 2.0 - 1.0;
+        dir = rayDirection(fov, aspectRatio, uv);
+        origin = cameraPosition;
+        throughput = vec3(1.0);
+        color = vec3(0.0);
+        seedRandom(pixelCoords.y * imgSize.x + pixelCoords.x);
+    } else {
+        uint index = gl_WorkGroupID.x * (gl_WorkGroupSize.x * gl_WorkGroupSize.y) + gl_LocalInvocationIndex;
+        live = index < inCount;
+
+        if (live) {
+            RayState ray = inRays[sortRays ? rayOrder[index] : index];
+            pixelCoords = ivec2(ray.pixel % imgSize.x, ray.pixel / imgSize.x);
+            origin = ray.origin;
+            dir = ray.direction;
+            throughput = ray.throughput;
+            rngState = ray.rngState;
+            color = imageLoad(imgOutput, pixelCoords).rgb;
+        }
+    }
+    barrier();
+
+    RayState next;
+    bool emit = false;
+    if (live) {
+        vec3 hitPoint;
+        vec3 normal;
+        float tMin;
+        bool hit = bounce == 0 ? firstHit(pixelCoords, origin, dir, hitPoint, normal, tMin)
+                               : traverseBVH(origin, dir, hitPoint, normal, tMin);
+        GBUFFER_WRITE(if (bounce == 0) writeGBuffer(pixelCoords, hit, dir, hitPoint, normal, tMin));
+        if (hit) {
+            color += throughput * computeLighting(hitPoint, normal, normalize(-dir));
+
+            if (bounce + 1 < maxBounces && scatter(hitPoint, normal, origin, dir, throughput, bounce)) {
+                next.origin = origin;
+                next.pixel = pixelCoords.y * imgSize.x + pixelCoords.x;
+                next.direction = dir;
+                next.rngState = rngState;
+                next.throughput = throughput;
+                emit = true;
+            }
+        }
+
+        imageStore(imgOutput, pixelCoords, vec4(color, 1.0));
+        STATS(writeTraversalStats(pixelCoords.y * imgSize.x + pixelCoords.x));
+    }
+
+    // Compact the surviving paths into the queue of the next bounce
+    uint localSlot = emit ? atomicAdd(groupCount, 1u) : 0u;
+    barrier();
+    if (gl_LocalInvocationIndex == 0u && groupCount > 0u) groupBase = atomicAdd(outCount, groupCount);
+    barrier();
+
+    if (emit) {
+        uint slot = groupBase + localSlot;
+        outRays[slot] = next;
+        if (sortRays) {
+            uint key = rayKey(next.origin, next.direction);
+            rayKeys[slot] = key;
+            atomicAdd(binCounts[key], 1u);
+        }
+    }
+}
+#else
+// Pixel of this invocation. With MORTON_SWIZZLE the invocations of a workgroup walk their tile in
+// Morton order (x takes the even index bits), so 64x1 or 32x4 groups still trace a compact block
+ivec2 pixelIndex() {
+#if MORTON_SWIZZLE
+    uint index = gl_LocalInvocationIndex;
+    uvec2 local = uvec2(0u);
+    for (uint bit = 0u; bit < 5u; ++bit) {
+        local.x |= ((index >> (2u * bit)) & 1u) << bit;
+        local.y |= ((index >> (2u * bit + 1u)) & 1u) << bit;
+    }
+    return ivec2(gl_WorkGroupID.xy * uvec2(TILE_X, TILE_Y) + local);
+#else
+    return ivec2(gl_GlobalInvocationID.xy);
+#endif
+}
+
+void main() {
+    ivec2 pixelCoords = pixelIndex();
+    ivec2 imgSize = renderSize;
 
     if (pixelCoords.x >= imgSize.x || pixelCoords.y >= imgSize.y) return;
 
@@ -159,6 +907,7 @@ void main() {
 
     vec3 dir = rayDirection(fov, aspectRatio, uv);
     vec3 origin = cameraPosition;
+    seedRandom(pixelCoords.y * imgSize.x + pixelCoords.x);
 
     vec3 color = vec3(0.0);
     vec3 throughput = vec3(1.0);
@@ -170,7 +919,10 @@ void main() {
         vec3 normal;
         float tMin;
 
-        if (traverseBVH(origin, dir, hitPoint, normal, tMin)) {
+        bool hit = currentBounce == 0 ? firstHit(pixelCoords, origin, dir, hitPoint, normal, tMin)
+                                      : traverseBVH(origin, dir, hitPoint, normal, tMin);
+        GBUFFER_WRITE(if (currentBounce == 0) writeGBuffer(pixelCoords, hit, dir, hitPoint, normal, tMin));
+        if (hit) {
             // ヒットポイントからのライティング計算
             vec3 viewDir = normalize(-dir);
             vec3 lighting = computeLighting(hitPoint, normal, viewDir);
@@ -178,12 +930,8 @@ void main() {
             // 現在のバウンスの色を累積
             color += throughput * lighting;
 
-            // 次のバウンスのためにoriginとdirを更新
-            origin = hitPoint + normal * BIAS; // ヒットポイントを微小オフセット
-            dir = reflect(dir, normal); // レイの反射方向を更新
-
-            // 色の減衰
-            throughput *= 0.5;
+            // 次のバウンスのためにoriginとdirとthroughputを更新. ロシアンルーレットで終わることもある
+            if (!scatter(hitPoint, normal, origin, dir, throughput, currentBounce)) break;
         } else {
             // 交差しない場合、ループを抜ける
             break;
@@ -192,5 +940,7 @@ void main() {
         ++currentBounce;
     }
 
-    imageStore(imgOutput, pixelCoords, vec4(color, 1.0));
+    imageStore(imgOutput, pixelCoords, vec4(encodeOutput(color), 1.0));
+    STATS(writeTraversalStats(pixelCoords.y * imgSize.x + pixelCoords.x));
 }
+#endif
@@ -0,0 +1,134 @@
+#version 460 core
+layout(local_size_x = 64) in;
+
+// Per-command culling for the raster path (DrawCuller in culling.cpp). Each invocation tests one command's
+// bounds against the view frustum and against the hierarchical-Z pyramid of the previous frame, and appends the
+// survivors at their level of detail to outCommands for glMultiDrawElementsIndirectCount.
+
+// Model's DrawCommand (DrawElementsIndirectCommand)
+struct DrawCommand {
+    uint count;
+    uint instanceCount;
+    uint firstIndex;
+    int baseVertex;
+    uint baseInstance;
+};
+
+// Model's DrawBounds, untransformed like the vertices
+struct DrawBounds {
+    vec4 lo;
+    vec4 hi;
+};
+
+layout(std430, binding = 14) readonly buffer InCommands {
+    DrawCommand inCommands[];
+};
+layout(std430, binding = 15) readonly buffer Bounds {
+    DrawBounds bounds[];
+};
+layout(std430, binding = 16) writeonly buffer OutCommands {
+    DrawCommand outCommands[];
+};
+layout(std430, binding = 17) buffer DrawCount {
+    uint drawCount;     // cleared to 0 before the dispatch
+};
+
+// Must match Model::MAX_LOD_LEVELS
+const int MAX_LOD_LEVELS = 4;
+
+// Model's DrawLod, MAX_LOD_LEVELS per command
+struct DrawLod {
+    uint firstIndex;
+    uint count;
+    float error;        // distance from the original surface, in model units
+    float padding;
+};
+layout(std430, binding = 18) readonly buffer Lods {
+    DrawLod lods[];
+};
+
+// Level of each command, picked by Model::selectLods on the host. The BVH is built from the same levels, so the
+// rasterized first hits and the traced rays see the same surface
+layout(std430, binding = 24) readonly buffer Levels {
+    int drawLevels[];
+};
+
+// Farthest depth of each texel's footprint, level 0 is the depth buffer itself (built by hiz.glsl)
+layout(binding = 0) uniform sampler2D hiZ;
+
+layout(location = 0) uniform mat4 viewProjection;
+layout(location = 1) uniform mat4 hiZViewProjection;   // the one the pyramid's depth was rendered with
+layout(location = 2) uniform ivec2 hiZSize;            // size of level 0 that holds depth
+layout(location = 3) uniform int hiZLevels;            // 0 skips the occlusion test
+layout(location = 4) uniform uint numDraws;
+
+vec3 corner(vec3 lo, vec3 hi, int i) {
+    return vec3((i & 1) != 0 ? hi.x : lo.x, (i & 2) != 0 ? hi.y : lo.y, (i & 4) != 0 ? hi.z : lo.z);
+}
+
+// Outside when all eight corners lie beyond the same clip plane
+bool outsideFrustum(vec3 lo, vec3 hi) {
+    ivec3 below = ivec3(0);
+    ivec3 above = ivec3(0);
+    for (int i = 0; i < 8; ++i) {
+        vec4 clip = viewProjection * vec4(corner(lo, hi, i), 1.0);
+        below += ivec3(lessThan(clip.xyz, vec3(-clip.w)));
+        above += ivec3(greaterThan(clip.xyz, vec3(clip.w)));
+    }
+    return any(equal(below, ivec3(8))) || any(equal(above, ivec3(8)));
+}
+
+// Occluded when the nearest depth of the box is behind the farthest depth stored for every texel it covers.
+// The level is chosen so that the box's pixel rectangle spans at most 2x2 texels
+bool occluded(vec3 lo, vec3 hi) {
+    vec2 minUV = vec2(1.0);
+    vec2 maxUV = vec2(0.0);
+    float nearest = 1.0;
+    for (int i = 0; i < 8; ++i) {
+        vec4 clip = hiZViewProjection * vec4(corner(lo, hi, i), 1.0);
+        // Crosses the near plane of the pyramid's camera: its depth says nothing about the box
+        if (clip.w <= 0.0) return false;
+        vec3 ndc = clip.xyz / clip.w;
+        minUV = min(minUV, ndc.xy * 0.5 + 0.5);
+        maxUV = max(maxUV, ndc.xy * 0.5 + 0.5);
+        nearest = min(nearest, ndc.z * 0.5 + 0.5);
+    }
+    minUV = clamp(minUV, 0.0, 1.0);
+    maxUV = clamp(maxUV, 0.0, 1.0);
+    // Off screen last frame, so there is no depth to test against
+    if (any(greaterThanEqual(minUV, maxUV))) return false;
+
+    // Pixels of level 0, shifted down to the level. Halving rounds down, so the last texel of a level also covers
+    // the pixels past levelSize << level
+    ivec2 firstPixel = clamp(ivec2(minUV * vec2(hiZSize)), ivec2(0), hiZSize - 1);
+    ivec2 lastPixel = clamp(ivec2(maxUV * vec2(hiZSize)), ivec2(0), hiZSize - 1);
+    ivec2 extent = lastPixel - firstPixel + 1;
+    int level = clamp(int(ceil(log2(float(max(extent.x, extent.y))))), 0, hiZLevels - 1);
+    ivec2 levelSize = max(hiZSize >> level, ivec2(1));
+    ivec2 first = min(firstPixel >> level, levelSize - 1);
+    ivec2 last = min(lastPixel >> level, levelSize - 1);
+    float farthest = max(max(texelFetch(hiZ, first, level).r, texelFetch(hiZ, ivec2(last.x, first.y), level).r),
+                         max(texelFetch(hiZ, ivec2(first.x, last.y), level).r, texelFetch(hiZ, last, level).r));
+    return nearest > farthest;
+}
+
+void main() {
+    uint index = gl_GlobalInvocationID.x;
+    if (index >= numDraws) return;
+
+    vec3 lo = bounds[index].lo.xyz;
+    vec3 hi = bounds[index].hi.xyz;
+    if (outsideFrustum(lo, hi)) return;
+    if (hiZLevels > 0 && occluded(lo, hi)) return;
+
+    int level = drawLevels[index];
+
+    // baseInstance names the DrawInfo of the level, which the vertex shaders use to find the material and the
+    // level's first triangle
+    DrawCommand command = inCommands[index];
+    DrawLod lod = lods[index * uint(MAX_LOD_LEVELS) + uint(level)];
+    command.firstIndex = lod.firstIndex;
+    command.count = lod.count;
+    command.baseInstance = index * uint(MAX_LOD_LEVELS) + uint(level);
+    outCommands[atomicAdd(drawCount, 1u)] = command;
+}
@@ -1,11 +1,25 @@
-#version 410 core
+#version 460 core
 out vec4 FragColor;
 
 in vec2 TexCoord;
+flat in int MaterialIndex;
 
-uniform sampler2D texture_diffuse;
+struct Material {
+    vec4 baseColorFactor;
+    int textureLayer; // negative: no texture
+};
+
+layout(std430, binding = 13) readonly buffer Materials {
+    Material materials[];
+};
+
+// Every base colour texture of the model, one layer each (Model::loadMaterials)
+layout(binding = 0) uniform sampler2DArray texture_diffuse;
 
 void main()
 {
-    FragColor = texture(texture_diffuse, TexCoord);
-}
\ No newline at end of file
+    Material material = materials[MaterialIndex];
+    vec4 color = material.baseColorFactor;
+    if (material.textureLayer >= 0) color *= texture(texture_diffuse, vec3(TexCoord, float(material.textureLayer)));
+    FragColor = color;
+}
@@ -0,0 +1,36 @@
+#version 460 core
+layout(local_size_x = 16, local_size_y = 16) in;
+
+// Builds one level of the hierarchical-Z pyramid for DrawCuller (culling.cpp). Level 0 copies the depth buffer,
+// every further level keeps the farthest depth of the texels it covers, so a box behind a texel's value is
+// behind everything drawn in that footprint.
+
+// The depth texture for level 0, otherwise the pyramid itself (read at sourceLevel, written at the next level)
+layout(binding = 0) uniform sampler2D source;
+layout(r32f, binding = 0) writeonly uniform image2D target;
+
+layout(location = 0) uniform ivec2 sourceSize;
+layout(location = 1) uniform ivec2 targetSize;
+layout(location = 2) uniform int sourceLevel;   // -1: copy the depth buffer
+
+void main() {
+    ivec2 pixel = ivec2(gl_GlobalInvocationID.xy);
+    if (any(greaterThanEqual(pixel, targetSize))) return;
+
+    if (sourceLevel < 0) {
+        imageStore(target, pixel, vec4(texelFetch(source, pixel, 0).r));
+        return;
+    }
+
+    // Halving rounds down, so the last texel of an odd row or column also takes the one left over
+    ivec2 base = pixel * 2;
+    ivec2 span = ivec2(2) + ivec2(equal(pixel, targetSize - 1)) * (sourceSize & 1);
+    float farthest = 0.0;
+    for (int y = 0; y < span.y; ++y) {
+        for (int x = 0; x < span.x; ++x) {
+            ivec2 texel = min(base + ivec2(x, y), sourceSize - 1);
+            farthest = max(farthest, texelFetch(source, texel, sourceLevel).r);
+        }
+    }
+    imageStore(target, pixel, vec4(farthest));
+}
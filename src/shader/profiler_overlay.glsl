@@ -0,0 +1,41 @@
+#version 460 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// Stacked phase timings from Profiler::drawOverlay.
+// Top row: GPU time per phase, middle row: CPU time per phase, bottom row: whole frame
+const int MAX_PHASES = 16; // Profiler::MAX_PHASES, checked when the profiler is created
+
+uniform int numPhases;
+uniform float gpuMs[MAX_PHASES];
+uniform float cpuMs[MAX_PHASES];
+uniform float frameMs;
+uniform float scaleMs; // milliseconds across the full width
+
+vec3 phaseColor(int i) {
+    return 0.5 + 0.5 * cos(6.2831853 * (float(i) / float(MAX_PHASES) + vec3(0.0, 0.33, 0.67)));
+}
+
+void main() {
+    float ms = TexCoords.x * scaleMs;
+    vec4 color = vec4(0.0, 0.0, 0.0, 0.5);
+
+    int row = int(TexCoords.y * 3.0);
+    if (row == 0) {
+        if (ms < frameMs) color = vec4(0.8, 0.8, 0.8, 0.9);
+    } else {
+        float start = 0.0;
+        for (int i = 0; i < numPhases; ++i) {
+            float duration = row == 2 ? gpuMs[i] : cpuMs[i];
+            if (ms >= start && ms < start + duration) color = vec4(phaseColor(i), 0.9);
+            start += duration;
+        }
+    }
+
+    // 60 Hz budget marks
+    float budget = 1000.0 / 60.0;
+    if (mod(ms, budget) < scaleMs * 0.004) color = vec4(1.0, 0.2, 0.2, 1.0);
+
+    FragColor = color;
+}
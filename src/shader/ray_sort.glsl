@@ -0,0 +1,77 @@
+#version 460 core
+layout(local_size_x = 256) in;
+
+// Counting sort of the ray queue by key (see rayKey in compute_raytracing_1.glsl)
+// sortPass 0: one workgroup scans the bin counts and hands the queue to the next bounce
+// sortPass 1: scatters ray indices into rayOrder, dispatched indirectly over inCount
+const uint CELL_BITS = 3u; // Wavefront::CELL_BITS, see the comment above rayKey's CELL_BITS
+const uint NUM_BINS = 8u << (3u * CELL_BITS);
+const uint BINS_PER_THREAD = NUM_BINS / 256u;
+
+layout(std430, binding = 5) readonly buffer RayKeys {
+    uint rayKeys[];
+};
+
+layout(std430, binding = 6) writeonly buffer RayOrder {
+    uint rayOrder[];
+};
+
+layout(std430, binding = 7) buffer RayQueue {
+    uvec4 dispatchArgs;
+    uint inCount;
+    uint outCount;
+    uint padding2;
+    uint padding3;
+    uint binCounts[NUM_BINS];
+    uint binOffsets[NUM_BINS];
+};
+
+layout(location = 0) uniform int sortPass;
+
+shared uint partialSums[256];
+
+void scanBins() {
+    uint thread = gl_LocalInvocationIndex;
+    uint first = thread * BINS_PER_THREAD;
+
+    uint sum = 0u;
+    for (uint i = 0u; i < BINS_PER_THREAD; ++i) {
+        sum += binCounts[first + i];
+    }
+    partialSums[thread] = sum;
+    barrier();
+
+    // Inclusive scan of the per-thread sums
+    for (uint offset = 1u; offset < 256u; offset <<= 1u) {
+        uint value = thread >= offset ? partialSums[thread - offset] : 0u;
+        barrier();
+        partialSums[thread] += value;
+        barrier();
+    }
+
+    uint offset = partialSums[thread] - sum;
+    for (uint i = 0u; i < BINS_PER_THREAD; ++i) {
+        uint count = binCounts[first + i];
+        binOffsets[first + i] = offset;
+        binCounts[first + i] = 0u; // ready for the next bounce
+        offset += count;
+    }
+
+    if (thread == 0u) {
+        inCount = outCount;
+        outCount = 0u;
+        dispatchArgs = uvec4((inCount + 255u) / 256u, 1u, 1u, 0u);
+    }
+}
+
+void main() {
+    if (sortPass == 0) {
+        scanBins();
+    } else {
+        uint index = gl_GlobalInvocationID.x;
+        if (index >= inCount) return;
+
+        uint slot = atomicAdd(binOffsets[rayKeys[index]], 1u);
+        rayOrder[slot] = index;
+    }
+}
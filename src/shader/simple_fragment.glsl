@@ -4,7 +4,19 @@ out vec4 FragColor;
 in vec2 TexCoords;
 
 uniform sampler2D screenTexture;
+uniform vec2 textureScale; // part of the texture that holds the image (Quad::setTextureScale)
+uniform bool encodeOutput;  // the texture holds linear HDR (Quad::setEncodeOutput)
+
+// Same curve as compute_raytracing_1.glsl and encodeChannel in util.cpp: ACES fit, then the sRGB transfer function
+vec3 tonemapSRGB(vec3 color) {
+    vec3 x = max(color, vec3(0.0));
+    vec3 mapped = clamp((x * (2.51 * x + 0.03)) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);
+    return mix(12.92 * mapped, 1.055 * pow(mapped, vec3(1.0 / 2.4)) - 0.055, greaterThan(mapped, vec3(0.0031308)));
+}
 
 void main() {
-    FragColor = texture(screenTexture, TexCoords);
+    // stay half a texel inside the rendered region so linear filtering does not pick up stale texels
+    vec2 halfTexel = 0.5 / vec2(textureSize(screenTexture, 0));
+    vec4 color = texture(screenTexture, clamp(TexCoords * textureScale, halfTexel, textureScale - halfTexel));
+    FragColor = encodeOutput ? vec4(tonemapSRGB(color.rgb), color.a) : color;
 }
\ No newline at end of file
@@ -0,0 +1,25 @@
+#version 460 core
+out vec4 FragColor;
+
+in vec2 TexCoords;
+
+// Written by compute_raytracing_1.glsl when compiled with TRAVERSAL_STATS
+layout(std430, binding = 8) readonly buffer TraversalCounters {
+    uvec4 traversalCounters[]; // x: nodes visited, y: AABB tests, z: triangle tests, w: max stack depth
+};
+
+uniform int imageWidth;
+uniform int imageHeight;
+uniform int metric;     // component of traversalCounters to show
+uniform float maxValue; // mapped to the hot end of the ramp
+
+// blue -> cyan -> green -> yellow -> red
+vec3 heat(float x) {
+    return clamp(vec3(1.5) - abs(4.0 * x - vec3(3.0, 2.0, 1.0)), 0.0, 1.0);
+}
+
+void main() {
+    ivec2 pixel = min(ivec2(TexCoords * vec2(imageWidth, imageHeight)), ivec2(imageWidth - 1, imageHeight - 1));
+    float value = float(traversalCounters[pixel.y * imageWidth + pixel.x][metric]);
+    FragColor = vec4(heat(value / max(maxValue, 1.0)), 1.0);
+}
@@ -1,8 +1,19 @@
-#version 410 core
+#version 460 core
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec2 aTexCoord;
 
 out vec2 TexCoord;
+flat out int MaterialIndex;
+
+// Model::DrawInfo of each command and level of detail. Indexed by gl_BaseInstance, which names the original
+// command and its level even after DrawCuller compacts the commands (gl_DrawID would not)
+struct DrawInfo {
+    int material;
+    int firstTriangle;
+};
+layout(std430, binding = 12) readonly buffer DrawInfos {
+    DrawInfo drawInfos[];
+};
 
 uniform mat4 model;
 uniform mat4 view;
@@ -12,4 +23,5 @@ void main()
 {
     gl_Position = projection * view * model * vec4(aPos, 1.0);
     TexCoord = aTexCoord;
-}
\ No newline at end of file
+    MaterialIndex = drawInfos[gl_BaseInstance].material;
+}
@@ -0,0 +1,13 @@
+#version 460 core
+// x: index of the triangle in Model::getIndexBufferTriangles order + 1 (0 is left for the clear colour, a miss),
+// y: barycentrics of v1 and v2 packed as unorm16 (read by compute_raytracing_1.glsl with VISIBILITY_BUFFER)
+layout(location = 0) out uvec2 visibility;
+
+in vec3 barycentrics;
+flat in int firstTriangle;
+
+// gl_PrimitiveID counts from the start of the command, firstTriangle is where the command starts in the merged
+// index buffer
+void main() {
+    visibility = uvec2(uint(firstTriangle + gl_PrimitiveID) + 1u, packUnorm2x16(barycentrics.yz));
+}
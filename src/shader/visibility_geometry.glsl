@@ -0,0 +1,20 @@
+#version 460 core
+// Gives each corner of a triangle its own barycentric basis vector, interpolated perspective-correct
+layout(triangles) in;
+layout(triangle_strip, max_vertices = 3) out;
+
+flat in int vertexFirstTriangle[];
+
+out vec3 barycentrics;
+flat out int firstTriangle;
+
+void main() {
+    for (int i = 0; i < 3; ++i) {
+        gl_Position = gl_in[i].gl_Position;
+        gl_PrimitiveID = gl_PrimitiveIDIn;
+        firstTriangle = vertexFirstTriangle[0];
+        barycentrics = vec3(i == 0 ? 1.0 : 0.0, i == 1 ? 1.0 : 0.0, i == 2 ? 1.0 : 0.0);
+        EmitVertex();
+    }
+    EndPrimitive();
+}
@@ -0,0 +1,24 @@
+#version 460 core
+// Visibility buffer (VisibilityBuffer in visibility.cpp). The VAOs of Model hold the positions untransformed,
+// the same coordinates the ray tracer's triangles use
+layout(location = 0) in vec3 aPos;
+
+// Model::DrawInfo, indexed by gl_BaseInstance (the original command and its level of detail)
+struct DrawInfo {
+    int material;
+    int firstTriangle;
+};
+layout(std430, binding = 12) readonly buffer DrawInfos {
+    DrawInfo drawInfos[];
+};
+
+// gl_PrimitiveID restarts at 0 for each command of a multi-draw, firstTriangle is where the drawn level starts
+flat out int vertexFirstTriangle;
+
+// Includes the half-pixel shift that lines the raster samples up with the primary rays
+uniform mat4 viewProjection;
+
+void main() {
+    gl_Position = viewProjection * vec4(aPos, 1.0);
+    vertexFirstTriangle = drawInfos[gl_BaseInstance].firstTriangle;
+}
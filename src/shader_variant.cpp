@@ -0,0 +1,132 @@
+#include "shader_variant.h"
+#include <sstream>
+
+namespace {
+
+int log2Floor(int value) {
+    int bits = 0;
+    while ((2 << bits) <= value) ++bits;
+    return bits;
+}
+
+} // namespace
+
+std::string ShaderVariant::defines() const {
+    std::ostringstream out;
+    out << "#define LOCAL_SIZE_X " << localSizeX << "\n"
+        << "#define LOCAL_SIZE_Y " << localSizeY << "\n"
+        << "#define MAX_BOUNCES " << maxBounces << "\n"
+        << "#define TRAVERSAL_KIND " << static_cast<int>(traversal) << "\n"
+        << "#define SHADOWS " << (shadows ? 1 : 0) << "\n"
+        << "#define PATH_TRACE " << (pathTrace ? 1 : 0) << "\n";
+    if (mortonSwizzle) {
+        out << "#define MORTON_SWIZZLE 1\n"
+            << "#define TILE_X " << tileWidth() << "\n"
+            << "#define TILE_Y " << tileHeight() << "\n";
+    }
+    if (traversalStats) out << "#define TRAVERSAL_STATS\n";
+    if (wavefront) out << "#define WAVEFRONT\n";
+    if (outputFormat != OUTPUT_RGBA32F) out << "#define OUTPUT_FORMAT " << outputFormatQualifier(outputFormat) << "\n";
+    if (isDisplayFormat(outputFormat)) out << "#define ENCODE_OUTPUT 1\n";
+    if (lightSamples > 0) out << "#define LIGHT_SAMPLES " << lightSamples << "\n";
+    if (gbuffer) out << "#define GBUFFER\n";
+    if (visibility) out << "#define VISIBILITY_BUFFER\n";
+    if (streaming) out << "#define STREAMING\n";
+    if (instances) out << "#define INSTANCES\n";
+    return out.str();
+}
+
+std::string ShaderVariant::workgroupName() const {
+    std::ostringstream out;
+    out << localSizeX << "x" << localSizeY << (mortonSwizzle ? " morton" : "");
+    return out.str();
+}
+
+// Morton 順では x が偶数番目のビットを取るので, ビット数が奇数なら横長のタイルになる
+int ShaderVariant::tileWidth() const {
+    if (!mortonSwizzle) return localSizeX;
+    int bits = log2Floor(localSizeX * localSizeY);
+    return 1 << ((bits + 1) / 2);
+}
+
+int ShaderVariant::tileHeight() const {
+    if (!mortonSwizzle) return localSizeY;
+    int bits = log2Floor(localSizeX * localSizeY);
+    return 1 << (bits / 2);
+}
+
+ShaderVariant ShaderVariant::withWorkgroup(int x, int y, bool morton) const {
+    ShaderVariant variant = *this;
+    variant.localSizeX = x;
+    variant.localSizeY = y;
+    variant.mortonSwizzle = morton;
+    return variant;
+}
+
+ShaderVariant ShaderVariant::withTraversal(TraversalKind kind) const {
+    ShaderVariant variant = *this;
+    variant.traversal = kind;
+    return variant;
+}
+
+ShaderVariant ShaderVariant::withTraversalStats() const {
+    ShaderVariant variant = *this;
+    variant.traversalStats = true;
+    return variant;
+}
+
+ShaderVariant ShaderVariant::withWavefront() const {
+    ShaderVariant variant = *this;
+    // ray_sort.glsl は 256 スレッドのワークグループを前提にしている
+    variant.wavefront = true;
+    variant.localSizeX = 16;
+    variant.localSizeY = 16;
+    variant.mortonSwizzle = false;
+    // バウンスごとに imgOutput に足していくので表示用の形式は使えない
+    if (isDisplayFormat(variant.outputFormat)) variant.outputFormat = OUTPUT_RGBA16F;
+    return variant;
+}
+
+ShaderVariant ShaderVariant::withOutputFormat(OutputFormat format) const {
+    ShaderVariant variant = *this;
+    variant.outputFormat = format;
+    return variant;
+}
+
+ShaderVariant ShaderVariant::withPathTracing(bool enable, int bounces) const {
+    ShaderVariant variant = *this;
+    variant.pathTrace = enable;
+    variant.maxBounces = enable ? bounces : 1;
+    return variant;
+}
+
+ShaderVariant ShaderVariant::withLightSamples(int samples) const {
+    ShaderVariant variant = *this;
+    variant.lightSamples = samples;
+    return variant;
+}
+
+ShaderVariant ShaderVariant::withDenoiser(bool enable, OutputFormat displayFormat) const {
+    ShaderVariant variant = *this;
+    variant.gbuffer = enable;
+    variant.outputFormat = enable ? OUTPUT_RGBA16F : displayFormat;
+    return variant;
+}
+
+ShaderVariant ShaderVariant::withVisibilityBuffer(bool enable) const {
+    ShaderVariant variant = *this;
+    variant.visibility = enable;
+    return variant;
+}
+
+ShaderVariant ShaderVariant::withStreaming(bool enable) const {
+    ShaderVariant variant = *this;
+    variant.streaming = enable;
+    return variant;
+}
+
+ShaderVariant ShaderVariant::withInstances(bool enable) const {
+    ShaderVariant variant = *this;
+    variant.instances = enable;
+    return variant;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <string>
+#include <glad/gl.h>
+#include "util.h"
+
+// compute_raytracing_1.glsl の TRAVERSAL_KIND と同じ値
+enum TraversalKind { TRAVERSAL_STACK = 0, TRAVERSAL_STACKLESS = 1, TRAVERSAL_BRUTE_FORCE = 2 };
+
+// マスターカーネル compute_raytracing_1.glsl の 1 つの特殊化.
+// defines() を Cshader に渡すと #version の直後に挿入される
+struct ShaderVariant {
+    int localSizeX;
+    int localSizeY;
+    bool mortonSwizzle;         // 1 パスのカーネルのみ. localSizeX * localSizeY は 2 のべき乗
+    int maxBounces;             // 1 パスのカーネルのバウンス数
+    bool pathTrace;             // コサイン重み付きの拡散反射とロシアンルーレット. false なら鏡面反射
+    TraversalKind traversal;
+    bool shadows;
+    bool traversalStats;        // heatmap.h のカウンタ (デバッグ用)
+    bool wavefront;             // localSizeX * localSizeY は 256 でなければならない
+    OutputFormat outputFormat;  // imgOutput に結び付けるテクスチャの形式. wavefront では蓄積用の形式のみ
+    int lightSamples;           // > 0 なら LightBVH から当たった点ごとにこの数の光源を選ぶ. 0 なら全部の点光源
+    bool gbuffer;               // Denoiser の G-buffer (image unit 1, 2, 3) にも書く
+    bool visibility;            // 最初の交差を VisibilityBuffer (texture unit 0, SSBO binding 11) から読む
+    bool streaming;             // GeometryStreamer の読み込み済みのページをトレースする. brute force とは組み合わせない
+    bool instances;             // Scene のインスタンスをトレースする. streaming, brute force とは組み合わせない
+
+    ShaderVariant()
+        : localSizeX(16), localSizeY(16), mortonSwizzle(false), maxBounces(1), pathTrace(false), traversal(TRAVERSAL_STACK),
+          shadows(true), traversalStats(false), wavefront(false), outputFormat(OUTPUT_RGBA32F), lightSamples(0),
+          gbuffer(false), visibility(false), streaming(false), instances(false) {}
+
+    std::string defines() const;
+    std::string workgroupName() const;     // 例: "32x4 morton"
+
+    // 1 ワークグループが受け持つ画素の範囲と, 任意の解像度を覆うディスパッチ数 (切り上げ)
+    int tileWidth() const;
+    int tileHeight() const;
+    GLuint groupsX(int width) const { return static_cast<GLuint>((width + tileWidth() - 1) / tileWidth()); }
+    GLuint groupsY(int height) const { return static_cast<GLuint>((height + tileHeight() - 1) / tileHeight()); }
+
+    ShaderVariant withWorkgroup(int x, int y, bool morton) const;
+    ShaderVariant withTraversal(TraversalKind kind) const;
+    ShaderVariant withTraversalStats() const;
+    ShaderVariant withWavefront() const;
+    ShaderVariant withOutputFormat(OutputFormat format) const;
+    // pathTrace が false なら鏡面反射の 1 バウンスに戻す
+    ShaderVariant withPathTracing(bool enable, int bounces) const;
+    ShaderVariant withLightSamples(int samples) const;
+    // Denoiser に渡すときは G-buffer も書き, 出力をリニアの RGBA16F にする
+    ShaderVariant withDenoiser(bool enable, OutputFormat displayFormat) const;
+    ShaderVariant withVisibilityBuffer(bool enable) const;
+    ShaderVariant withStreaming(bool enable) const;
+    ShaderVariant withInstances(bool enable) const;
+};
@@ -0,0 +1,280 @@
+#include "simplify.h"
+#include <algorithm>
+#include <cmath>
+#include <queue>
+
+namespace {
+
+// 対称な 4x4 行列の上三角. 平面 (n, d) からの距離の 2 乗の重み付きの和を表す
+struct Quadric {
+    double a[10];
+    double weight;          // 重みの和. evaluate を割ると距離の 2 乗の平均になる
+
+    Quadric() : weight(0.0) { std::fill(a, a + 10, 0.0); }
+
+    void addPlane(const glm::dvec3& n, double d, double weight) {
+        this->weight += weight;
+        a[0] += weight * n.x * n.x; a[1] += weight * n.x * n.y; a[2] += weight * n.x * n.z; a[3] += weight * n.x * d;
+        a[4] += weight * n.y * n.y; a[5] += weight * n.y * n.z; a[6] += weight * n.y * d;
+        a[7] += weight * n.z * n.z; a[8] += weight * n.z * d;
+        a[9] += weight * d * d;
+    }
+
+    Quadric& operator+=(const Quadric& q) {
+        for (int i = 0; i < 10; ++i) a[i] += q.a[i];
+        weight += q.weight;
+        return *this;
+    }
+
+    // 平面からの距離の 2 乗の平均
+    double evaluate(const glm::dvec3& p) const {
+        if (weight <= 0.0) return 0.0;
+        return (a[0] * p.x * p.x + 2.0 * a[1] * p.x * p.y + 2.0 * a[2] * p.x * p.z + 2.0 * a[3] * p.x +
+               a[4] * p.y * p.y + 2.0 * a[5] * p.y * p.z + 2.0 * a[6] * p.y +
+               a[7] * p.z * p.z + 2.0 * a[8] * p.z + a[9]) / weight;
+    }
+};
+
+// from を to に寄せる縮約の候補. version が古いものは縮約の後に捨てる
+struct Collapse {
+    double cost;
+    unsigned int from;
+    unsigned int to;
+    unsigned int fromVersion;
+    unsigned int toVersion;
+
+    bool operator<(const Collapse& other) const { return cost > other.cost; }
+};
+
+class Simplifier {
+public:
+    Simplifier(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices,
+               const SimplifyOptions& options);
+    std::vector<SimplifiedMesh> run(const std::vector<size_t>& targetTriangles);
+
+private:
+    void lockSeams();
+    void computeQuadrics();
+    void pushEdges(unsigned int v);
+    void pushCollapse(unsigned int a, unsigned int b);
+    bool flips(unsigned int from, unsigned int to) const;
+    void collapse(const Collapse& c);
+    SimplifiedMesh snapshot() const;
+
+    const std::vector<glm::vec3>& positions;
+    SimplifyOptions options;
+    std::vector<unsigned int> faces;                // 3 つずつ. 縮約で番号を書き換える
+    std::vector<bool> faceAlive;
+    size_t liveFaces;
+    std::vector<std::vector<unsigned int>> vertexFaces;
+    std::vector<Quadric> quadrics;
+    std::vector<bool> vertexAlive;
+    std::vector<bool> locked;
+    std::vector<unsigned int> versions;
+    std::priority_queue<Collapse> heap;
+    double error;
+};
+
+Simplifier::Simplifier(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices,
+                       const SimplifyOptions& options)
+    : positions(positions), options(options), faces(indices), faceAlive(indices.size() / 3, true),
+      liveFaces(indices.size() / 3), vertexFaces(positions.size()), quadrics(positions.size()),
+      vertexAlive(positions.size(), true), locked(positions.size(), false), versions(positions.size(), 0), error(0.0) {
+    for (size_t f = 0; f < faceAlive.size(); ++f) {
+        for (int k = 0; k < 3; ++k) vertexFaces[faces[f * 3 + k]].push_back(static_cast<unsigned int>(f));
+    }
+    lockSeams();
+    computeQuadrics();
+    for (unsigned int v = 0; v < positions.size(); ++v) pushEdges(v);
+}
+
+// テクスチャ座標などの継ぎ目では同じ位置の頂点が分かれている. 片側だけ動かすと穴が開くので動かさない
+void Simplifier::lockSeams() {
+    std::vector<unsigned int> order(positions.size());
+    for (unsigned int i = 0; i < order.size(); ++i) order[i] = i;
+    auto less = [this](unsigned int a, unsigned int b) {
+        const glm::vec3& p = positions[a];
+        const glm::vec3& q = positions[b];
+        if (p.x != q.x) return p.x < q.x;
+        if (p.y != q.y) return p.y < q.y;
+        return p.z < q.z;
+    };
+    std::sort(order.begin(), order.end(), less);
+    for (size_t i = 1; i < order.size(); ++i) {
+        if (positions[order[i - 1]] == positions[order[i]]) locked[order[i - 1]] = locked[order[i]] = true;
+    }
+}
+
+void Simplifier::computeQuadrics() {
+    for (size_t f = 0; f < faceAlive.size(); ++f) {
+        glm::dvec3 p[3];
+        for (int k = 0; k < 3; ++k) p[k] = glm::dvec3(positions[faces[f * 3 + k]]);
+        glm::dvec3 n = glm::cross(p[1] - p[0], p[2] - p[0]);
+        double length = glm::length(n);
+        if (length <= 0.0) continue;
+        n /= length;
+        Quadric q;
+        q.addPlane(n, -glm::dot(n, p[0]), 1.0);
+        for (int k = 0; k < 3; ++k) quadrics[faces[f * 3 + k]] += q;
+
+        // 縁の辺 (使う面が一つだけ) は面に垂直な平面で縁から離れないようにする
+        for (int k = 0; k < 3; ++k) {
+            unsigned int a = faces[f * 3 + k];
+            unsigned int b = faces[f * 3 + (k + 1) % 3];
+            int shared = 0;
+            for (unsigned int g : vertexFaces[a]) {
+                for (int j = 0; j < 3; ++j) {
+                    if (faces[g * 3 + j] == b) ++shared;
+                }
+            }
+            if (shared != 1) continue;
+            glm::dvec3 edge = p[(k + 1) % 3] - p[k];
+            glm::dvec3 side = glm::cross(edge, n);
+            double sideLength = glm::length(side);
+            if (sideLength <= 0.0) continue;
+            side /= sideLength;
+            Quadric border;
+            border.addPlane(side, -glm::dot(side, p[k]), options.boundaryWeight);
+            quadrics[a] += border;
+            quadrics[b] += border;
+        }
+    }
+}
+
+void Simplifier::pushEdges(unsigned int v) {
+    for (unsigned int f : vertexFaces[v]) {
+        if (!faceAlive[f]) continue;
+        for (int k = 0; k < 3; ++k) {
+            unsigned int w = faces[f * 3 + k];
+            // 辺は両端から見つかるので, 番号の小さい側からだけ積む
+            if (v < w) pushCollapse(v, w);
+        }
+    }
+}
+
+// 動かせる向きのうち誤差の小さい方を積む
+void Simplifier::pushCollapse(unsigned int a, unsigned int b) {
+    Quadric q = quadrics[a];
+    q += quadrics[b];
+    Collapse best;
+    best.cost = -1.0;
+    if (!locked[a]) {
+        best.cost = q.evaluate(glm::dvec3(positions[b]));
+        best.from = a;
+        best.to = b;
+    }
+    if (!locked[b]) {
+        double cost = q.evaluate(glm::dvec3(positions[a]));
+        if (best.cost < 0.0 || cost < best.cost) {
+            best.cost = cost;
+            best.from = b;
+            best.to = a;
+        }
+    }
+    if (best.cost < 0.0) return;
+    best.cost = std::max(best.cost, 0.0);
+    best.fromVersion = versions[best.from];
+    best.toVersion = versions[best.to];
+    heap.push(best);
+}
+
+// from を to に寄せると残る面のどれかが裏返るか潰れるか
+bool Simplifier::flips(unsigned int from, unsigned int to) const {
+    for (unsigned int f : vertexFaces[from]) {
+        if (!faceAlive[f]) continue;
+        const unsigned int* face = &faces[f * 3];
+        if (face[0] == to || face[1] == to || face[2] == to) continue;
+        glm::vec3 before[3];
+        glm::vec3 after[3];
+        for (int k = 0; k < 3; ++k) {
+            before[k] = positions[face[k]];
+            after[k] = face[k] == from ? positions[to] : before[k];
+        }
+        glm::vec3 n0 = glm::cross(before[1] - before[0], before[2] - before[0]);
+        glm::vec3 n1 = glm::cross(after[1] - after[0], after[2] - after[0]);
+        if (glm::dot(n0, n1) <= 0.0f) return true;
+    }
+    return false;
+}
+
+void Simplifier::collapse(const Collapse& c) {
+    std::vector<unsigned int> merged;
+    for (unsigned int f : vertexFaces[c.to]) {
+        if (faceAlive[f]) merged.push_back(f);
+    }
+    for (unsigned int f : vertexFaces[c.from]) {
+        if (!faceAlive[f]) continue;
+        unsigned int* face = &faces[f * 3];
+        if (face[0] == c.to || face[1] == c.to || face[2] == c.to) {
+            faceAlive[f] = false;
+            --liveFaces;
+            continue;
+        }
+        for (int k = 0; k < 3; ++k) {
+            if (face[k] == c.from) face[k] = c.to;
+        }
+        merged.push_back(f);
+    }
+    // 消えた面は merged に残っていることがある (to の面のうち from も使っていたもの)
+    merged.erase(std::remove_if(merged.begin(), merged.end(), [this](unsigned int f) { return !faceAlive[f]; }),
+                 merged.end());
+    vertexFaces[c.to].swap(merged);
+    vertexFaces[c.from].clear();
+    vertexAlive[c.from] = false;
+    quadrics[c.to] += quadrics[c.from];
+    ++versions[c.to];
+    ++versions[c.from];
+    error = std::max(error, std::sqrt(c.cost));
+
+    // to の周りの辺だけ誤差が変わる. 隣の頂点から to への辺もここで積み直す
+    for (unsigned int f : vertexFaces[c.to]) {
+        for (int k = 0; k < 3; ++k) {
+            unsigned int w = faces[f * 3 + k];
+            if (w != c.to) pushCollapse(c.to, w);
+        }
+    }
+}
+
+SimplifiedMesh Simplifier::snapshot() const {
+    SimplifiedMesh mesh;
+    mesh.indices.reserve(liveFaces * 3);
+    for (size_t f = 0; f < faceAlive.size(); ++f) {
+        if (faceAlive[f]) mesh.indices.insert(mesh.indices.end(), faces.begin() + f * 3, faces.begin() + f * 3 + 3);
+    }
+    mesh.error = static_cast<float>(error);
+    return mesh;
+}
+
+std::vector<SimplifiedMesh> Simplifier::run(const std::vector<size_t>& targetTriangles) {
+    std::vector<SimplifiedMesh> levels;
+    size_t previous = liveFaces;
+    size_t level = 0;
+    while (level < targetTriangles.size()) {
+        if (liveFaces <= targetTriangles[level] || heap.empty()) {
+            // 目標に届かなくても十分減っていれば段にする. 縮約がもう残っていなければ終わり
+            if (liveFaces <= previous * options.minReduction) {
+                levels.push_back(snapshot());
+                previous = liveFaces;
+            }
+            if (heap.empty()) break;
+            ++level;
+            continue;
+        }
+
+        Collapse c = heap.top();
+        heap.pop();
+        if (!vertexAlive[c.from] || !vertexAlive[c.to] ||
+            c.fromVersion != versions[c.from] || c.toVersion != versions[c.to]) continue;
+        if (flips(c.from, c.to)) continue;
+        collapse(c);
+    }
+    return levels;
+}
+
+} // namespace
+
+std::vector<SimplifiedMesh> simplifyMesh(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices,
+                                         const std::vector<size_t>& targetTriangles, const SimplifyOptions& options) {
+    Simplifier simplifier(positions, indices, options);
+    return simplifier.run(targetTriangles);
+}
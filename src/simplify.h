@@ -0,0 +1,25 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+
+// 二次誤差 (QEM) の辺の縮約で三角形を減らす. 頂点は縮約先の既存の頂点に寄せるだけで新しく作らないので,
+// 結果は元の頂点を指すインデックスだけになり, テクスチャ座標などの属性はそのまま使える
+struct SimplifyOptions {
+    float boundaryWeight;       // 開いた縁を保つ二次誤差の重み
+    float minReduction;         // 前の段の三角形数のこの割合より減らなければその段は作らない
+
+    SimplifyOptions() : boundaryWeight(10.0f), minReduction(0.75f) {}
+};
+
+struct SimplifiedMesh {
+    std::vector<unsigned int> indices;
+    float error;                // 縮約で動いた面からの距離の見積もり (positions と同じ単位)
+};
+
+// indices (positions の番号の三角形の並び) を targetTriangles (降順) の三角形数まで順に縮め,
+// 段ごとの結果を返す. 一回の縮約の途中を取り出すので, 後の段は前の段をさらに縮めたものになる.
+// 同じ位置に別の頂点がある継ぎ目の頂点は動かさないので, 目標まで減らせなければ返す段は少なくなる
+std::vector<SimplifiedMesh> simplifyMesh(const std::vector<glm::vec3>& positions, const std::vector<unsigned int>& indices,
+                                         const std::vector<size_t>& targetTriangles,
+                                         const SimplifyOptions& options = SimplifyOptions());
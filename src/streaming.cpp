@@ -0,0 +1,240 @@
+#include "streaming.h"
+#include <algorithm>
+#include <iostream>
+#include "util.h"
+
+namespace {
+
+// 印は数フレーム遅れて読むので, 最後に使われてからこのフレーム数の間は追い出さない
+const uint32_t EVICTION_DELAY = 4;
+
+} // namespace
+
+GeometryStreamer::GeometryStreamer(const std::string& path, const StreamingOptions& options)
+    : file(path), options(options), slotCount(0), pageNodeCapacity(0), pageTriangleCapacity(0),
+      triangleSSBO(0), nodeSSBO(0), topNodeSSBO(0), pageTableSSBO(0), feedbackSSBO(0), feedback(nullptr),
+      feedbackFence(nullptr), pendingCount(0), stopping(false) {
+    int clusterCount = getClusterCount();
+    if (!file.isOpen() || clusterCount == 0) return;
+
+    pageNodeCapacity = file.getPageNodeCapacity();
+    pageTriangleCapacity = file.getPageTriangleCapacity();
+    size_t pageBytes = pageNodeCapacity * sizeof(BVHNode) + pageTriangleCapacity * sizeof(Data);
+    slotCount = static_cast<int>(std::min(std::max<size_t>(options.budgetBytes / pageBytes, 1),
+                                          static_cast<size_t>(clusterCount)));
+
+    glGenBuffers(1, &triangleSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangleSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, slotCount * pageTriangleCapacity * sizeof(Data), nullptr, GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &nodeSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodeSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, slotCount * pageNodeCapacity * sizeof(BVHNode), nullptr, GL_DYNAMIC_DRAW);
+
+    const std::vector<BVHNode>& topNodes = file.getTopNodes();
+    topNodeSSBO = createSSBO(topNodes.data(), topNodes.size() * sizeof(BVHNode), TOP_NODE_BINDING);
+    std::vector<GLint> roots(clusterCount, -1);
+    glGenBuffers(1, &pageTableSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, pageTableSSBO);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, roots.size() * sizeof(GLint), roots.data(), GL_DYNAMIC_DRAW);
+
+    // カーネルが書き, CPU が毎フレーム読むので永続マップにする
+    std::vector<uint32_t> zeros(clusterCount, 0);
+    GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    glGenBuffers(1, &feedbackSSBO);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, feedbackSSBO);
+    glBufferStorage(GL_SHADER_STORAGE_BUFFER, zeros.size() * sizeof(uint32_t), zeros.data(), flags);
+    feedback = static_cast<const uint32_t*>(
+        glMapBufferRange(GL_SHADER_STORAGE_BUFFER, 0, zeros.size() * sizeof(uint32_t), flags));
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    if (!feedback) {
+        std::cerr << "GeometryStreamer: failed to map the feedback buffer" << std::endl;
+    }
+
+    lastUsed.assign(clusterCount, 0);
+    slotOfCluster.assign(clusterCount, -1);
+    pending.assign(clusterCount, false);
+    lruPosition.resize(clusterCount);
+    clusterOfSlot.assign(slotCount, -1);
+    for (int slot = slotCount - 1; slot >= 0; --slot) freeSlots.push_back(slot);
+
+    loader = std::thread(&GeometryStreamer::loadPages, this);
+    std::cout << "streaming: " << clusterCount << " clusters, " << slotCount << " resident pages of "
+              << (pageBytes >> 10) << " KiB" << std::endl;
+}
+
+GeometryStreamer::~GeometryStreamer() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    if (loader.joinable()) loader.join();
+}
+
+// バックグラウンドのスレッド. 頼まれた順にページを読む
+void GeometryStreamer::loadPages() {
+    while (true) {
+        LoadedPage page;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this]() { return stopping || !requests.empty(); });
+            if (stopping) return;
+            page.cluster = requests.front();
+            requests.pop_front();
+        }
+        page.ok = file.readPage(page.cluster, page.nodes, page.triangles);
+        std::lock_guard<std::mutex> lock(mutex);
+        loaded.push_back(std::move(page));
+    }
+}
+
+void GeometryStreamer::update(uint32_t frameIndex) {
+    if (slotCount == 0) return;
+    readFeedback();
+    uploadPages(frameIndex);
+    requestPages(frameIndex);
+}
+
+// 前のフェンスが終わっていれば, それまでのトレースが付けた印を読んで LRU の順を直す
+void GeometryStreamer::readFeedback() {
+    if (!feedback || !feedbackFence) return;
+    GLenum status = glClientWaitSync(feedbackFence, 0, 0);
+    if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) return;
+    glDeleteSync(feedbackFence);
+    feedbackFence = nullptr;
+
+    for (size_t cluster = 0; cluster < lastUsed.size(); ++cluster) {
+        uint32_t stamp = feedback[cluster];
+        if (stamp <= lastUsed[cluster]) continue;
+        lastUsed[cluster] = stamp;
+        if (slotOfCluster[cluster] >= 0) lru.splice(lru.begin(), lru, lruPosition[cluster]);
+    }
+}
+
+// 最近当たったのに読み込まれていないクラスタを, 新しく当たったものから順に頼む
+void GeometryStreamer::requestPages(uint32_t frameIndex) {
+    int room = options.maxPendingLoads - pendingCount;
+    if (room <= 0) return;
+
+    std::vector<int> wanted;
+    for (size_t cluster = 0; cluster < lastUsed.size(); ++cluster) {
+        if (lastUsed[cluster] == 0 || slotOfCluster[cluster] >= 0 || pending[cluster]) continue;
+        if (lastUsed[cluster] + EVICTION_DELAY <= frameIndex) continue;
+        wanted.push_back(static_cast<int>(cluster));
+    }
+    if (wanted.empty()) return;
+    if (static_cast<int>(wanted.size()) > room) {
+        std::partial_sort(wanted.begin(), wanted.begin() + room, wanted.end(),
+                          [this](int a, int b) { return lastUsed[a] > lastUsed[b]; });
+        wanted.resize(room);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int cluster : wanted) {
+            pending[cluster] = true;
+            requests.push_back(cluster);
+        }
+    }
+    pendingCount += static_cast<int>(wanted.size());
+    wake.notify_one();
+}
+
+// 読み終わったページをスロットに上げる. ノードの番号はプール全体のものに直す
+void GeometryStreamer::uploadPages(uint32_t frameIndex) {
+    std::vector<LoadedPage> pages;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        size_t count = std::min(loaded.size(), static_cast<size_t>(options.maxUploadsPerFrame));
+        pages.assign(std::make_move_iterator(loaded.begin()), std::make_move_iterator(loaded.begin() + count));
+        loaded.erase(loaded.begin(), loaded.begin() + count);
+    }
+
+    for (LoadedPage& page : pages) {
+        pending[page.cluster] = false;
+        --pendingCount;
+        if (!page.ok) continue;
+        // スロットが空かなければ捨てる. まだ当たるなら印からまた頼まれる
+        int slot = allocateSlot(frameIndex);
+        if (slot < 0) continue;
+
+        int nodeBase = slot * pageNodeCapacity;
+        int triangleBase = slot * pageTriangleCapacity;
+        for (BVHNode& node : page.nodes) {
+            if (node.parent >= 0) node.parent += nodeBase;
+            if (node.sibling >= 0) node.sibling += nodeBase;
+            if (node.dataOffset >= 0) {
+                node.dataOffset += triangleBase;
+            } else {
+                node.left += nodeBase;
+                node.right += nodeBase;
+            }
+        }
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodeSSBO);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, nodeBase * sizeof(BVHNode), page.nodes.size() * sizeof(BVHNode),
+                        page.nodes.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, triangleSSBO);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, triangleBase * sizeof(Data), page.triangles.size() * sizeof(Data),
+                        page.triangles.data());
+
+        clusterOfSlot[slot] = page.cluster;
+        slotOfCluster[page.cluster] = slot;
+        lru.push_front(page.cluster);
+        lruPosition[page.cluster] = lru.begin();
+        setPageTable(page.cluster, nodeBase);
+    }
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// 空きがなければ一番長く使われていないページを追い出す. それも最近使われていれば -1
+int GeometryStreamer::allocateSlot(uint32_t frameIndex) {
+    if (!freeSlots.empty()) {
+        int slot = freeSlots.back();
+        freeSlots.pop_back();
+        return slot;
+    }
+    int victim = lru.back();
+    if (lastUsed[victim] + EVICTION_DELAY > frameIndex) return -1;
+    lru.pop_back();
+    int slot = slotOfCluster[victim];
+    slotOfCluster[victim] = -1;
+    clusterOfSlot[slot] = -1;
+    setPageTable(victim, -1);
+    return slot;
+}
+
+void GeometryStreamer::setPageTable(int cluster, GLint root) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, pageTableSSBO);
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, cluster * sizeof(GLint), sizeof(GLint), &root);
+}
+
+void GeometryStreamer::bind() {
+    if (slotCount == 0) return;
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, triangleSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, nodeSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, TOP_NODE_BINDING, topNodeSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, PAGE_TABLE_BINDING, pageTableSSBO);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, FEEDBACK_BINDING, feedbackSSBO);
+}
+
+void GeometryStreamer::fence() {
+    if (slotCount == 0 || feedbackFence) return;
+    glMemoryBarrier(GL_CLIENT_MAPPED_BUFFER_BARRIER_BIT);
+    feedbackFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void GeometryStreamer::cleanup() {
+    if (slotCount == 0) return;
+    if (feedbackFence) glDeleteSync(feedbackFence);
+    feedbackFence = nullptr;
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, feedbackSSBO);
+    glUnmapBuffer(GL_SHADER_STORAGE_BUFFER);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+    feedback = nullptr;
+    glDeleteBuffers(1, &triangleSSBO);
+    glDeleteBuffers(1, &nodeSSBO);
+    glDeleteBuffers(1, &topNodeSSBO);
+    glDeleteBuffers(1, &pageTableSSBO);
+    glDeleteBuffers(1, &feedbackSSBO);
+    slotCount = 0;
+}
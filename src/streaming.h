@@ -0,0 +1,99 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <glad/gl.h>
+#include "cluster_file.h"
+
+struct StreamingOptions {
+    size_t budgetBytes;         // GPU に置くページの合計の上限. これでスロットの数が決まる
+    int maxUploadsPerFrame;     // 1 フレームに glBufferSubData で上げるページの数
+    int maxPendingLoads;        // 読み込み待ちのページの数の上限
+
+    StreamingOptions() : budgetBytes(256u << 20), maxUploadsPerFrame(8), maxPendingLoads(32) {}
+};
+
+// ClusterFile のページを必要になったものから GPU のスロットに読み込む.
+// compute_raytracing_1.glsl を STREAMING 付きでコンパイルすると, 上位の木 (binding 19) を手前から順にたどって
+// 読み込み済みのクラスタの BVH だけをトレースし, 一番近い当たりより手前で入ったクラスタにフレーム番号を書く (binding 21).
+// update がその印を読み, 足りないページをバックグラウンドのスレッドに読ませ, 使われていないページから
+// 追い出す (LRU). 読み込まれるまでそのクラスタは見えない
+class GeometryStreamer {
+public:
+    // カーネルの SSBO の binding. スロットのプールは BVH と同じ 0 (三角形) と 1 (ノード) に置く
+    static const GLuint TOP_NODE_BINDING = 19;
+    static const GLuint PAGE_TABLE_BINDING = 20;
+    static const GLuint FEEDBACK_BINDING = 21;
+
+    GeometryStreamer(const std::string& path, const StreamingOptions& options = StreamingOptions());
+    ~GeometryStreamer();
+    bool isOpen() const { return file.isOpen(); }
+
+    // トレースの前に呼ぶ. frameIndex は FrameUniforms::frameIndex (カーネルが印に使う)
+    void update(uint32_t frameIndex);
+    // プールと上位の木を binding に結び付ける. update の後, トレースの前に呼ぶ
+    void bind();
+    // トレースのコマンドを出した後に呼ぶ. 印はこのフェンスが終わってから読む
+    void fence();
+    void cleanup();
+
+    int getClusterCount() const { return static_cast<int>(file.getClusters().size()); }
+    int getSlotCount() const { return slotCount; }
+    int getResidentCount() const { return static_cast<int>(lru.size()); }
+    int getPendingCount() const { return pendingCount; }
+
+private:
+    // バックグラウンドのスレッドが読んだページ
+    struct LoadedPage {
+        int cluster;
+        bool ok;
+        std::vector<BVHNode> nodes;
+        std::vector<Data> triangles;
+    };
+
+    void loadPages();
+    void readFeedback();
+    void requestPages(uint32_t frameIndex);
+    void uploadPages(uint32_t frameIndex);
+    int allocateSlot(uint32_t frameIndex);
+    void setPageTable(int cluster, GLint root);
+
+    ClusterFile file;
+    StreamingOptions options;
+    int slotCount;
+    int pageNodeCapacity;
+    int pageTriangleCapacity;
+
+    GLuint triangleSSBO;    // スロットごとに pageTriangleCapacity 個
+    GLuint nodeSSBO;        // スロットごとに pageNodeCapacity 個. 番号はプール全体のものに直して上げる
+    GLuint topNodeSSBO;
+    GLuint pageTableSSBO;   // クラスタごとのページの根のノード. 読み込まれていなければ -1
+    GLuint feedbackSSBO;    // クラスタごとの最後に当たったフレーム番号 + 1 (永続マップ)
+    const uint32_t* feedback;
+    GLsync feedbackFence;
+
+    // クラスタごとの状態. lastUsed は印から読んだ最後のフレーム
+    std::vector<uint32_t> lastUsed;
+    std::vector<int> slotOfCluster;     // 読み込まれていなければ -1
+    std::vector<bool> pending;
+    std::vector<int> clusterOfSlot;     // 空きなら -1
+    std::vector<int> freeSlots;
+    // 読み込み済みのクラスタ. 前ほど最近使われた
+    std::list<int> lru;
+    std::vector<std::list<int>::iterator> lruPosition;
+    int pendingCount;
+
+    // バックグラウンドのスレッドとの受け渡し
+    std::thread loader;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<int> requests;
+    std::vector<LoadedPage> loaded;
+    bool stopping;
+};
@@ -0,0 +1,133 @@
+#include "temporal.h"
+#include <algorithm>
+#include <cmath>
+#include "parallel.h"
+
+namespace {
+
+float luminance(const glm::vec3& color) {
+    return glm::dot(color, glm::vec3(0.2126f, 0.7152f, 0.0722f));
+}
+
+glm::vec3 demodulate(const glm::vec3& color, const glm::vec3& albedo) {
+    return color / glm::max(albedo, glm::vec3(1e-3f));
+}
+
+// 3x3 の近傍の輝度の分散 (atrous.glsl の prepare). 履歴が短い間はこちらを使う
+float spatialVariance(const std::vector<glm::vec4>& image, const std::vector<GBufferTexel>& gbuffer, int width,
+                      int height, int x, int y) {
+    float sum = 0.0f;
+    float sumSquared = 0.0f;
+    int count = 0;
+    for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+            int qx = x + dx;
+            int qy = y + dy;
+            if (qx < 0 || qy < 0 || qx >= width || qy >= height) continue;
+            int q = qy * width + qx;
+            if (gbuffer[q].depth < 0.0f) continue;
+            float l = luminance(demodulate(glm::vec3(image[q]), gbuffer[q].albedo));
+            sum += l;
+            sumSquared += l * l;
+            ++count;
+        }
+    }
+    float mean = count > 0 ? sum / count : 0.0f;
+    return count > 0 ? std::max(sumSquared / count - mean * mean, 0.0f) : 0.0f;
+}
+
+} // namespace
+
+TemporalAccumulator::TemporalAccumulator(const TemporalOptions& options)
+    : options(options), valid(false), width(0), height(0), previousViewProjection(0.0f), previousPosition(0.0f) {}
+
+void TemporalAccumulator::reset() {
+    valid = false;
+}
+
+int TemporalAccumulator::accumulate(std::vector<glm::vec4>& image, const std::vector<GBufferTexel>& gbuffer,
+                                    const Camera& camera, int width, int height, std::vector<float>& variance) {
+    int numPixels = width * height;
+    bool useHistory = valid && width == this->width && height == this->height;
+    std::vector<glm::vec4> nextHistory(numPixels);
+    std::vector<glm::vec2> nextMoments(numPixels);
+    std::vector<int> reused(numPixels, 0);
+    variance.resize(numPixels);
+
+    parallelFor(0, numPixels, [&](int pixel) {
+        int x = pixel % width;
+        int y = pixel / width;
+        const GBufferTexel& center = gbuffer[pixel];
+        glm::vec3 color = demodulate(glm::vec3(image[pixel]), center.albedo);
+        float l = luminance(color);
+
+        // compute_raytracing_1.glsl の writeGBuffer と同じ動きベクトル, atrous.glsl の temporal と同じ双線形の再投影
+        glm::vec3 historyColor(0.0f);
+        glm::vec2 historyMoments(0.0f);
+        float historyLength = 0.0f;
+        float weightSum = 0.0f;
+        glm::vec4 clip = previousViewProjection * glm::vec4(center.position, 1.0f);
+        if (useHistory && center.depth >= 0.0f && clip.w > 0.0f) {
+            glm::vec2 size(static_cast<float>(width), static_cast<float>(height));
+            glm::vec2 position = (glm::vec2(clip) / clip.w * 0.5f + 0.5f) * size;
+            float distance = glm::length(center.position - previousPosition);
+            int baseX = static_cast<int>(std::floor(position.x));
+            int baseY = static_cast<int>(std::floor(position.y));
+            glm::vec2 f = position - glm::vec2(static_cast<float>(baseX), static_cast<float>(baseY));
+            for (int i = 0; i < 4; ++i) {
+                int ox = i & 1;
+                int oy = i >> 1;
+                int qx = baseX + ox;
+                int qy = baseY + oy;
+                if (qx < 0 || qy < 0 || qx >= width || qy >= height) continue;
+                int q = qy * width + qx;
+                const GBufferTexel& previous = previousGBuffer[q];
+                if (previous.depth < 0.0f || std::fabs(previous.depth - distance) > options.depthTolerance * distance ||
+                    glm::dot(previous.normal, center.normal) < options.normalTolerance)
+                    continue;
+                float w = (ox == 1 ? f.x : 1.0f - f.x) * (oy == 1 ? f.y : 1.0f - f.y);
+                historyColor += w * glm::vec3(history[q]);
+                historyLength += w * history[q].w;
+                historyMoments += w * moments[q];
+                weightSum += w;
+            }
+        }
+        if (weightSum > 1e-3f) {
+            historyColor /= weightSum;
+            historyMoments /= weightSum;
+            historyLength /= weightSum;
+            reused[pixel] = 1;
+        } else {
+            historyLength = 0.0f;
+        }
+
+        historyLength = std::min(historyLength + 1.0f, options.maxHistory);
+        float alpha = 1.0f / historyLength;
+        glm::vec3 accumulated = glm::mix(historyColor, color, alpha);
+        glm::vec2 m = glm::mix(historyMoments, glm::vec2(l, l * l), alpha);
+        nextHistory[pixel] = glm::vec4(accumulated, historyLength);
+        nextMoments[pixel] = m;
+
+        // 時間方向の分散は数フレームたまるまで 3x3 の見積もりで代える
+        variance[pixel] = historyLength >= 4.0f ? std::max(m.y - m.x * m.x, 0.0f)
+                                                : spatialVariance(image, gbuffer, width, height, x, y);
+    });
+
+    // 分散の見積もりが元の image を読むので, 書き換えは最後にまとめる
+    int reusedCount = 0;
+    for (int pixel = 0; pixel < numPixels; ++pixel) {
+        glm::vec3 color = glm::vec3(nextHistory[pixel]) * glm::max(gbuffer[pixel].albedo, glm::vec3(1e-3f));
+        image[pixel] = glm::vec4(color, image[pixel].w);
+        reusedCount += reused[pixel];
+    }
+
+    history.swap(nextHistory);
+    moments.swap(nextMoments);
+    previousGBuffer = gbuffer;
+    previousViewProjection = camera.GetViewProjectionMatrix(static_cast<float>(width) / static_cast<float>(height));
+    previousPosition = camera.Position;
+    this->width = width;
+    this->height = height;
+    valid = true;
+    return reusedCount;
+}
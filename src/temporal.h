@@ -0,0 +1,41 @@
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "atrous.h"
+#include "camera.h"
+
+// atrous.glsl の TEMPORAL_PASS の定数と同じ
+struct TemporalOptions {
+    float maxHistory;       // 新しいフレームの重みは 1 / maxHistory より小さくならない
+    float depthTolerance;   // 同じ面とみなす距離の差 (距離に対する比)
+    float normalTolerance;  // 今と前のフレームの法線の cos の下限
+
+    TemporalOptions() : maxHistory(32.0f), depthTolerance(0.05f), normalTolerance(0.9f) {}
+};
+
+// 前のフレームまでの蓄積を G-buffer の位置と前のカメラで再投影し, 今のフレームと混ぜる (SVGF の時間方向).
+// 距離か法線が合わない画素は前のフレームで隠れていた (disocclusion) ので履歴を捨てる.
+// Denoiser (denoiser.cpp) が GPU で同じ計算をする
+class TemporalAccumulator {
+public:
+    explicit TemporalAccumulator(const TemporalOptions& options = TemporalOptions());
+
+    // image を蓄積した色で置き換え, variance に輝度の分散を返す (atrousFilter に渡す).
+    // gbuffer は Tracer::render が image と一緒に返したもの. 戻り値は履歴を使えた画素の数
+    int accumulate(std::vector<glm::vec4>& image, const std::vector<GBufferTexel>& gbuffer, const Camera& camera,
+                   int width, int height, std::vector<float>& variance);
+    // 次のフレームは履歴なしで始める
+    void reset();
+
+private:
+    TemporalOptions options;
+    bool valid;
+    int width;
+    int height;
+    glm::mat4 previousViewProjection;
+    glm::vec3 previousPosition;
+    std::vector<GBufferTexel> previousGBuffer;
+    std::vector<glm::vec4> history;     // rgb: アルベドで割って蓄積した色, a: 蓄積したフレーム数
+    std::vector<glm::vec2> moments;     // 輝度と輝度の 2 乗の平均
+};
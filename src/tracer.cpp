@@ -0,0 +1,389 @@
+#include "tracer.h"
+#include "parallel.h"
+#include "raysort.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+namespace {
+
+const float BIAS = 0.001f;
+const float INF = 1e30f;
+// compute_raytracing_1.glsl と同じ値
+const float ALBEDO = 0.8f;
+const int ROULETTE_START = 2;
+// パストレースでは直接光にも間接光と同じランバート BRDF (ALBEDO / π) を掛ける (DIRECT_BRDF)
+const float LAMBERT_BRDF = ALBEDO / 3.14159265f;
+// 光源までのシャドウレイは光源の少し手前で止める (三角形の光源自身に当たらないように)
+const float SHADOW_T_SCALE = 0.999f;
+
+glm::vec3 rayDirection(const Camera& camera, float aspectRatio, const glm::vec2& uv) {
+    float tanFov = std::tan(glm::radians(camera.Zoom) / 2.0f);
+    return glm::normalize(uv.x * camera.Right * aspectRatio * tanFov + uv.y * camera.Up * tanFov + camera.Front);
+}
+
+bool intersectAABB(const glm::vec3& origin, const glm::vec3& invDir, const glm::vec3& boxMin, const glm::vec3& boxMax,
+                   float tLimit) {
+    glm::vec3 tMin = (boxMin - origin) * invDir;
+    glm::vec3 tMax = (boxMax - origin) * invDir;
+    glm::vec3 t1 = glm::min(tMin, tMax);
+    glm::vec3 t2 = glm::max(tMin, tMax);
+    float tNear = std::max(std::max(t1.x, t1.y), t1.z);
+    float tFar = std::min(std::min(t2.x, t2.y), t2.z);
+    return tNear <= tFar && tFar > 0.0f && tNear < tLimit;
+}
+
+bool intersectTriangle(const glm::vec3& origin, const glm::vec3& dir, const Data& triangle, float& t) {
+    const float EPSILON = 0.0000001f;
+    glm::vec3 v0(triangle.v0);
+    glm::vec3 edge1 = glm::vec3(triangle.v1) - v0;
+    glm::vec3 edge2 = glm::vec3(triangle.v2) - v0;
+    glm::vec3 h = glm::cross(dir, edge2);
+    float a = glm::dot(edge1, h);
+    if (a > -EPSILON && a < EPSILON) return false;
+
+    float f = 1.0f / a;
+    glm::vec3 s = origin - v0;
+    float u = f * glm::dot(s, h);
+    if (u < 0.0f || u > 1.0f) return false;
+
+    glm::vec3 q = glm::cross(s, edge1);
+    float v = f * glm::dot(dir, q);
+    if (v < 0.0f || u + v > 1.0f) return false;
+
+    t = f * glm::dot(edge2, q);
+    return t > EPSILON;
+}
+
+struct PathState {
+    glm::vec3 origin;
+    glm::vec3 dir;
+    glm::vec3 throughput;
+    int pixel;
+    uint32_t rng;
+};
+
+// compute_raytracing_1.glsl の pcgHash / random と同じ乱数
+uint32_t pcgHash(uint32_t value) {
+    uint32_t state = value * 747796405u + 2891336453u;
+    uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+    return (word >> 22u) ^ word;
+}
+
+float random(uint32_t& state) {
+    state = pcgHash(state);
+    return static_cast<float>(state >> 8u) * (1.0f / 16777216.0f);
+}
+
+// 入射側の半球からコサイン重み付きで方向を選ぶ. BRDF * cos / pdf は ALBEDO だけになる
+glm::vec3 cosineSample(const glm::vec3& normal, const glm::vec3& incoming, uint32_t& rng) {
+    glm::vec3 n = glm::dot(normal, incoming) < 0.0f ? normal : -normal;
+    float side = n.z >= 0.0f ? 1.0f : -1.0f;
+    float a = -1.0f / (side + n.z);
+    float b = n.x * n.y * a;
+    glm::vec3 tangent(1.0f + side * n.x * n.x * a, side * b, -side * n.x);
+    glm::vec3 bitangent(b, side + n.y * n.y * a, -n.y);
+    float u1 = random(rng);
+    float phi = 6.28318530718f * random(rng);
+    float r = std::sqrt(u1);
+    return glm::normalize(tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) +
+                          n * std::sqrt(std::max(1.0f - u1, 0.0f)));
+}
+
+struct ShadowRay {
+    glm::vec3 origin;
+    glm::vec3 dir;
+    float tMax;
+    glm::vec3 contribution;
+    int pixel;
+};
+
+// sort が false なら keys は使わず元の順のまま
+void buildOrder(int count, bool sort, const std::vector<uint32_t>& keys, std::vector<int>& order) {
+    if (sort) {
+        sortRayKeys(keys, RayBinner::KEY_BITS, order);
+        return;
+    }
+    order.resize(count);
+    for (int i = 0; i < count; ++i) order[i] = i;
+}
+
+// 計測しないときの Stats. 呼び出しはすべてインライン展開で消える
+struct NoTraversalStats {
+    void visitNode() {}
+    void testAABB() {}
+    void testTriangles(int) {}
+    void stackDepth(int) {}
+};
+
+double secondsSince(const std::chrono::steady_clock::time_point& start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+} // namespace
+
+Tracer::Tracer(const BVH& bvh) : nodes(bvh.getNodes()), triangles(bvh.getDataArray()) {
+}
+
+template <bool AnyHit, typename Stats>
+bool Tracer::traverse(const glm::vec3& origin, const glm::vec3& dir, float tMax, Hit& hit, Stats& stats) const {
+    if (nodes.empty()) return false;
+
+    glm::vec3 invDir = 1.0f / dir;
+    int stack[BVH_STACK_SIZE];
+    int stackPtr = 0;
+    stack[stackPtr++] = 0;
+
+    bool found = false;
+    hit.t = tMax;
+    int hitIndex = -1;
+
+    while (stackPtr > 0) {
+        const BVHNode& node = nodes[stack[--stackPtr]];
+        stats.testAABB();
+        if (!intersectAABB(origin, invDir, node.min, node.max, hit.t)) continue;
+
+        stats.visitNode();
+        if (node.dataOffset >= 0) {
+            for (int i = node.dataOffset; i < node.dataOffset + node.dataCount; ++i) {
+                float t;
+                stats.testTriangles(1);
+                if (intersectTriangle(origin, dir, triangles[i], t) && t < hit.t) {
+                    found = true;
+                    hit.t = t;
+                    hitIndex = i;
+                    if (AnyHit) return true;
+                }
+            }
+        } else {
+            stack[stackPtr++] = node.right;
+            stack[stackPtr++] = node.left;
+            stats.stackDepth(stackPtr);
+        }
+    }
+
+    if (found) {
+        const Data& triangle = triangles[hitIndex];
+        hit.point = origin + dir * hit.t;
+        hit.normal = glm::normalize(glm::cross(glm::vec3(triangle.v1) - glm::vec3(triangle.v0),
+                                               glm::vec3(triangle.v2) - glm::vec3(triangle.v0)));
+    }
+    return found;
+}
+
+bool Tracer::intersect(const glm::vec3& origin, const glm::vec3& dir, Hit& hit) const {
+    NoTraversalStats stats;
+    return traverse<false>(origin, dir, INF, hit, stats);
+}
+
+bool Tracer::occluded(const glm::vec3& origin, const glm::vec3& dir, float tMax) const {
+    Hit hit;
+    NoTraversalStats stats;
+    return traverse<true>(origin, dir, tMax, hit, stats);
+}
+
+bool Tracer::intersect(const glm::vec3& origin, const glm::vec3& dir, Hit& hit, TraversalStats& stats) const {
+    return traverse<false>(origin, dir, INF, hit, stats);
+}
+
+bool Tracer::occluded(const glm::vec3& origin, const glm::vec3& dir, TraversalStats& stats, float tMax) const {
+    Hit hit;
+    return traverse<true>(origin, dir, tMax, hit, stats);
+}
+
+RenderStats Tracer::render(const Camera& camera, const std::vector<Light>& lights, int width, int height,
+                           std::vector<glm::vec4>& image, const TraceOptions& options,
+                           std::vector<TraversalStats>* pixelStats, std::vector<GBufferTexel>* gbuffer) const {
+    int numPixels = width * height;
+    image.assign(numPixels, glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
+    if (pixelStats) pixelStats->assign(numPixels, TraversalStats());
+
+    RenderStats stats;
+    stats.primaryRays = numPixels;
+    stats.shadowRays = 0;
+    stats.secondaryRays = 0;
+    stats.primarySeconds = 0.0;
+    stats.shadowSeconds = 0.0;
+    stats.secondarySeconds = 0.0;
+    stats.terminatedPaths = 0;
+    if (nodes.empty()) return stats;
+
+    RayBinner binner(nodes[0].min, nodes[0].max);
+    float aspectRatio = static_cast<float>(width) / static_cast<float>(height);
+
+    // 一次レイ
+    std::vector<PathState> paths(numPixels);
+    parallelFor(0, numPixels, [&](int pixel) {
+        int x = pixel % width;
+        int y = pixel / width;
+        glm::vec2 uv = glm::vec2(static_cast<float>(x) / width, static_cast<float>(y) / height) * 2.0f - 1.0f;
+        PathState& path = paths[pixel];
+        path.origin = camera.Position;
+        path.dir = rayDirection(camera, aspectRatio, uv);
+        path.throughput = glm::vec3(1.0f);
+        path.pixel = pixel;
+        path.rng = pcgHash(static_cast<uint32_t>(pixel) ^ pcgHash(options.frameIndex));
+    });
+
+    std::vector<PathState> nextPaths;
+    std::vector<Hit> hits;
+    std::vector<char> hitFlags;
+    std::vector<ShadowRay> shadowRays;
+    std::vector<char> visible;
+    std::vector<uint32_t> keys;
+    std::vector<int> order;
+    std::vector<TraversalStats> rayStats;    // pixelStats 用. 同じ画素のシャドウレイが並列に走るのでレイごとに数える
+
+    for (int bounce = 0; bounce < options.maxBounces && !paths.empty(); ++bounce) {
+        int numPaths = static_cast<int>(paths.size());
+        if (bounce > 0) stats.secondaryRays += numPaths;
+
+        // 一次レイはすでにコヒーレントなので二次レイだけ並べ替える
+        bool sortPaths = options.sortRays && bounce > 0;
+        if (sortPaths) {
+            keys.resize(numPaths);
+            for (int i = 0; i < numPaths; ++i) keys[i] = binner.key(paths[i].origin, paths[i].dir);
+        }
+        buildOrder(numPaths, sortPaths, keys, order);
+
+        hits.resize(numPaths);
+        hitFlags.resize(numPaths);
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if (pixelStats) {
+            rayStats.assign(numPaths, TraversalStats());
+            parallelFor(0, numPaths, [&](int k) {
+                int i = order[k];
+                hitFlags[i] = intersect(paths[i].origin, paths[i].dir, hits[i], rayStats[i]);
+            });
+        } else {
+            parallelFor(0, numPaths, [&](int k) {
+                int i = order[k];
+                hitFlags[i] = intersect(paths[i].origin, paths[i].dir, hits[i]);
+            });
+        }
+        (bounce == 0 ? stats.primarySeconds : stats.secondarySeconds) += secondsSince(start);
+        if (pixelStats) {
+            for (int i = 0; i < numPaths; ++i) (*pixelStats)[paths[i].pixel].add(rayStats[i]);
+        }
+        if (gbuffer && bounce == 0) {
+            // compute_raytracing_1.glsl の writeGBuffer と同じ. 法線はカメラ側に向ける
+            gbuffer->resize(numPixels);
+            for (int i = 0; i < numPaths; ++i) {
+                GBufferTexel& texel = (*gbuffer)[paths[i].pixel];
+                if (hitFlags[i]) {
+                    const Hit& hit = hits[i];
+                    texel.normal = glm::dot(hit.normal, paths[i].dir) > 0.0f ? -hit.normal : hit.normal;
+                    texel.depth = hit.t;
+                    texel.position = hit.point;
+                } else {
+                    texel.normal = glm::vec3(0.0f);
+                    texel.depth = -1.0f;
+                    texel.position = glm::vec3(0.0f);
+                }
+                texel.albedo = glm::vec3(1.0f);
+            }
+        }
+
+        // シャドウレイを集め, 続くパスだけを nextPaths に詰める (computeLighting と同じ拡散反射)
+        shadowRays.clear();
+        nextPaths.clear();
+        bool lastBounce = bounce + 1 >= options.maxBounces;
+        float directBrdf = options.pathTrace ? LAMBERT_BRDF : 1.0f;
+        for (int i = 0; i < numPaths; ++i) {
+            if (!hitFlags[i]) continue;
+            const Hit& hit = hits[i];
+            glm::vec3 shadowOrigin = hit.point + hit.normal * BIAS;
+            if (options.lightBVH) {
+                // 光源を選んだ確率で割った寄与を選んだ数で平均する
+                for (int s = 0; s < options.lightSamples; ++s) {
+                    glm::vec3 u(random(paths[i].rng), random(paths[i].rng), random(paths[i].rng));
+                    LightSample sample;
+                    if (!options.lightBVH->sample(hit.point, u, sample)) continue;
+                    float diffuseFactor = std::max(glm::dot(hit.normal, sample.direction), 0.0f);
+                    if (diffuseFactor <= 0.0f) continue;
+
+                    ShadowRay shadowRay;
+                    shadowRay.origin = shadowOrigin;
+                    shadowRay.dir = sample.direction;
+                    shadowRay.tMax = sample.distance * SHADOW_T_SCALE;
+                    shadowRay.contribution =
+                        paths[i].throughput * sample.radiance * (diffuseFactor * directBrdf / options.lightSamples);
+                    shadowRay.pixel = paths[i].pixel;
+                    shadowRays.push_back(shadowRay);
+                }
+            } else {
+                for (const Light& light : lights) {
+                    glm::vec3 lightDir = glm::normalize(glm::vec3(light.position) - hit.point);
+                    float diffuseFactor = std::max(glm::dot(hit.normal, lightDir), 0.0f);
+                    if (diffuseFactor <= 0.0f) continue;
+
+                    ShadowRay shadowRay;
+                    shadowRay.origin = shadowOrigin;
+                    shadowRay.dir = lightDir;
+                    shadowRay.tMax = INF;
+                    shadowRay.contribution = paths[i].throughput * glm::vec3(light.color) * (diffuseFactor * directBrdf);
+                    shadowRay.pixel = paths[i].pixel;
+                    shadowRays.push_back(shadowRay);
+                }
+            }
+
+            if (lastBounce) continue;
+            PathState next = paths[i];
+            if (options.pathTrace) {
+                next.dir = cosineSample(hit.normal, paths[i].dir, next.rng);
+                next.origin = hit.point + (glm::dot(hit.normal, paths[i].dir) < 0.0f ? hit.normal : -hit.normal) * BIAS;
+                next.throughput = paths[i].throughput * ALBEDO;
+                // ロシアンルーレット: 暗いパスを確率で打ち切り, 残ったパスを重み付けし直す
+                if (bounce + 1 >= ROULETTE_START) {
+                    float survive = glm::clamp(std::max(std::max(next.throughput.x, next.throughput.y),
+                                                        next.throughput.z), 0.05f, 0.95f);
+                    if (random(next.rng) >= survive) {
+                        ++stats.terminatedPaths;
+                        continue;
+                    }
+                    next.throughput /= survive;
+                }
+            } else {
+                next.origin = shadowOrigin;
+                next.dir = glm::reflect(paths[i].dir, hit.normal);
+                next.throughput = paths[i].throughput * 0.5f;
+            }
+            nextPaths.push_back(next);
+        }
+
+        int numShadowRays = static_cast<int>(shadowRays.size());
+        stats.shadowRays += numShadowRays;
+        if (options.sortRays) {
+            keys.resize(numShadowRays);
+            for (int i = 0; i < numShadowRays; ++i) keys[i] = binner.key(shadowRays[i].origin, shadowRays[i].dir);
+        }
+        buildOrder(numShadowRays, options.sortRays, keys, order);
+
+        visible.resize(numShadowRays);
+        start = std::chrono::steady_clock::now();
+        if (pixelStats) {
+            rayStats.assign(numShadowRays, TraversalStats());
+            parallelFor(0, numShadowRays, [&](int k) {
+                int i = order[k];
+                visible[i] = !occluded(shadowRays[i].origin, shadowRays[i].dir, rayStats[i], shadowRays[i].tMax);
+            });
+        } else {
+            parallelFor(0, numShadowRays, [&](int k) {
+                int i = order[k];
+                visible[i] = !occluded(shadowRays[i].origin, shadowRays[i].dir, shadowRays[i].tMax);
+            });
+        }
+        stats.shadowSeconds += secondsSince(start);
+        if (pixelStats) {
+            for (int i = 0; i < numShadowRays; ++i) (*pixelStats)[shadowRays[i].pixel].add(rayStats[i]);
+        }
+
+        // 並べ替える前の順に足すので結果は sortRays によらない
+        for (int i = 0; i < numShadowRays; ++i) {
+            if (visible[i]) image[shadowRays[i].pixel] += glm::vec4(shadowRays[i].contribution, 0.0f);
+        }
+
+        paths.swap(nextPaths);
+    }
+    return stats;
+}
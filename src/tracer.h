@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+#include <glm/glm.hpp>
+#include "bvh.h"
+#include "camera.h"
+#include "light_bvh.h"
+#include "atrous.h"
+
+struct Hit {
+    float t;
+    glm::vec3 point;
+    glm::vec3 normal;
+};
+
+struct TraceOptions {
+    int maxBounces;
+    bool sortRays;      // 二次レイとシャドウレイを RayBinner のキーで並べてからトレースする
+    bool pathTrace;     // コサイン重み付きの拡散反射とロシアンルーレット (compute_raytracing_1.glsl の PATH_TRACE)
+    unsigned int frameIndex;    // 乱数の種
+    // 渡すと lights の代わりに, 当たった点ごとに lightSamples 個の光源を選んでシャドウレイを飛ばす
+    const LightBVH* lightBVH;
+    int lightSamples;
+
+    TraceOptions()
+        : maxBounces(1), sortRays(false), pathTrace(false), frameIndex(0), lightBVH(nullptr), lightSamples(1) {}
+};
+
+struct RenderStats {
+    long long primaryRays;
+    long long shadowRays;
+    long long secondaryRays;
+    double primarySeconds;      // レイの種類ごとのトレース時間
+    double shadowSeconds;
+    double secondarySeconds;
+    long long terminatedPaths;  // ロシアンルーレットで終わったパス
+};
+
+// トラバーサルのコスト計測 (compute_raytracing_1.glsl の TRAVERSAL_STATS と同じ項目)
+struct TraversalStats {
+    long long nodesVisited;     // AABB に当たったノード
+    long long aabbTests;
+    long long triangleTests;
+    int maxStackDepth;
+
+    TraversalStats() : nodesVisited(0), aabbTests(0), triangleTests(0), maxStackDepth(0) {}
+
+    void visitNode() { ++nodesVisited; }
+    void testAABB() { ++aabbTests; }
+    void testTriangles(int count) { triangleTests += count; }
+    void stackDepth(int depth) { maxStackDepth = std::max(maxStackDepth, depth); }
+
+    void add(const TraversalStats& other) {
+        nodesVisited += other.nodesVisited;
+        aabbTests += other.aabbTests;
+        triangleTests += other.triangleTests;
+        maxStackDepth = std::max(maxStackDepth, other.maxStackDepth);
+    }
+};
+
+// compute_raytracing_1.glsl と同じ計算を CPU で行うトレーサー.
+// バウンスごとにレイをまとめてトレースする (wavefront)
+class Tracer {
+public:
+    explicit Tracer(const BVH& bvh);
+
+    bool intersect(const glm::vec3& origin, const glm::vec3& dir, Hit& hit) const;
+    // tMax より手前に何かあれば true
+    bool occluded(const glm::vec3& origin, const glm::vec3& dir, float tMax = 1e30f) const;
+    bool intersect(const glm::vec3& origin, const glm::vec3& dir, Hit& hit, TraversalStats& stats) const;
+    bool occluded(const glm::vec3& origin, const glm::vec3& dir, TraversalStats& stats, float tMax = 1e30f) const;
+
+    // pixelStats を渡すと画素ごとのトラバーサルコストを返す (渡さなければ計測なしのトラバーサルを使う).
+    // gbuffer を渡すと一次レイの当たった面を返す (atrousFilter 用)
+    RenderStats render(const Camera& camera, const std::vector<Light>& lights, int width, int height,
+                       std::vector<glm::vec4>& image, const TraceOptions& options = TraceOptions(),
+                       std::vector<TraversalStats>* pixelStats = nullptr,
+                       std::vector<GBufferTexel>* gbuffer = nullptr) const;
+
+private:
+    // Stats は TraversalStats か何もしない NoTraversalStats (tracer.cpp)
+    template <bool AnyHit, typename Stats>
+    bool traverse(const glm::vec3& origin, const glm::vec3& dir, float tMax, Hit& hit, Stats& stats) const;
+
+    const std::vector<BVHNode>& nodes;
+    const std::vector<Data>& triangles;
+};
@@ -0,0 +1,49 @@
+#include "uniform_ring.h"
+#include <cstring>
+#include <iostream>
+#include "util.h"
+
+UniformRing::UniformRing(GLsizeiptr blockSize, GLuint binding, int slots)
+    : blockSize(blockSize), binding(binding), current(0), fences(slots, nullptr) {
+    GLint alignment = 256;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    stride = (blockSize + alignment - 1) / alignment * alignment;
+
+    void* pointer = nullptr;
+    buffer = createPersistentUBO(stride * slots, binding, &pointer);
+    mapped = static_cast<char*>(pointer);
+    if (!mapped) {
+        std::cerr << "UniformRing: failed to map the uniform buffer" << std::endl;
+    }
+}
+
+void UniformRing::update(const void* data) {
+    current = (current + 1) % static_cast<int>(fences.size());
+    if (fences[current]) {
+        // 通常はすでにシグナル済み. 1 秒待っても終わらなければそのまま上書きする
+        glClientWaitSync(fences[current], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        glDeleteSync(fences[current]);
+        fences[current] = nullptr;
+    }
+    if (!mapped) return;
+
+    std::memcpy(mapped + current * stride, data, blockSize);
+    glBindBufferRange(GL_UNIFORM_BUFFER, binding, buffer, current * stride, blockSize);
+}
+
+void UniformRing::fence() {
+    if (fences[current]) glDeleteSync(fences[current]);
+    fences[current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void UniformRing::cleanup() {
+    for (GLsync& sync : fences) {
+        if (sync) glDeleteSync(sync);
+        sync = nullptr;
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glUnmapBuffer(GL_UNIFORM_BUFFER);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glDeleteBuffers(1, &buffer);
+    mapped = nullptr;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+#include <glad/gl.h>
+
+// 毎フレーム書き換える uniform block 用のリングバッファ (永続マップ).
+// フレームごとに次のスロットへ書いて glBindBufferRange で binding に割り当てる.
+// スロットを GPU がまだ読んでいる間はフェンスで待つ
+class UniformRing {
+public:
+    UniformRing(GLsizeiptr blockSize, GLuint binding, int slots = 3);
+    void update(const void* data);  // フレームの最初に呼ぶ
+    void fence();                   // そのフレームでブロックを読むコマンドを出した後に呼ぶ
+    void cleanup();
+
+private:
+    GLuint buffer;
+    char* mapped;
+    GLsizeiptr blockSize;
+    GLsizeiptr stride;
+    GLuint binding;
+    int current;
+    std::vector<GLsync> fences;
+};
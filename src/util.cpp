@@ -1,5 +1,23 @@
 #include "util.h"
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include "stb_image_write.h"
+
+namespace {
+
+// simple_fragment.glsl と compute_raytracing_1.glsl の encodeOutput と同じ変換 (ACES のフィット + sRGB)
+float encodeChannel(float linear) {
+    float x = std::max(linear, 0.0f);
+    float mapped = std::min((x * (2.51f * x + 0.03f)) / (x * (2.43f * x + 0.59f) + 0.14f), 1.0f);
+    return mapped <= 0.0031308f ? 12.92f * mapped : 1.055f * std::pow(mapped, 1.0f / 2.4f) - 0.055f;
+}
+
+unsigned char toByte(float value) {
+    return static_cast<unsigned char>(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+} // namespace
 
 bool initializeGLFW() {
     if (!glfwInit()) {
@@ -36,11 +54,30 @@ void cleanup(GLFWwindow* window) {
     glfwTerminate();
 }
 
-GLuint createTexture(int width, int height) {
+const char* outputFormatName(OutputFormat format) {
+    static const char* names[NUM_OUTPUT_FORMATS] = {"RGBA32F", "RGBA16F", "R11G11B10F", "RGBA8"};
+    return names[format];
+}
+
+GLenum outputInternalFormat(OutputFormat format) {
+    static const GLenum formats[NUM_OUTPUT_FORMATS] = {GL_RGBA32F, GL_RGBA16F, GL_R11F_G11F_B10F, GL_RGBA8};
+    return formats[format];
+}
+
+const char* outputFormatQualifier(OutputFormat format) {
+    static const char* qualifiers[NUM_OUTPUT_FORMATS] = {"rgba32f", "rgba16f", "r11f_g11f_b10f", "rgba8"};
+    return qualifiers[format];
+}
+
+bool isDisplayFormat(OutputFormat format) {
+    return format == OUTPUT_R11G11B10F || format == OUTPUT_RGBA8;
+}
+
+GLuint createTexture(int width, int height, GLenum internalFormat) {
     GLuint texture;
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
+    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, GL_RGBA, GL_FLOAT, nullptr);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glBindTexture(GL_TEXTURE_2D, 0);
@@ -61,6 +98,38 @@ GLuint createFramebuffer(GLuint texture) {
     return fbo;
 }
 
+bool writeTexturePNG(const std::string& path, GLuint texture, int width, int height, OutputFormat format) {
+    size_t numPixels = static_cast<size_t>(width) * height;
+    std::vector<unsigned char> pixels(numPixels * 4);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    if (format == OUTPUT_RGBA8) {
+        // シェーダーで変換済みなのでそのまま書き出せる
+        glGetTextureSubImage(texture, 0, 0, 0, 0, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE,
+                             static_cast<GLsizei>(pixels.size()), pixels.data());
+    } else {
+        std::vector<float> texels(numPixels * 4);
+        glGetTextureSubImage(texture, 0, 0, 0, 0, width, height, 1, GL_RGBA, GL_FLOAT,
+                             static_cast<GLsizei>(texels.size() * sizeof(float)), texels.data());
+        bool encode = !isDisplayFormat(format);
+        for (size_t i = 0; i < numPixels; ++i) {
+            for (int c = 0; c < 3; ++c) {
+                float value = texels[i * 4 + c];
+                pixels[i * 4 + c] = toByte(encode ? encodeChannel(value) : value);
+            }
+            pixels[i * 4 + 3] = 255;
+        }
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+    // OpenGL のテクスチャは下の行から並んでいる
+    stbi_flip_vertically_on_write(1);
+    if (!stbi_write_png(path.c_str(), width, height, 4, pixels.data(), width * 4)) {
+        std::cerr << "Failed to write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
 GLuint createUBO(const void* data, GLsizeiptr size, GLuint binding) {
     GLuint ubo;
     glGenBuffers(1, &ubo);
@@ -71,6 +140,19 @@ GLuint createUBO(const void* data, GLsizeiptr size, GLuint binding) {
     return ubo;
 }
 
+// 永続マップした UBO. coherent なので書いた内容はフラッシュなしで GPU から見える
+GLuint createPersistentUBO(GLsizeiptr size, GLuint binding, void** mapped) {
+    const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLuint ubo;
+    glGenBuffers(1, &ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+    glBufferStorage(GL_UNIFORM_BUFFER, size, nullptr, flags);
+    *mapped = glMapBufferRange(GL_UNIFORM_BUFFER, 0, size, flags);
+    glBindBufferBase(GL_UNIFORM_BUFFER, binding, ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    return ubo;
+}
+
 GLuint createSSBO(const void* data, size_t size, GLuint binding) {
     GLuint ssbo;
     glGenBuffers(1, &ssbo);
@@ -83,6 +165,12 @@ GLuint createSSBO(const void* data, size_t size, GLuint binding) {
 
 std::vector<Data> makeData(const std::vector<Triangle>& triangles) {
     std::vector<Data> data;
+    makeData(triangles, data);
+    return data;
+}
+
+void makeData(const std::vector<Triangle>& triangles, std::vector<Data>& data) {
+    data.clear();
     data.reserve(triangles.size());
 
     for (const auto& triangle : triangles) {
@@ -92,5 +180,4 @@ std::vector<Data> makeData(const std::vector<Triangle>& triangles) {
         d.v2 = glm::vec4(triangle.v2, 0.0f);
         data.push_back(d);
     }
-    return data;
 }
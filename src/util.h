@@ -1,5 +1,6 @@
 #pragma once
 
+#include <string>
 #include <vector>
 #include <glm/glm.hpp>
 #include <glad/gl.h>
@@ -12,8 +13,19 @@ bool initializeGLAD();
 GLFWwindow* createWindow(int width, int height, const char* title);
 void cleanup(GLFWwindow* window);
 
-GLuint createTexture(int width, int height);
+// 出力画像の形式. 蓄積用の形式はリニアの HDR を保持し, Quad が表示時にトーンマップと sRGB 変換をする.
+// 表示用の形式にはコンピュートシェーダーが変換済みの値を書く (compute_raytracing_1.glsl の ENCODE_OUTPUT)
+enum OutputFormat { OUTPUT_RGBA32F, OUTPUT_RGBA16F, OUTPUT_R11G11B10F, OUTPUT_RGBA8, NUM_OUTPUT_FORMATS };
+const char* outputFormatName(OutputFormat format);
+GLenum outputInternalFormat(OutputFormat format);
+// GLSL の image format qualifier (例: "rgba16f")
+const char* outputFormatQualifier(OutputFormat format);
+bool isDisplayFormat(OutputFormat format);
+
+GLuint createTexture(int width, int height, GLenum internalFormat = GL_RGBA32F);
 GLuint createFramebuffer(GLuint texture);
+// texture の左下 width x height を PNG に書き出す. format は texture を作ったときのもの
+bool writeTexturePNG(const std::string& path, GLuint texture, int width, int height, OutputFormat format);
 
 struct Data {
     glm::vec4 v0;
@@ -21,6 +33,31 @@ struct Data {
     glm::vec4 v2;
 };
 
+struct Light {
+    glm::vec4 position;
+    glm::vec4 color;
+};
+
+// compute_raytracing_1.glsl の FrameUniforms (std140, binding 0). vec3 の後ろに 4 バイトの値を詰める
+struct FrameUniforms {
+    glm::vec3 cameraPosition;
+    float aspectRatio;
+    glm::vec3 cameraFront;
+    float fov;
+    glm::vec3 cameraUp;
+    int numLights;
+    glm::vec3 cameraRight;
+    unsigned int frameIndex;
+    glm::ivec2 renderSize;      // 出力テクスチャのうち実際にトレースする範囲 (DynamicResolution)
+    glm::ivec2 padding;
+    glm::mat4 previousViewProjection;   // 前のフレームのカメラ. G-buffer の動きベクトル (Denoiser の再投影) 用
+    glm::vec3 previousCameraPosition;
+    float padding2;
+};
+
 GLuint createUBO(const void* data, GLsizeiptr size, GLuint binding);
+GLuint createPersistentUBO(GLsizeiptr size, GLuint binding, void** mapped);
 GLuint createSSBO(const void* data, size_t size, GLuint binding);
 std::vector<Data> makeData(const std::vector<Triangle>& triangles);
+// data の容量を使い回す版. 中身は置き換える
+void makeData(const std::vector<Triangle>& triangles, std::vector<Data>& data);
@@ -0,0 +1,107 @@
+#include "visibility.h"
+#include <algorithm>
+#include <iostream>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+namespace {
+
+// compute_raytracing_1.glsl の Primitives
+const GLuint PRIMITIVE_BINDING = 11;
+
+} // namespace
+
+VisibilityBuffer::VisibilityBuffer(const std::vector<Data>& primitives, int width, int height)
+    : width(0), height(0),
+      shader(SOURCE_DIR "/src/shader/visibility_vertex.glsl", SOURCE_DIR "/src/shader/visibility_fragment.glsl",
+             SOURCE_DIR "/src/shader/visibility_geometry.glsl") {
+    primitiveSSBO = createSSBO(primitives.data(), primitives.size() * sizeof(Data), PRIMITIVE_BINDING);
+    viewProjectionLocation = shader.getUniformLocation("viewProjection");
+    allocate(width, height);
+}
+
+void VisibilityBuffer::allocate(int width, int height) {
+    if (this->width > 0) release();
+    this->width = width;
+    this->height = height;
+
+    // 整数の形式は createTexture (GL_RGBA, GL_FLOAT で確保する) が使えないので不変のストレージにする
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32UI, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    // DrawCuller が Hi-Z を作るので深度もテクスチャにする
+    glGenTextures(1, &depth);
+    glBindTexture(GL_TEXTURE_2D, depth);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "VisibilityBuffer: framebuffer is not complete" << std::endl;
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void VisibilityBuffer::release() {
+    glDeleteFramebuffers(1, &framebuffer);
+    glDeleteTextures(1, &depth);
+    glDeleteTextures(1, &texture);
+}
+
+void VisibilityBuffer::resize(int width, int height) {
+    if (width <= this->width && height <= this->height) return;
+    allocate(std::max(width, this->width), std::max(height, this->height));
+}
+
+void VisibilityBuffer::render(Model& model, const Camera& camera, const glm::ivec2& renderSize, DrawCuller* culler) {
+    // カーネルの一次レイは画素の左下の角 (uv = pixel / size * 2 - 1) を通るので, 半画素ずらして
+    // ラスタライズの標本点 (画素の中心) をそこに合わせる
+    float aspectRatio = static_cast<float>(renderSize.x) / static_cast<float>(renderSize.y);
+    glm::mat4 shift = glm::translate(glm::mat4(1.0f), glm::vec3(1.0f / renderSize.x, 1.0f / renderSize.y, 0.0f));
+    glm::mat4 viewProjection = shift * camera.GetViewProjectionMatrix(aspectRatio);
+    if (culler) culler->cull(viewProjection);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, renderSize.x, renderSize.y);
+    const GLuint miss[4] = {0, 0, 0, 0};
+    glClearBufferuiv(GL_COLOR, 0, miss);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    // 裏面も一次レイは当たるので描く
+    glDisable(GL_CULL_FACE);
+    glEnable(GL_DEPTH_TEST);
+
+    shader.use();
+    glUniformMatrix4fv(viewProjectionLocation, 1, GL_FALSE, glm::value_ptr(viewProjection));
+    if (culler) {
+        model.DrawVisibility(shader, culler->commandBuffer(), culler->countBuffer());
+    } else {
+        model.DrawVisibility(shader);
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    // 次のフレームの遮蔽の判定に使う
+    if (culler) {
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+        culler->buildHiZ(depth, renderSize, viewProjection);
+    }
+}
+
+void VisibilityBuffer::bind() {
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, texture);
+}
+
+void VisibilityBuffer::cleanup() {
+    release();
+    glDeleteBuffers(1, &primitiveSSBO);
+    glDeleteProgram(shader.ID);
+}
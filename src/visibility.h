@@ -0,0 +1,42 @@
+#pragma once
+
+#include <vector>
+#include <glad/gl.h>
+#include <glm/glm.hpp>
+#include "camera.h"
+#include "culling.h"
+#include "model.h"
+#include "shader.h"
+#include "util.h"
+
+// 一次レイの代わりにモデルの VAO をラスタライズし, 画素ごとに三角形の番号と重心座標 (RG32UI) を書く.
+// compute_raytracing_1.glsl を VISIBILITY_BUFFER 付きでコンパイルすると最初の交差をここから読み,
+// シャドウレイと二次レイだけをトレースする. 三角形は BVH の並べ替え前の順 (Model::getIndexBufferTriangles) で引く
+class VisibilityBuffer {
+public:
+    // primitives は makeData(model.getIndexBufferTriangles()) (SSBO binding 11 に置く)
+    VisibilityBuffer(const std::vector<Data>& primitives, int width, int height);
+    // 描画範囲の最大. テクスチャは大きくなるときだけ作り直す
+    void resize(int width, int height);
+
+    // camera から見た左下 renderSize に描く. トレースの前に呼ぶ.
+    // culler があれば見えるコマンドだけを culler の段で描き, 描いた深度で culler の Hi-Z を作り直す.
+    // culler がなければいつも段 0
+    void render(Model& model, const Camera& camera, const glm::ivec2& renderSize, DrawCuller* culler = nullptr);
+    // カーネルの usampler2D visibilityBuffer (texture unit 0) に結び付ける
+    void bind();
+    void cleanup();
+
+private:
+    void allocate(int width, int height);
+    void release();
+
+    int width;
+    int height;
+    GLuint texture;
+    GLuint depth;           // GL_DEPTH_COMPONENT32F のテクスチャ
+    GLuint framebuffer;
+    GLuint primitiveSSBO;
+    Shader shader;
+    GLint viewProjectionLocation;
+};
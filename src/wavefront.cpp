@@ -0,0 +1,96 @@
+#include "wavefront.h"
+#include "util.h"
+
+namespace {
+
+// compute_raytracing_1.glsl の RayState (std430)
+const size_t RAY_STATE_SIZE = 48;
+// RayQueue: dispatchArgs, inCount, outCount, padding, binCounts, binOffsets
+const size_t RAY_QUEUE_SIZE = 32 + 2 * Wavefront::NUM_BINS * sizeof(GLuint);
+
+// compute_raytracing_1.glsl (WAVEFRONT) と ray_sort.glsl の uniform の layout(location)
+const GLint BOUNCE_LOCATION = 0;
+const GLint MAX_BOUNCES_LOCATION = 1;
+const GLint SORT_RAYS_LOCATION = 2;
+const GLint SORT_PASS_LOCATION = 0;
+
+} // namespace
+
+Wavefront::Wavefront(int width, int height)
+    : width(width), height(height), capacity(0), sortShader(SOURCE_DIR "/src/shader/ray_sort.glsl") {
+    allocate(static_cast<size_t>(width) * height);
+    queueBuffer = createSSBO(nullptr, RAY_QUEUE_SIZE, 7);
+}
+
+void Wavefront::allocate(size_t numRays) {
+    if (capacity > 0) {
+        glDeleteBuffers(2, rayBuffers);
+        glDeleteBuffers(1, &keyBuffer);
+        glDeleteBuffers(1, &orderBuffer);
+    }
+    capacity = numRays;
+    rayBuffers[0] = createSSBO(nullptr, numRays * RAY_STATE_SIZE, 3);
+    rayBuffers[1] = createSSBO(nullptr, numRays * RAY_STATE_SIZE, 4);
+    keyBuffer = createSSBO(nullptr, numRays * sizeof(GLuint), 5);
+    orderBuffer = createSSBO(nullptr, numRays * sizeof(GLuint), 6);
+}
+
+void Wavefront::resize(int width, int height) {
+    this->width = width;
+    this->height = height;
+    size_t numRays = static_cast<size_t>(width) * height;
+    if (numRays > capacity) allocate(numRays);
+}
+
+void Wavefront::render(Cshader& traceShader, GLuint outputTexture, OutputFormat outputFormat, int maxBounces,
+                       bool sortRays) {
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, queueBuffer);
+    glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 5, keyBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 6, orderBuffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 7, queueBuffer);
+    glBindImageTexture(0, outputTexture, 0, GL_FALSE, 0, GL_READ_WRITE, outputInternalFormat(outputFormat));
+
+    // 一次レイ: 画素ごとに起動し, 二次レイをキューに書き出す
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, rayBuffers[1]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, rayBuffers[0]);
+    traceShader.use();
+    traceShader.setInt(BOUNCE_LOCATION, 0);
+    traceShader.setInt(MAX_BOUNCES_LOCATION, maxBounces);
+    traceShader.setBool(SORT_RAYS_LOCATION, sortRays);
+    glDispatchCompute((width + 15) / 16, (height + 15) / 16, 1);
+
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, queueBuffer);
+    for (int bounce = 1; bounce < maxBounces; ++bounce) {
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+
+        // キューの受け渡しと間接ディスパッチの引数 (並べ替えない場合も必要)
+        sortShader.use();
+        sortShader.setInt(SORT_PASS_LOCATION, 0);
+        glDispatchCompute(1, 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+        if (sortRays) {
+            sortShader.setInt(SORT_PASS_LOCATION, 1);
+            glDispatchComputeIndirect(0);
+            glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        }
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, rayBuffers[(bounce - 1) % 2]);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, rayBuffers[bounce % 2]);
+        traceShader.use();
+        traceShader.setInt(BOUNCE_LOCATION, bounce);
+        glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+        glDispatchComputeIndirect(0);
+    }
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+}
+
+void Wavefront::cleanup() {
+    glDeleteBuffers(2, rayBuffers);
+    glDeleteBuffers(1, &keyBuffer);
+    glDeleteBuffers(1, &orderBuffer);
+    glDeleteBuffers(1, &queueBuffer);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <glad/gl.h>
+#include "cshader.h"
+#include "util.h"
+
+// 二次レイを一度キューに書き出し, キーで並べ替えてから次のバウンスをトレースするパイプライン.
+// トレースには compute_raytracing_1.glsl を WAVEFRONT 付きでコンパイルしたものを使う
+class Wavefront {
+public:
+    // レイキーの軸ごとのビット数 (シェーダの CELL_BITS). RayBinner::CELL_BITS (6) より粗いのは,
+    // ビンの走査を 1 ワークグループで毎バウンス行うため
+    static const int CELL_BITS = 3;
+    static const int NUM_BINS = 8 << (3 * CELL_BITS);  // ray_sort.glsl の NUM_BINS
+
+    Wavefront(int width, int height);
+    // 描画範囲を変える. バッファは大きくなるときだけ確保し直す
+    void resize(int width, int height);
+    // outputFormat は traceShader の ShaderVariant::outputFormat (蓄積用の形式)
+    void render(Cshader& traceShader, GLuint outputTexture, OutputFormat outputFormat, int maxBounces, bool sortRays);
+    void cleanup();
+
+private:
+    void allocate(size_t numRays);
+
+    int width;
+    int height;
+    size_t capacity;    // 確保済みのレイの数
+    Cshader sortShader;
+    GLuint rayBuffers[2];
+    GLuint keyBuffer;
+    GLuint orderBuffer;
+    GLuint queueBuffer;
+};